@@ -89,6 +89,8 @@ static void DisplayConstantTab(AddonImGui::AddonUIData& instance, ShaderToggler:
         return;
     }
 
+    instance.GetConstantHandler()->SetViewedGroup(group);
+
     std::shared_lock<std::shared_mutex> lock(instance.GetConstantHandler()->GetBufferMutex());
 
     static float height = ImGui::GetWindowHeight();
@@ -113,6 +115,8 @@ static void DisplayConstantTab(AddonImGui::AddonUIData& instance, ShaderToggler:
     uint32_t selectedStageIndex = group->getCBShaderStage();
     const char* selectedStage = stageItems[selectedStageIndex];
 
+    int readbackLatency = static_cast<int>(group->getCBReadbackLatency());
+
     bool extractionEnabled = group->getExtractConstants();
     ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(0, 0));
     if (ImGui::BeginChild("Constant Buffer Viewer##child", { 0, height / 1.5f }, true, ImGuiChildFlags_AlwaysAutoResize))
@@ -204,6 +208,17 @@ static void DisplayConstantTab(AddonImGui::AddonUIData& instance, ShaderToggler:
 
             ImGui::TableNextRow();
 
+            ImGui::TableNextColumn();
+            ImGui::Text("Readback latency");
+            ImGui::TableNextColumn();
+            ImGui::SliderInt("##ReadbackLatency", &readbackLatency, 0, static_cast<int>(ShaderToggler::MAX_CB_READBACK_LATENCY), readbackLatency == 1 ? "%d frame" : "%d frames");
+            if (ImGui::IsItemHovered())
+            {
+                ImGui::SetTooltip("GPU readback only: read the constants this many frames after copying them, which avoids waiting for the GPU at the cost of lagging behind.");
+            }
+
+            ImGui::TableNextRow();
+
             DisplayConstantSettings(group);
 
             ImGui::EndTable();
@@ -211,6 +226,7 @@ static void DisplayConstantTab(AddonImGui::AddonUIData& instance, ShaderToggler:
         group->setExtractConstant(extractionEnabled);
         group->setCBIsPushMode(cbModeSelectionIndex == 1);
         group->setCBShaderStage(selectedStageIndex);
+        group->setCBReadbackLatency(static_cast<uint32_t>(readbackLatency));
 
         ImGui::Separator();
 
@@ -62,6 +62,9 @@ AddonUIData::AddonUIData(ShaderManager* pixelShaderManager, ShaderManager* verte
     _keyBindings[Keybind::INVOCATION_UP] = VK_NUMPAD8;
     _keyBindings[Keybind::DESCRIPTOR_DOWN] = VK_SUBTRACT;
     _keyBindings[Keybind::DESCRIPTOR_UP] = VK_ADD;
+
+    _toggleGroupIndexOwner = make_unique<ToggleGroupIndex>(_toggleGroupEpoch, vector<ToggleGroup*>(), array<size_t, 3>{});
+    _toggleGroupIndex.store(_toggleGroupIndexOwner.get(), memory_order_release);
 }
 
 
@@ -91,66 +94,45 @@ void AddonUIData::AssignPreferredGroupTechniques(std::unordered_map<std::string,
     }
 }
 
-const vector<ToggleGroup*>* AddonUIData::GetToggleGroupsForPixelShaderHash(uint32_t hash)
+void AddonUIData::UpdateToggleGroupsForShaderHashes()
 {
-    const auto& it = _pixelShaderHashToToggleGroups.find(hash);
-
-    if (it != _pixelShaderHashToToggleGroups.end())
-    {
-        return &it->second;
-    }
-
-    return nullptr;
-}
+    const bool hunting = _pixelShaderManager->isInHuntingMode() || _vertexShaderManager->isInHuntingMode() || _computeShaderManager->isInHuntingMode();
 
-const vector<ToggleGroup*>* AddonUIData::GetToggleGroupsForVertexShaderHash(uint32_t hash)
-{
-    const auto& it = _vertexShaderHashToToggleGroups.find(hash);
+    vector<ToggleGroup*> groups;
+    array<size_t, 3> hashCounts = { 0, 0, 0 };
+    groups.reserve(_toggleGroups.size());
 
-    if (it != _vertexShaderHashToToggleGroups.end())
+    for (auto& [_, group] : _toggleGroups)
     {
-        return &it->second;
+        groups.push_back(&group);
+        hashCounts[0] += group.getPixelShaderHashes().size() + 1;
+        hashCounts[1] += group.getVertexShaderHashes().size() + 1;
+        hashCounts[2] += group.getComputeShaderHashes().size() + 1;
     }
 
-    return nullptr;
-}
-
-const vector<ToggleGroup*>* AddonUIData::GetToggleGroupsForComputeShaderHash(uint32_t hash)
-{
-    const auto& it = _computeShaderHashToToggleGroups.find(hash);
+    auto index = make_unique<ToggleGroupIndex>(++_toggleGroupEpoch, std::move(groups), hashCounts);
+    const vector<ToggleGroup*>& indexedGroups = index->GetGroups();
 
-    if (it != _computeShaderHashToToggleGroups.end())
+    for (uint32_t i = 0; i < indexedGroups.size(); i++)
     {
-        return &it->second;
-    }
+        const ToggleGroup& group = *indexedGroups[i];
 
-    return nullptr;
-}
-
-void AddonUIData::UpdateToggleGroupsForShaderHashes()
-{
-    _pixelShaderHashToToggleGroups.clear();
-    _vertexShaderHashToToggleGroups.clear();
-    _computeShaderHashToToggleGroups.clear();
-
-    for (auto& [_,group] : _toggleGroups)
-    {
         // Only consider the currently hunted hash for the group being edited
-        if (group.getId() == _toggleGroupIdShaderEditing && (_pixelShaderManager->isInHuntingMode() || _vertexShaderManager->isInHuntingMode() || _computeShaderManager->isInHuntingMode()))
+        if (group.getId() == _toggleGroupIdShaderEditing && hunting)
         {
             if (_pixelShaderManager->isInHuntingMode())
             {
-                _pixelShaderHashToToggleGroups[_pixelShaderManager->getActiveHuntedShaderHash()].push_back(&group);
+                index->Add(0, _pixelShaderManager->getActiveHuntedShaderHash(), i);
             }
 
             if (_vertexShaderManager->isInHuntingMode())
             {
-                _vertexShaderHashToToggleGroups[_vertexShaderManager->getActiveHuntedShaderHash()].push_back(&group);
+                index->Add(1, _vertexShaderManager->getActiveHuntedShaderHash(), i);
             }
 
             if (_computeShaderManager->isInHuntingMode())
             {
-                _computeShaderHashToToggleGroups[_computeShaderManager->getActiveHuntedShaderHash()].push_back(&group);
+                index->Add(2, _computeShaderManager->getActiveHuntedShaderHash(), i);
             }
 
             continue;
@@ -158,18 +140,66 @@ void AddonUIData::UpdateToggleGroupsForShaderHashes()
 
         for (const auto& h : group.getPixelShaderHashes())
         {
-            _pixelShaderHashToToggleGroups[h].push_back(&group);
+            index->Add(0, h, i);
         }
 
         for (const auto& h : group.getVertexShaderHashes())
         {
-            _vertexShaderHashToToggleGroups[h].push_back(&group);
+            index->Add(1, h, i);
         }
 
         for (const auto& h : group.getComputeShaderHashes())
         {
-            _computeShaderHashToToggleGroups[h].push_back(&group);
+            index->Add(2, h, i);
+        }
+    }
+
+    // Readers may still be using the previous index, keep it around for a bit
+    _toggleGroupIndex.store(index.get(), memory_order_release);
+    _retiredToggleGroupIndices.emplace_back(std::move(_toggleGroupIndexOwner), _presentCount);
+    _toggleGroupIndexOwner = std::move(index);
+}
+
+void AddonUIData::UpdateActiveToggleGroups()
+{
+    _toggleGroupIndexOwner->UpdateActiveGroups();
+}
+
+void AddonUIData::ReleaseRetiredToggleGroupIndices()
+{
+    _presentCount++;
+
+    std::erase_if(_retiredToggleGroupIndices, [&](const auto& retired) { return _presentCount - retired.second > 2; });
+}
+
+void AddonUIData::UpdateStateTrackingInterest()
+{
+    StateTracking::tracking_interest interest;
+
+    // Inactive groups are included as well: bindings stay until the game replaces them, a group which is toggled on has to find the ones
+    // made while it was off
+    for (const auto& [id, group] : _toggleGroups)
+    {
+        if (group.getExtractConstants())
+        {
+            interest.add(group.getCBShaderStage(), group.getCBSlotIndex());
         }
+
+        if (group.getExtractResourceViews())
+        {
+            interest.add(group.getSRVShaderStage(), group.getBindingSRVSlotIndex());
+        }
+
+        if (group.getRenderToResourceViews())
+        {
+            interest.add(group.getRenderSRVShaderStage(), group.getRenderSRVSlotIndex());
+        }
+    }
+
+    if (interest != _stateTrackingInterest)
+    {
+        _stateTrackingInterest = interest;
+        state_tracking::set_interest(interest);
     }
 }
 
@@ -265,22 +295,9 @@ void AddonUIData::LoadShaderTogglerIniFile(const string& fileName)
     {
         group.loadState(iniFile, groupCounter);		// groupCounter is normally 0 or greater. For when the old format is detected, it's -1 (and there's 1 group).
         groupCounter++;
-
-        for (const auto& h : group.getPixelShaderHashes())
-        {
-            _pixelShaderHashToToggleGroups[h].push_back(&group);
-        }
-
-        for (const auto& h : group.getVertexShaderHashes())
-        {
-            _vertexShaderHashToToggleGroups[h].push_back(&group);
-        }
-
-        for (const auto& h : group.getComputeShaderHashes())
-        {
-            _computeShaderHashToToggleGroups[h].push_back(&group);
-        }
     }
+
+    UpdateToggleGroupsForShaderHashes();
 }
 
 
@@ -37,6 +37,8 @@
 #include "ShaderManager.h"
 #include "CDataFile.h"
 #include "ToggleGroup.h"
+#include "ToggleGroupIndex.h"
+#include "StateTracking.h"
 #include "ConstantHandlerBase.h"
 #include "EffectData.h"
 
@@ -102,9 +104,12 @@ namespace AddonImGui
         std::atomic_int _toggleGroupIdEffectEditing = -1;
         std::atomic_int _toggleGroupIdConstantEditing = -1;
         std::unordered_map<int, ShaderToggler::ToggleGroup> _toggleGroups;
-        std::unordered_map<uint32_t, std::vector<ShaderToggler::ToggleGroup*>> _pixelShaderHashToToggleGroups;
-        std::unordered_map<uint32_t, std::vector<ShaderToggler::ToggleGroup*>> _vertexShaderHashToToggleGroups;
-        std::unordered_map<uint32_t, std::vector<ShaderToggler::ToggleGroup*>> _computeShaderHashToToggleGroups;
+        std::atomic<ShaderToggler::ToggleGroupIndex*> _toggleGroupIndex = nullptr;
+        std::unique_ptr<ShaderToggler::ToggleGroupIndex> _toggleGroupIndexOwner;
+        std::vector<std::pair<std::unique_ptr<ShaderToggler::ToggleGroupIndex>, uint32_t>> _retiredToggleGroupIndices;	// superseded indices with the present they were retired at
+        uint32_t _toggleGroupEpoch = 0;
+        uint32_t _presentCount = 0;
+        StateTracking::tracking_interest _stateTrackingInterest;
         int _startValueFramecountCollectionPhase = FRAMECOUNT_COLLECTION_PHASE_DEFAULT;
         float _overlayOpacity = 0.2f;
         uint32_t _keyBindings[ARRAYSIZE(KeybindNames)];
@@ -120,10 +125,28 @@ namespace AddonImGui
     public:
         AddonUIData(ShaderToggler::ShaderManager* pixelShaderManager, ShaderToggler::ShaderManager* vertexShaderManager, ShaderToggler::ShaderManager* computeShaderManager, Shim::Constants::ConstantHandlerBase* constants, std::atomic_uint32_t* activeCollectorFrameCounter);
         std::unordered_map<int, ShaderToggler::ToggleGroup>& GetToggleGroups();
-        const std::vector<ShaderToggler::ToggleGroup*>* GetToggleGroupsForPixelShaderHash(uint32_t hash);
-        const std::vector<ShaderToggler::ToggleGroup*>* GetToggleGroupsForVertexShaderHash(uint32_t hash);
-        const std::vector<ShaderToggler::ToggleGroup*>* GetToggleGroupsForComputeShaderHash(uint32_t hash);
+        /// <summary>
+        /// Returns the current shader hash to toggle group index. Never null. Indices which got replaced stay valid for a couple of presents.
+        /// </summary>
+        const ShaderToggler::ToggleGroupIndex* GetToggleGroupIndex() const { return _toggleGroupIndex.load(std::memory_order_acquire); }
+        /// <summary>
+        /// Rebuilds the shader hash to toggle group index. Anything caching lookups in it has to redo them once the epoch of the index changed.
+        /// </summary>
         void UpdateToggleGroupsForShaderHashes();
+        /// <summary>
+        /// Updates the active group bitset of the current toggle group index, call after toggling a group.
+        /// </summary>
+        void UpdateActiveToggleGroups();
+        /// <summary>
+        /// Frees toggle group indices which were replaced at least two presents ago. Called once per present.
+        /// </summary>
+        void ReleaseRetiredToggleGroupIndices();
+        /// <summary>
+        /// Collects the CB and SRV stages and slots of all groups and passes them to the state tracking, so it only captures what is read
+        /// back. Called once per present, which picks up any change to the group settings made in the UI.
+        /// </summary>
+        void UpdateStateTrackingInterest();
+        uint32_t GetToggleGroupEpoch() const { return GetToggleGroupIndex()->GetEpoch(); }
         void AddDefaultGroup();
         const std::atomic_int& GetToggleGroupIdShaderEditing() const;
         void EndShaderEditing(bool acceptCollectedShaderHashes, ShaderToggler::ToggleGroup& groupEditing);
@@ -591,7 +591,7 @@ static void DisplayGroupView(AddonImGui::AddonUIData& instance, Rendering::Resou
         return;
     }
 
-    const std::unordered_set<uint32_t>& hashes = shaderManager->getCollectedShaderHashes();
+    const std::vector<uint32_t>& hashes = shaderManager->getCollectedShaderHashes();
     static int32_t selected = -1;
     uint32_t index = 0;
     ImGuiStyle style = ImGui::GetStyle();
@@ -600,10 +600,17 @@ static void DisplayGroupView(AddonImGui::AddonUIData& instance, Rendering::Resou
     {
         for (auto h : hashes)
         {
+            if (h == 0)
+            {
+                // released since the last merge
+                index++;
+                continue;
+            }
+
             ImGui::TableNextColumn();
 
             bool marked = false;
-            if (shaderManager->isHuntedShaderMarked(shaderManager->getCollectedShaderHash(index)))
+            if (shaderManager->isHuntedShaderMarked(h))
             {
                 marked = true;
                 ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 1.0f, 0.0f, 1.0f));
@@ -953,6 +960,12 @@ static void DisplayTextureBindings(AddonImGui::AddonUIData& instance, ShaderTogg
 
 static void DisplayOverlay(AddonImGui::AddonUIData& instance, Rendering::ResourceManager& resManager, reshade::api::effect_runtime* runtime)
 {
+    // Set again by the constant tab if it's shown this frame
+    if (instance.GetConstantHandler() != nullptr)
+    {
+        instance.GetConstantHandler()->SetViewedGroup(nullptr);
+    }
+
     if (instance.GetToggleGroupIdShaderEditing() >= 0)
     {
         std::string editingGroupName = "";
@@ -1219,6 +1232,29 @@ static void DisplaySettings(AddonImGui::AddonUIData& instance, reshade::api::eff
         }
     }
 
+    if (ImGui::CollapsingHeader("Statistics", ImGuiTreeNodeFlags_None))
+    {
+        const ShaderToggler::ShaderManager* managers[] = { instance.GetPixelShaderManager(), instance.GetVertexShaderManager(), instance.GetComputeShaderManager() };
+        const char* managerNames[] = { "Pixel", "Vertex", "Compute" };
+
+        for (uint32_t i = 0; i < IM_ARRAYSIZE(managers); i++)
+        {
+            ImGui::Text(std::format("{} shaders: {} unique in {} pipelines", managerNames[i], managers[i]->getShaderCount(), managers[i]->getPipelineCount()).c_str());
+        }
+
+        const ShaderToggler::ToggleGroupIndex* groupIndex = instance.GetToggleGroupIndex();
+        for (uint32_t i = 0; i < IM_ARRAYSIZE(managers); i++)
+        {
+            const ShaderToggler::ShaderGroupTable& table = groupIndex->GetShaderGroupTable(i);
+            ImGui::Text(std::format("{} group filter: {} hashes, {} lookups rejected, {:.2f}% false positives", managerNames[i], table.GetHashCount(), table.GetFilterRejectCount(), table.GetFilterFalsePositiveRate() * 100.0).c_str());
+        }
+
+        ImGui::Text(std::format("State snapshot blocks allocated: {}", StateTracking::snapshot_arena::get_block_allocation_count()).c_str());
+        const StateTracking::state_call_count stateCalls = StateTracking::state_block::get_state_call_stats();
+        ImGui::Text(std::format("State restore calls last frame: {} issued, {} saved", stateCalls.issued, stateCalls.saved).c_str());
+        ImGui::Text(std::format("Descriptor heap mirror: {:.1f} MB", static_cast<double>(runtime->get_device()->get_private_data<descriptor_tracking>().get_heap_mirror_memory()) / (1024.0 * 1024.0)).c_str());
+    }
+
     if (ImGui::CollapsingHeader("List of Toggle Groups", ImGuiTreeNodeFlags_DefaultOpen))
     {
         if (ImGui::Button(" New "))
@@ -1246,6 +1282,7 @@ static void DisplaySettings(AddonImGui::AddonUIData& instance, reshade::api::eff
             if (groupActive != group.isActive())
             {
                 group.toggleActive();
+                instance.UpdateActiveToggleGroups();
 
                 if (!groupActive && instance.GetConstantHandler() != nullptr)
                 {
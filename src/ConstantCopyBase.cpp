@@ -4,8 +4,10 @@ using namespace Shim::Constants;
 using namespace reshade::api;
 using namespace std;
 
-unordered_map<uint64_t, vector<uint8_t>> ConstantCopyBase::deviceToHostConstantBuffer;
-shared_mutex ConstantCopyBase::deviceHostMutex;
+HostConstantBufferStore ConstantCopyBase::hostConstantBuffers;
+atomic<uint32_t> ConstantCopyBase::currentFrame = 1;
+vector<ConstantCopyBase::PendingSeed> ConstantCopyBase::pendingSeeds;
+mutex ConstantCopyBase::seedMutex;
 
 ConstantCopyBase::ConstantCopyBase()
 {
@@ -17,57 +19,150 @@ ConstantCopyBase::~ConstantCopyBase()
 
 }
 
-void ConstantCopyBase::GetHostConstantBuffer(reshade::api::command_list* cmd_list, ShaderToggler::ToggleGroup* group, vector<uint8_t>& dest, size_t size, uint64_t resourceHandle)
+void ConstantCopyBase::GetHostConstantBuffer(reshade::api::command_list* cmd_list, ShaderToggler::ToggleGroup* group, vector<uint8_t>& dest, size_t size, uint64_t resourceHandle, const vector<ShaderToggler::ConstantSpan>* spans)
 {
-    shared_lock<shared_mutex> lock(deviceHostMutex);
-    const auto& it = deviceToHostConstantBuffer.find(resourceHandle);
-    if (it != deviceToHostConstantBuffer.end())
+    const auto copy = [&dest, size, spans](const uint8_t* data, size_t bufferSize) {
+        CopyConstantSpans(dest.data(), data, std::min(size, bufferSize), spans);
+        };
+
+    if (hostConstantBuffers.Read(resourceHandle, currentFrame.load(memory_order_relaxed), copy) != HostConstantBufferStore::ReadResult::Missing)
+    {
+        return;
+    }
+
+    // First read of this buffer, start copying it from now on
+    device* dev = cmd_list->get_device();
+    const resource_desc desc = dev->get_resource_desc(resource{ resourceHandle });
+    if (desc.heap == memory_heap::cpu_to_gpu && static_cast<uint32_t>(desc.usage & resource_usage::constant_buffer))
     {
-        auto& [_, buffer] = *it;
-        std::memcpy(dest.data(), buffer.data(), size);
+        CreateHostConstantBuffer(dev, resource{ resourceHandle }, static_cast<size_t>(desc.buffer.size));
+        RequestSeed(cmd_list, resource{ resourceHandle }, desc.buffer.size);
     }
 }
 
 void ConstantCopyBase::CreateHostConstantBuffer(device* dev, resource resource, size_t size)
 {
-    unique_lock<shared_mutex> lock(deviceHostMutex);
-    deviceToHostConstantBuffer.emplace(resource.handle, vector<uint8_t>(size, 0));
+    hostConstantBuffers.Create(resource.handle, size, currentFrame.load(memory_order_relaxed));
+}
+
+void ConstantCopyBase::RequestSeed(command_list* cmd_list, resource resource, uint64_t size)
+{
+    device* dev = cmd_list->get_device();
+
+    PendingSeed seed = { dev, resource.handle, { 0 }, size, currentFrame.load(memory_order_relaxed) };
+    if (!dev->create_resource(resource_desc(size, memory_heap::gpu_to_cpu, resource_usage::copy_dest), nullptr, resource_usage::copy_dest, &seed.staging))
+    {
+        // The host copy is handed out once the buffer is written instead
+        reshade::log_message(reshade::log_level::warning, "Failed to create constant buffer seed readback buffer!");
+        return;
+    }
+
+    cmd_list->copy_resource(resource, seed.staging);
+
+    unique_lock<mutex> lock(seedMutex);
+    pendingSeeds.push_back(seed);
+}
+
+void ConstantCopyBase::ResolveSeeds(uint32_t frame)
+{
+    unique_lock<mutex> lock(seedMutex);
+
+    // Same guarantee the group readback buffers rely on: the copy has long finished once that many frames have passed
+    erase_if(pendingSeeds, [frame](const PendingSeed& seed) {
+        if (frame - seed.copyFrame <= ShaderToggler::MAX_CB_READBACK_LATENCY + 1)
+        {
+            return false;
+        }
+
+        void* data = nullptr;
+        if (seed.handle != 0 && seed.device->map_buffer_region(seed.staging, 0, seed.size, map_access::read_only, &data))
+        {
+            hostConstantBuffers.Seed(seed.handle, data, static_cast<size_t>(seed.size));
+            seed.device->unmap_buffer_region(seed.staging);
+        }
+
+        seed.device->destroy_resource(seed.staging);
+        return true;
+        });
+}
+
+bool ConstantCopyBase::HasHostConstantBuffer(uint64_t handle)
+{
+    return hostConstantBuffers.Contains(handle);
 }
 
 void ConstantCopyBase::DeleteHostConstantBuffer(resource resource)
 {
-    unique_lock<shared_mutex> lock(deviceHostMutex);
-    deviceToHostConstantBuffer.erase(resource.handle);
+    hostConstantBuffers.Erase(resource.handle);
 }
 
 inline void ConstantCopyBase::SetHostConstantBuffer(const uint64_t handle, const void* buffer, size_t size, uintptr_t offset, uint64_t bufferSize)
 {
-    unique_lock<shared_mutex> lock(deviceHostMutex);
-    const auto& it = deviceToHostConstantBuffer.find(handle);
-    if (it != deviceToHostConstantBuffer.end())
-    {
-        auto& [_, cBuffer] = *it;
-        memcpy(&cBuffer[offset], buffer, size);
-    }
+    hostConstantBuffers.Write(handle, buffer, size, offset);
 }
 
 void ConstantCopyBase::OnInitResource(device* device, const resource_desc& desc, const subresource_data* initData, resource_usage usage, reshade::api::resource handle)
 {
+    // Host copies are created on the first read of a buffer, see GetHostConstantBuffer
+}
+
+void ConstantCopyBase::OnDestroyResource(device* device, resource res)
+{
+    resource_desc desc = device->get_resource_desc(res);
     if (desc.heap == memory_heap::cpu_to_gpu && static_cast<uint32_t>(desc.usage & resource_usage::constant_buffer))
     {
-        CreateHostConstantBuffer(device, handle, static_cast<size_t>(desc.buffer.size));
-        if (initData != nullptr && initData->data != nullptr)
+        DeleteHostConstantBuffer(res);
+
+        // The handle may be reused by a new buffer before the seed is resolved, its staging buffer is still destroyed in ResolveSeeds
+        unique_lock<mutex> lock(seedMutex);
+        for (PendingSeed& seed : pendingSeeds)
         {
-            SetHostConstantBuffer(handle.handle, initData->data, static_cast<size_t>(desc.buffer.size), 0, desc.buffer.size);
+            if (seed.handle == res.handle)
+            {
+                seed.handle = 0;
+            }
         }
     }
 }
 
-void ConstantCopyBase::OnDestroyResource(device* device, resource res)
+void ConstantCopyBase::OnDestroyDevice(device* device)
 {
-    resource_desc desc = device->get_resource_desc(res);
-    if (desc.heap == memory_heap::cpu_to_gpu && static_cast<uint32_t>(desc.usage & resource_usage::constant_buffer))
+    unique_lock<mutex> lock(seedMutex);
+
+    erase_if(pendingSeeds, [device](const PendingSeed& seed) {
+        if (seed.device != device)
+        {
+            return false;
+        }
+
+        device->destroy_resource(seed.staging);
+        return true;
+        });
+}
+
+void ConstantCopyBase::OnReshadePresent()
+{
+    const uint32_t frame = currentFrame.fetch_add(1, memory_order_relaxed) + 1;
+
+    hostConstantBuffers.EvictIdle(frame, SUBSCRIPTION_IDLE_FRAMES);
+    ResolveSeeds(frame);
+}
+
+void ConstantCopyBase::CopyConstantSpans(uint8_t* dest, const uint8_t* src, size_t size, const vector<ShaderToggler::ConstantSpan>* spans)
+{
+    if (spans == nullptr)
     {
-        DeleteHostConstantBuffer(res);
+        memcpy(dest, src, size);
+        return;
     }
-}
\ No newline at end of file
+
+    for (const auto& span : *spans)
+    {
+        if (span.offset >= size)
+        {
+            break;
+        }
+
+        memcpy(dest + span.offset, src + span.offset, std::min(static_cast<size_t>(span.size), size - span.offset));
+    }
+}
@@ -3,9 +3,11 @@
 #include <reshade_api.hpp>
 #include <reshade_api_device.hpp>
 #include <reshade_api_pipeline.hpp>
-#include <unordered_map>
-#include <shared_mutex>
+#include <atomic>
+#include <mutex>
+#include <vector>
 #include "ToggleGroup.h"
+#include "HostConstantBufferStore.h"
 
 namespace Shim
 {
@@ -19,7 +21,11 @@ namespace Shim
             virtual bool Init() = 0;
             virtual bool UnInit() = 0;
 
-            virtual void GetHostConstantBuffer(reshade::api::command_list* cmd_list, ShaderToggler::ToggleGroup* group, std::vector<uint8_t>& dest, size_t size, uint64_t resourceHandle);
+            /// <summary>
+            /// Copies the content of the constant buffer resourceHandle to dest. If spans isn't nullptr only the bytes in those ranges are
+            /// copied, the rest of dest is left untouched.
+            /// </summary>
+            virtual void GetHostConstantBuffer(reshade::api::command_list* cmd_list, ShaderToggler::ToggleGroup* group, std::vector<uint8_t>& dest, size_t size, uint64_t resourceHandle, const std::vector<ShaderToggler::ConstantSpan>* spans);
             virtual void CreateHostConstantBuffer(reshade::api::device* dev, reshade::api::resource resource, size_t size);
             virtual void DeleteHostConstantBuffer(reshade::api::resource resource);
             virtual inline void SetHostConstantBuffer(const uint64_t handle, const void* buffer, size_t size, uintptr_t offset, uint64_t bufferSize);
@@ -30,9 +36,55 @@ namespace Shim
             virtual void OnUpdateBufferRegion(reshade::api::device* device, const void* data, reshade::api::resource resource, uint64_t offset, uint64_t size) = 0;
             virtual void OnMapBufferRegion(reshade::api::device* device, reshade::api::resource resource, uint64_t offset, uint64_t size, reshade::api::map_access access, void** data) = 0;
             virtual void OnUnmapBufferRegion(reshade::api::device* device, reshade::api::resource resource) = 0;
+
+            /// <summary>
+            /// Advances the frame counter of the subscriptions and drops the host copies of buffers which weren't read for a while.
+            /// </summary>
+            virtual void OnReshadePresent();
+
+            /// <summary>
+            /// Releases what was kept for group, which stopped reading constants or was removed.
+            /// </summary>
+            virtual void OnGroupRemoved(const ShaderToggler::ToggleGroup* group, reshade::api::device* device) {}
+
+            /// <summary>
+            /// Destroys the resources created on device, which is about to be destroyed.
+            /// </summary>
+            virtual void OnDestroyDevice(reshade::api::device* device);
+
+            /// <summary>
+            /// Copies the first size bytes of src to dest, or only the bytes in spans (clamped to size) if spans isn't nullptr.
+            /// </summary>
+            static void CopyConstantSpans(uint8_t* dest, const uint8_t* src, size_t size, const std::vector<ShaderToggler::ConstantSpan>* spans);
         protected:
-            static std::unordered_map<uint64_t, std::vector<uint8_t>> deviceToHostConstantBuffer;
-            static std::shared_mutex deviceHostMutex;
+            static constexpr uint32_t SUBSCRIPTION_IDLE_FRAMES = 120;
+
+            bool HasHostConstantBuffer(uint64_t handle);
+
+            // Host copies of constant buffers. Buffers are only copied once a group asked for their content (see GetHostConstantBuffer),
+            // everything else isn't tracked at all. A copy only sees the writes made after it was created, so what the buffer held before
+            // is read back from the GPU once and seeded into it, unless it's written first. It's handed out once either happened.
+            static HostConstantBufferStore hostConstantBuffers;
+            static std::atomic<uint32_t> currentFrame;
+
+        private:
+            struct PendingSeed
+            {
+                reshade::api::device* device = nullptr;     // device staging was created on
+                uint64_t handle = 0;                        // 0 once the buffer was destroyed
+                reshade::api::resource staging = { 0 };
+                uint64_t size = 0;
+                uint32_t copyFrame = 0;
+            };
+
+            /// <summary>
+            /// Copies the current content of resource into a staging buffer, to seed its newly created host copy with once the copy finished.
+            /// </summary>
+            static void RequestSeed(reshade::api::command_list* cmd_list, reshade::api::resource resource, uint64_t size);
+            static void ResolveSeeds(uint32_t frame);
+
+            static std::vector<PendingSeed> pendingSeeds;
+            static std::mutex seedMutex;
         };
     }
 }
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cstring>
 #include "ConstantCopyGPUReadback.h"
 #include "PipelinePrivateData.h"
@@ -8,17 +9,66 @@ using namespace ShaderToggler;
 using namespace std;
 
 
-void ConstantCopyGPUReadback::GetHostConstantBuffer(reshade::api::command_list* cmd_list, ShaderToggler::ToggleGroup* group, vector<uint8_t>& dest, size_t size, uint64_t resourceHandle)
+void ConstantCopyGPUReadback::GetHostConstantBuffer(reshade::api::command_list* cmd_list, ShaderToggler::ToggleGroup* group, vector<uint8_t>& dest, size_t size, uint64_t resourceHandle, const vector<ShaderToggler::ConstantSpan>* spans)
 {
+    const uint32_t latency = std::min(group->getCBReadbackLatency(), ShaderToggler::MAX_CB_READBACK_LATENCY);
+
+    if (latency == 0)
+    {
+        CopyToHost(cmd_list, group, dest, size, resourceHandle, spans);
+    }
+    else
+    {
+        CopyToRing(cmd_list, group, dest, size, resourceHandle, spans, latency);
+    }
+}
+
+void ConstantCopyGPUReadback::CopyRegions(command_list* cmd_list, resource src, resource dst, size_t size, const vector<ShaderToggler::ConstantSpan>* spans)
+{
+    if (spans == nullptr)
+    {
+        cmd_list->copy_resource(src, dst);
+        return;
+    }
+
+    for (const auto& span : *spans)
+    {
+        if (span.offset >= size)
+        {
+            break;
+        }
+
+        cmd_list->copy_buffer_region(src, span.offset, dst, span.offset, std::min(static_cast<uint64_t>(span.size), static_cast<uint64_t>(size - span.offset)));
+    }
+}
+
+void ConstantCopyGPUReadback::CopyToHost(reshade::api::command_list* cmd_list, ShaderToggler::ToggleGroup* group, vector<uint8_t>& dest, size_t size, uint64_t resourceHandle, const vector<ShaderToggler::ConstantSpan>* spans)
+{
+    {
+        const uint32_t frame = currentFrame.load(memory_order_relaxed);
+
+        unique_lock<mutex> lock(ringMutex);
+
+        DestroyRetiredSlots(frame);
+
+        // The group went back to reading without latency, its staging buffers aren't needed anymore
+        RetireRing(group, frame);
+    }
+
     resource src = resource{ resourceHandle };
     ShaderToggler::GroupResource& dst = group->GetGroupResource(ShaderToggler::GroupResourceType::RESOURCE_CONSTANTS_COPY);
     if (groupResourceManager.IsCompatibleWithGroupFormat(cmd_list->get_device(), ShaderToggler::GroupResourceType::RESOURCE_CONSTANTS_COPY, src, group))
     {
+        if (spans != nullptr && spans->empty())
+        {
+            return;
+        }
+
         void* data = nullptr;
-        cmd_list->copy_resource(src, dst.res);
+        CopyRegions(cmd_list, src, dst.res, size, spans);
         if (cmd_list->get_device()->map_buffer_region(dst.res, 0, size, map_access::read_only, &data))
         {
-            memcpy(dest.data(), data, size);
+            CopyConstantSpans(dest.data(), static_cast<const uint8_t*>(data), size, spans);
             cmd_list->get_device()->unmap_buffer_region(dst.res);
         }
     }
@@ -27,4 +77,163 @@ void ConstantCopyGPUReadback::GetHostConstantBuffer(reshade::api::command_list*
         dst.state = ShaderToggler::GroupResourceState::RESOURCE_INVALID;
         dst.target_description = cmd_list->get_device()->get_resource_desc(src);
     }
-}
\ No newline at end of file
+}
+
+void ConstantCopyGPUReadback::CopyToRing(reshade::api::command_list* cmd_list, ShaderToggler::ToggleGroup* group, vector<uint8_t>& dest, size_t size, uint64_t resourceHandle, const vector<ShaderToggler::ConstantSpan>* spans, uint32_t latency)
+{
+    if (spans != nullptr && spans->empty())
+    {
+        return;
+    }
+
+    device* dev = cmd_list->get_device();
+    const resource src = resource{ resourceHandle };
+    const uint64_t bufferSize = dev->get_resource_desc(src).buffer.size;
+    const uint32_t frame = currentFrame.load(memory_order_relaxed);
+
+    unique_lock<mutex> lock(ringMutex);
+
+    DestroyRetiredSlots(frame);
+
+    ReadbackRing& ring = groupRings[group];
+
+    // The latency went down, the slots beyond the new ring size won't be read anymore
+    if (ring.latency != latency)
+    {
+        for (uint32_t i = latency + 1; i < ring.slots.size(); i++)
+        {
+            RetireSlot(ring.slots[i], frame);
+        }
+
+        ring.current = std::min(ring.current, latency);
+        ring.latency = latency;
+    }
+
+    // One copy per group and frame, later draws in the same frame copy into the same slot again
+    if (!ring.slots[ring.current].pending || ring.slots[ring.current].copyFrame != frame)
+    {
+        ring.current = (ring.current + 1) % (latency + 1);
+    }
+
+    // Slots created on another device are replaced, the group draws on this one now
+    ReadbackSlot& slot = ring.slots[ring.current];
+    if (slot.res == 0 || slot.size != bufferSize || slot.device != dev)
+    {
+        RetireSlot(slot, frame);
+
+        if (!dev->create_resource(resource_desc(bufferSize, memory_heap::gpu_to_cpu, resource_usage::copy_dest | resource_usage::copy_source), nullptr, resource_usage::copy_dest, &slot.res))
+        {
+            reshade::log_message(reshade::log_level::error, "Failed to create group constant readback buffer!");
+            slot.res = resource{ 0 };
+            return;
+        }
+
+        slot.device = dev;
+        slot.size = bufferSize;
+    }
+
+    CopyRegions(cmd_list, src, slot.res, static_cast<size_t>(bufferSize), spans);
+    slot.copyFrame = frame;
+    slot.pending = true;
+
+    // Read the newest copy which is at least latency frames old. Until there is one the group keeps its previous constants.
+    const ReadbackSlot* latest = nullptr;
+    for (const ReadbackSlot& candidate : ring.slots)
+    {
+        if (candidate.pending && candidate.device == dev && frame - candidate.copyFrame >= latency && (latest == nullptr || frame - candidate.copyFrame < frame - latest->copyFrame))
+        {
+            latest = &candidate;
+        }
+    }
+
+    void* data = nullptr;
+    if (latest != nullptr && dev->map_buffer_region(latest->res, 0, latest->size, map_access::read_only, &data))
+    {
+        CopyConstantSpans(dest.data(), static_cast<const uint8_t*>(data), std::min(size, static_cast<size_t>(latest->size)), spans);
+        dev->unmap_buffer_region(latest->res);
+    }
+}
+
+void ConstantCopyGPUReadback::OnGroupRemoved(const ShaderToggler::ToggleGroup* group, device* device)
+{
+    const uint32_t frame = currentFrame.load(memory_order_relaxed);
+
+    unique_lock<mutex> lock(ringMutex);
+
+    RetireRing(group, frame);
+    DestroyRetiredSlots(frame);
+}
+
+void ConstantCopyGPUReadback::OnDestroyDevice(device* device)
+{
+    unique_lock<mutex> lock(ringMutex);
+
+    // The device is gone once this returns, so its buffers are destroyed right away instead of after the copy latency
+    for (auto it = groupRings.begin(); it != groupRings.end();)
+    {
+        bool empty = true;
+
+        for (ReadbackSlot& slot : it->second.slots)
+        {
+            if (slot.device == device)
+            {
+                device->destroy_resource(slot.res);
+                slot = ReadbackSlot{};
+            }
+
+            empty &= slot.res == 0;
+        }
+
+        it = empty ? groupRings.erase(it) : std::next(it);
+    }
+
+    erase_if(retiredSlots, [device](const ReadbackSlot& slot) {
+        if (slot.device != device)
+        {
+            return false;
+        }
+
+        device->destroy_resource(slot.res);
+        return true;
+        });
+}
+
+void ConstantCopyGPUReadback::RetireSlot(ReadbackSlot& slot, uint32_t frame)
+{
+    if (slot.res != 0)
+    {
+        slot.copyFrame = frame;
+        retiredSlots.push_back(slot);
+    }
+
+    slot = ReadbackSlot{};
+}
+
+void ConstantCopyGPUReadback::RetireRing(const ShaderToggler::ToggleGroup* group, uint32_t frame)
+{
+    const auto it = groupRings.find(group);
+    if (it == groupRings.end())
+    {
+        return;
+    }
+
+    for (ReadbackSlot& slot : it->second.slots)
+    {
+        RetireSlot(slot, frame);
+    }
+    groupRings.erase(it);
+}
+
+void ConstantCopyGPUReadback::DestroyRetiredSlots(uint32_t frame)
+{
+    // Retired buffers may still be the target of a copy in flight, keep them until that's guaranteed to have finished
+    erase_if(retiredSlots, [frame](const ReadbackSlot& slot) {
+        if (frame - slot.copyFrame <= ShaderToggler::MAX_CB_READBACK_LATENCY + 1)
+        {
+            return false;
+        }
+
+        slot.device->destroy_resource(slot.res);
+        return true;
+        });
+}
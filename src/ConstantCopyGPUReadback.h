@@ -5,6 +5,8 @@
 #include <reshade_api_pipeline.hpp>
 #include <unordered_map>
 #include <vector>
+#include <array>
+#include <mutex>
 #include <shared_mutex>
 #include "ConstantCopyBase.h"
 #include "ToggleGroupResourceManager.h"
@@ -20,7 +22,7 @@ namespace Shim
             bool Init() override final { return true; };
             bool UnInit() override final { return true; };
 
-            virtual void GetHostConstantBuffer(reshade::api::command_list* cmd_list, ShaderToggler::ToggleGroup* group, std::vector<uint8_t>& dest, size_t size, uint64_t resourceHandle) override final;
+            virtual void GetHostConstantBuffer(reshade::api::command_list* cmd_list, ShaderToggler::ToggleGroup* group, std::vector<uint8_t>& dest, size_t size, uint64_t resourceHandle, const std::vector<ShaderToggler::ConstantSpan>* spans) override final;
             virtual void CreateHostConstantBuffer(reshade::api::device* dev, reshade::api::resource resource, size_t size) override final {};
             virtual void DeleteHostConstantBuffer(reshade::api::resource resource) override final {};
             virtual void SetHostConstantBuffer(const uint64_t handle, const void* buffer, size_t size, uintptr_t offset, uint64_t bufferSize) override final {};
@@ -32,8 +34,41 @@ namespace Shim
             virtual void OnMapBufferRegion(reshade::api::device* device, reshade::api::resource resource, uint64_t offset, uint64_t size, reshade::api::map_access access, void** data) override final {};
             virtual void OnUnmapBufferRegion(reshade::api::device* device, reshade::api::resource resource) override final {};
 
+            virtual void OnGroupRemoved(const ShaderToggler::ToggleGroup* group, reshade::api::device* device) override final;
+            virtual void OnDestroyDevice(reshade::api::device* device) override final;
+
         private:
-            std::unordered_map<uint64_t, reshade::api::resource> resToCopyBuffer;
+            struct ReadbackSlot
+            {
+                reshade::api::device* device = nullptr;     // device res was created on
+                reshade::api::resource res = { 0 };
+                uint64_t size = 0;
+                uint32_t copyFrame = 0;
+                bool pending = false;
+            };
+
+            /// <summary>
+            /// Staging buffers a group copies its constant buffer into, one per frame of latency plus the one written in the current frame.
+            /// A slot is read back once latency frames have passed since its copy was issued, so the GPU has long finished it by then.
+            /// </summary>
+            struct ReadbackRing
+            {
+                std::array<ReadbackSlot, ShaderToggler::MAX_CB_READBACK_LATENCY + 1> slots;
+                uint32_t current = 0;
+                uint32_t latency = 0;
+            };
+
+            static void CopyRegions(reshade::api::command_list* cmd_list, reshade::api::resource src, reshade::api::resource dst, size_t size, const std::vector<ShaderToggler::ConstantSpan>* spans);
+
+            void CopyToHost(reshade::api::command_list* cmd_list, ShaderToggler::ToggleGroup* group, std::vector<uint8_t>& dest, size_t size, uint64_t resourceHandle, const std::vector<ShaderToggler::ConstantSpan>* spans);
+            void CopyToRing(reshade::api::command_list* cmd_list, ShaderToggler::ToggleGroup* group, std::vector<uint8_t>& dest, size_t size, uint64_t resourceHandle, const std::vector<ShaderToggler::ConstantSpan>* spans, uint32_t latency);
+            void RetireSlot(ReadbackSlot& slot, uint32_t frame);
+            void RetireRing(const ShaderToggler::ToggleGroup* group, uint32_t frame);
+            void DestroyRetiredSlots(uint32_t frame);
+
+            std::unordered_map<const ShaderToggler::ToggleGroup*, ReadbackRing> groupRings;
+            std::vector<ReadbackSlot> retiredSlots;
+            std::mutex ringMutex;
             Rendering::ToggleGroupResourceManager& groupResourceManager;
         };
     }
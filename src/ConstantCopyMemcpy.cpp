@@ -94,7 +94,10 @@ bool ConstantCopyMemcpy::Unhook()
 
 void* __fastcall ConstantCopyMemcpy::detour_memcpy(void* dest, void* src, size_t size)
 {
-    _instance->OnMemcpy(dest, src, size);
+    if (MemcpyFence::Admits(reinterpret_cast<uintptr_t>(dest)))
+    {
+        _instance->OnMemcpy(dest, src, size);
+    }
 
     return org_memcpy(dest, src, size);
 }
\ No newline at end of file
@@ -5,8 +5,10 @@
 #include <reshade_api_pipeline.hpp>
 #include <unordered_map>
 #include <vector>
+#include <atomic>
 #include <shared_mutex>
 #include "ConstantCopyBase.h"
+#include "MemcpyFence.h"
 #include "GameHookT.h"
 
 using namespace sigmatch_literals;
@@ -57,7 +59,6 @@ namespace Shim
         {
             uint64_t resource = 0;
             void* destination = nullptr;
-            uint8_t* hostDestination = nullptr;
             uint64_t offset = 0;
             uint64_t size = 0;
             uint64_t bufferSize = 0;
@@ -82,6 +83,14 @@ namespace Shim
         protected:
             static ConstantCopyMemcpy* _instance;
 
+            /// <summary>
+            /// The detour only forwards memcpy calls admitted by the MemcpyFence. Derived classes keep it up to date from
+            /// OnMapBufferRegion/OnUnmapBufferRegion, on the thread which maps or unmaps.
+            /// </summary>
+            static void OnThreadMapped() { MemcpyFence::OnThreadMapped(); }
+            static void OnThreadUnmapped() { MemcpyFence::OnThreadUnmapped(); }
+            static void SetMappedFence(uintptr_t lowest, uintptr_t highest) { MemcpyFence::Set(lowest, highest); }
+
         private:
             bool HookStatic(sig_memcpy** original, sig_memcpy* detour);
             bool HookDynamic(sig_memcpy** original, sig_memcpy* detour);
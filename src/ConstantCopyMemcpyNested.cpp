@@ -4,7 +4,7 @@ using namespace Shim::Constants;
 using namespace reshade::api;
 using namespace std;
 
-ConstantCopyMemcpyNested::ConstantCopyMemcpyNested()
+ConstantCopyMemcpyNested::ConstantCopyMemcpyNested() : _resourceMemoryMapping(&SetMappedFence)
 {
     _instance = this;
 }
@@ -16,13 +16,19 @@ ConstantCopyMemcpyNested::~ConstantCopyMemcpyNested()
 
 void ConstantCopyMemcpyNested::OnMapBufferRegion(device* device, resource resource, uint64_t offset, uint64_t size, map_access access, void** data)
 {
-    if (access == map_access::write_discard || access == map_access::write_only)
+    // Buffers no group subscribed to don't have a host copy to write into
+    if ((access == map_access::write_discard || access == map_access::write_only) && HasHostConstantBuffer(resource.handle))
     {
         resource_desc desc = device->get_resource_desc(resource);
         if (desc.heap == memory_heap::cpu_to_gpu && static_cast<uint32_t>(desc.usage & resource_usage::constant_buffer))
         {
-            unique_lock<shared_mutex> lock(_map_mutex);
-            _resourceMemoryMapping[resource.handle] = BufferCopy{ resource.handle, *data, nullptr, offset, size, desc.buffer.size };
+            const uintptr_t destination = reinterpret_cast<uintptr_t>(*data);
+
+            // Mapping a buffer again without unmapping it replaces its range, the thread still has it mapped only once
+            if (_resourceMemoryMapping.Add(resource.handle, destination, destination + desc.buffer.size - offset, desc.buffer.size))
+            {
+                OnThreadMapped();
+            }
         }
     }
 }
@@ -33,23 +39,23 @@ void ConstantCopyMemcpyNested::OnUnmapBufferRegion(device* device, resource reso
     resource_desc desc = device->get_resource_desc(resource);
     if (desc.heap == memory_heap::cpu_to_gpu && static_cast<uint32_t>(desc.usage & resource_usage::constant_buffer))
     {
-        unique_lock<shared_mutex> lock(_map_mutex);
-        _resourceMemoryMapping.erase(resource.handle);
+        if (_resourceMemoryMapping.Remove(resource.handle))
+        {
+            OnThreadUnmapped();
+        }
     }
 }
 
 void ConstantCopyMemcpyNested::OnMemcpy(void* volatile dest, void* src, size_t size)
 {
-    shared_lock<shared_mutex> lock(_map_mutex);
-    if (_resourceMemoryMapping.size() > 0)
+    if (_resourceMemoryMapping.Empty())
     {
-        for (auto& [_,buffer] : _resourceMemoryMapping)
-        {
-            if (dest >= buffer.destination && static_cast<uintptr_t>(reinterpret_cast<intptr_t>(dest)) <= reinterpret_cast<intptr_t>(buffer.destination) + buffer.bufferSize - buffer.offset)
-            {
-                SetHostConstantBuffer(buffer.resource, src, size, reinterpret_cast<intptr_t>(dest) - reinterpret_cast<intptr_t>(buffer.destination), buffer.bufferSize);
-                break;
-            }
-        }
+        return;
+    }
+
+    MappedRange buffer;
+    if (_resourceMemoryMapping.Find(reinterpret_cast<uintptr_t>(dest), buffer))
+    {
+        SetHostConstantBuffer(buffer.resource, src, size, reinterpret_cast<uintptr_t>(dest) - buffer.destination, buffer.bufferSize);
     }
 }
\ No newline at end of file
@@ -5,6 +5,8 @@ using namespace reshade::api;
 using namespace std;
 
 BufferCopy ConstantCopyMemcpySingular::_bufferCopy;
+mutex ConstantCopyMemcpySingular::_bufferCopyMutex;
+thread_local uint64_t ConstantCopyMemcpySingular::_threadMappedResource = 0;
 
 ConstantCopyMemcpySingular::ConstantCopyMemcpySingular()
 {
@@ -18,36 +20,62 @@ void ConstantCopyMemcpySingular::OnMapBufferRegion(device* device, resource reso
     if (access == map_access::write_discard || access == map_access::write_only)
     {
         resource_desc desc = device->get_resource_desc(resource);
-        const auto& it = deviceToHostConstantBuffer.find(resource.handle);
 
-        if (it != deviceToHostConstantBuffer.end())
+        if (HasHostConstantBuffer(resource.handle))
         {
-            auto& [_, buf] = *it;
+            // The fence counts mappings per thread, so the thread which maps claims the mapping in its own count
+            if (_threadMappedResource == 0)
+            {
+                OnThreadMapped();
+            }
+            _threadMappedResource = resource.handle;
+
+            unique_lock<mutex> lock(_bufferCopyMutex);
             _bufferCopy.resource = resource.handle;
             _bufferCopy.destination = *data;
             _bufferCopy.size = size;
             _bufferCopy.offset = offset;
             _bufferCopy.bufferSize = desc.buffer.size;
-            _bufferCopy.hostDestination = buf.data();
+
+            const uintptr_t destination = reinterpret_cast<uintptr_t>(*data);
+            SetMappedFence(destination, destination + desc.buffer.size - offset);
         }
     }
 }
 
 void ConstantCopyMemcpySingular::OnUnmapBufferRegion(device* device, resource resource)
 {
-    _bufferCopy.resource = 0;
-    _bufferCopy.destination = nullptr;
+    if (_threadMappedResource == resource.handle)
+    {
+        OnThreadUnmapped();
+        _threadMappedResource = 0;
+    }
+
+    // Another thread might have mapped a buffer since, which then stays the one forwarded
+    unique_lock<mutex> lock(_bufferCopyMutex);
+    if (_bufferCopy.resource == resource.handle)
+    {
+        SetMappedFence(UINTPTR_MAX, 0);
+        _bufferCopy.resource = 0;
+        _bufferCopy.destination = nullptr;
+    }
 }
 
 void ConstantCopyMemcpySingular::OnMemcpy(void* dest, void* src, size_t size)
 {
+    BufferCopy bufferCopy;
+    {
+        unique_lock<mutex> lock(_bufferCopyMutex);
+        bufferCopy = _bufferCopy;
+    }
+
     uintptr_t destPtr = reinterpret_cast<uintptr_t>(dest);
-    uintptr_t destinationPtr = reinterpret_cast<uintptr_t>(_bufferCopy.destination);
+    uintptr_t destinationPtr = reinterpret_cast<uintptr_t>(bufferCopy.destination);
 
-    if (_bufferCopy.resource != 0 &&
+    if (bufferCopy.resource != 0 &&
         destPtr >= destinationPtr &&
-        destPtr <= destinationPtr + _bufferCopy.bufferSize - _bufferCopy.offset)
+        destPtr <= destinationPtr + bufferCopy.bufferSize - bufferCopy.offset)
     {
-        memcpy(_bufferCopy.hostDestination, src, size);
+        SetHostConstantBuffer(bufferCopy.resource, src, size, 0, bufferCopy.bufferSize);
     }
 }
\ No newline at end of file
@@ -1,4 +1,5 @@
 #pragma once
+#include <mutex>
 #include "ConstantCopyMemcpy.h"
 
 namespace Shim
@@ -15,6 +16,8 @@ namespace Shim
             void OnUnmapBufferRegion(reshade::api::device* device, reshade::api::resource resource) override final;
         private:
             static BufferCopy _bufferCopy;
+            static std::mutex _bufferCopyMutex;
+            static thread_local uint64_t _threadMappedResource;     // mapping this thread claimed and counted in the fence, 0 if none
         };
     }
 }
\ No newline at end of file
@@ -9,6 +9,7 @@ using namespace ShaderToggler;
 using namespace std;
 
 unordered_map<string, tuple<constant_type, vector<effect_uniform_variable>>> ConstantHandlerBase::restVariables;
+uint32_t ConstantHandlerBase::restVariablesVersion = 0;
 char ConstantHandlerBase::charBuffer[CHAR_BUFFER_SIZE];
 ConstantCopyBase* ConstantHandlerBase::_constCopy;
 std::shared_mutex ConstantHandlerBase::groupBufferMutex;
@@ -29,9 +30,10 @@ void ConstantHandlerBase::SetConstantCopy(ConstantCopyBase* constantCopy)
 
 size_t ConstantHandlerBase::GetConstantBufferSize(const ToggleGroup* group)
 {
-    if (groupBufferSize.contains(group))
+    const auto it = groupConstants.find(group);
+    if (it != groupConstants.end())
     {
-        return groupBufferSize.at(group);
+        return it->second.content.size();
     }
 
     return 0;
@@ -39,9 +41,10 @@ size_t ConstantHandlerBase::GetConstantBufferSize(const ToggleGroup* group)
 
 const uint8_t* ConstantHandlerBase::GetConstantBuffer(const ToggleGroup* group)
 {
-    if (groupBufferContent.contains(group))
+    const auto it = groupConstants.find(group);
+    if (it != groupConstants.end())
     {
-        return groupBufferContent.at(group).data();
+        return it->second.content.data();
     }
 
     return nullptr;
@@ -54,7 +57,11 @@ unordered_map<string, tuple<constant_type, vector<effect_uniform_variable>>>* Co
 
 void ConstantHandlerBase::ReloadConstantVariables(effect_runtime* runtime)
 {
+    unique_lock<shared_mutex> lock(varMutex);
+
+    // Compiled bindings point into the variable lists, they're recompiled on their next use
     restVariables.clear();
+    restVariablesVersion++;
 
     runtime->enumerate_uniform_variables(nullptr, [](effect_runtime* rt, effect_uniform_variable variable) {
         if (!rt->get_annotation_string_from_uniform_variable<CHAR_BUFFER_SIZE>(variable, "source", charBuffer))
@@ -130,7 +137,10 @@ void ConstantHandlerBase::ReloadConstantVariables(effect_runtime* runtime)
 
 void ConstantHandlerBase::ClearConstantVariables()
 {
+    unique_lock<shared_mutex> lock(varMutex);
+
     restVariables.clear();
+    restVariablesVersion++;
 }
 
 void ConstantHandlerBase::OnEffectsReloading(effect_runtime* runtime)
@@ -196,8 +206,11 @@ bool ConstantHandlerBase::UpdateConstantBufferEntries(command_list* cmd_list, Co
     {
         unique_lock<shared_mutex> lock(groupBufferMutex);
 
-        SetBufferRange(group, buf->constant, cmd_list->get_device(), cmd_list);
-        ApplyConstantValues(devData.current_runtime, group, restVariables);
+        group_constant_data* data = SetBufferRange(group, buf->constant, cmd_list->get_device(), cmd_list);
+        if (data != nullptr)
+        {
+            ApplyBindings(devData.current_runtime, group, *data, restVariables);
+        }
         devData.constantsUpdated.insert(group);
 
         return true;
@@ -224,14 +237,17 @@ bool ConstantHandlerBase::UpdateConstantEntries(command_list* cmd_list, CommandL
     if (const_buffer_size == 0)
         return false;
     
-    const vector<uint32_t>* buf = state.get_constants_at(index, slot);//current_constants.at(slot);
+    span<const uint32_t> buf = state.get_constants_at(index, slot);//current_constants.at(slot);
 
-    if (buf != nullptr)
+    if (!buf.empty())
     {
         unique_lock<shared_mutex> lock(groupBufferMutex);
 
-        SetConstants(group, *buf, cmd_list->get_device(), cmd_list);
-        ApplyConstantValues(devData.current_runtime, group, restVariables);
+        group_constant_data* data = SetConstants(group, buf, cmd_list->get_device(), cmd_list);
+        if (data != nullptr)
+        {
+            ApplyBindings(devData.current_runtime, group, *data, restVariables);
+        }
         devData.constantsUpdated.insert(group);
     }
 
@@ -310,120 +326,146 @@ void ConstantHandlerBase::UpdateConstants(command_list* cmd_list)
     }
 }
 
-void ConstantHandlerBase::ApplyConstantValues(effect_runtime* runtime, const ToggleGroup* group,
+void ConstantHandlerBase::CompileBindings(group_constant_data& data, const ToggleGroup* group,
     const unordered_map<string, tuple<constant_type, vector<effect_uniform_variable>>>& constants)
 {
-    unique_lock<shared_mutex> lock(varMutex);
+    data.bindings.clear();
 
-    if (!groupBufferContent.contains(group) || runtime == nullptr)
+    for (const auto& [varName, varData] : group->GetVarOffsetMapping())
     {
-        return;
+        const auto& [offset, prevValue] = varData;
+
+        const auto it = constants.find(varName);
+        if (it == constants.end())
+        {
+            continue;
+        }
+
+        const auto& [type, effect_variables] = it->second;
+        const uint32_t typeIndex = static_cast<uint32_t>(type);
+
+        data.bindings.push_back({ offset, offset + type_size[typeIndex] * type_length[typeIndex], type, static_cast<uint32_t>(type_length[typeIndex]), prevValue, effect_variables });
     }
 
-    const uint8_t* buffer = groupBufferContent.at(group).data();
-    const uint8_t* prevBuffer = groupPrevBufferContent.at(group).data();
+    data.varMappingVersion = group->GetVarMappingVersion();
+    data.variablesVersion = restVariablesVersion;
+}
 
-    for (const auto& [varName,varData] : group->GetVarOffsetMapping())
+void ConstantHandlerBase::ApplyConstantValues(effect_runtime* runtime, const ToggleGroup* group,
+    const unordered_map<string, tuple<constant_type, vector<effect_uniform_variable>>>& constants)
+{
+    const auto it = groupConstants.find(group);
+    if (it != groupConstants.end())
     {
-        const auto& [offset, prevValue] = varData;
+        ApplyBindings(runtime, group, it->second, constants);
+    }
+}
 
-        const uint8_t* bufferInUse = prevValue ? prevBuffer : buffer;
+void ConstantHandlerBase::ApplyBindings(effect_runtime* runtime, const ToggleGroup* group, group_constant_data& data,
+    const unordered_map<string, tuple<constant_type, vector<effect_uniform_variable>>>& constants)
+{
+    unique_lock<shared_mutex> lock(varMutex);
 
-        if (!constants.contains(varName))
-        {
-            continue;
-        }
+    if (runtime == nullptr)
+    {
+        return;
+    }
+
+    if (data.varMappingVersion != group->GetVarMappingVersion() || data.variablesVersion != restVariablesVersion)
+    {
+        CompileBindings(data, group, constants);
+    }
 
-        const auto& [type, effect_variables] = constants.at(varName);
-        uint32_t typeIndex = static_cast<uint32_t>(type);
-        size_t bufferSize = groupBufferSize.at(group);
+    const uint8_t* buffer = data.content.data();
+    const uint8_t* prevBuffer = data.prevContent.data();
+    const size_t bufferSize = data.content.size();
 
-        if (offset + type_size[typeIndex] * type_length[typeIndex] >= bufferSize)
+    for (const uniform_binding& binding : data.bindings)
+    {
+        if (binding.end >= bufferSize)
         {
             continue;
         }
 
+        const uint8_t* value = (binding.usePrevious ? prevBuffer : buffer) + binding.offset;
 
-        for (const auto& effect_var : effect_variables)
+        for (const auto& effect_var : binding.variables)
         {
-            if (type <= constant_type::type_float4x4)
+            if (binding.type <= constant_type::type_float4x4)
             {
-                runtime->set_uniform_value_float(effect_var, reinterpret_cast<const float*>(bufferInUse + offset), type_length[typeIndex], 0);
+                runtime->set_uniform_value_float(effect_var, reinterpret_cast<const float*>(value), binding.length, 0);
             }
-            else if (type == constant_type::type_int)
+            else if (binding.type == constant_type::type_int)
             {
-                runtime->set_uniform_value_int(effect_var, reinterpret_cast<const int32_t*>(bufferInUse + offset), type_length[typeIndex], 0);
+                runtime->set_uniform_value_int(effect_var, reinterpret_cast<const int32_t*>(value), binding.length, 0);
             }
             else
             {
-                runtime->set_uniform_value_uint(effect_var, reinterpret_cast<const uint32_t*>(bufferInUse + offset), type_length[typeIndex], 0);
+                runtime->set_uniform_value_uint(effect_var, reinterpret_cast<const uint32_t*>(value), binding.length, 0);
             }
         }
     }
 }
 
 
-void ConstantHandlerBase::SetConstants(const ToggleGroup* group, const vector<uint32_t>& buf, device* dev, command_list* cmd_list)
+ConstantHandlerBase::group_constant_data* ConstantHandlerBase::SetConstants(const ToggleGroup* group, span<const uint32_t> buf, device* dev, command_list* cmd_list)
 {
     if (dev == nullptr || cmd_list == nullptr || buf.size() == 0)
     {
-        return;
+        return nullptr;
     }
 
-    InitBuffers(group, buf.size());
+    group_constant_data& data = InitBuffers(group, buf.size_bytes());
 
-    vector<uint8_t>& bufferContent = groupBufferContent.at(group);
-    vector<uint8_t>& prevBufferContent = groupPrevBufferContent.at(group);
+    std::memcpy(data.prevContent.data(), data.content.data(), buf.size_bytes());
+    std::memcpy(data.content.data(), reinterpret_cast<const uint8_t*>(buf.data()), buf.size_bytes());
 
-    std::memcpy(prevBufferContent.data(), bufferContent.data(), buf.size());
-    std::memcpy(bufferContent.data(), reinterpret_cast<const uint8_t*>(buf.data()), buf.size() * 4);
+    return &data;
 }
 
-void ConstantHandlerBase::SetBufferRange(ToggleGroup* group, buffer_range range, device* dev, command_list* cmd_list)
+ConstantHandlerBase::group_constant_data* ConstantHandlerBase::SetBufferRange(ToggleGroup* group, buffer_range range, device* dev, command_list* cmd_list)
 {
     if (dev == nullptr || cmd_list == nullptr || range.buffer == 0)
     {
-        return;
+        return nullptr;
     }
 
     resource_desc targetBufferDesc = dev->get_resource_desc(range.buffer);
     size_t size = static_cast<size_t>(targetBufferDesc.buffer.size);
 
-    InitBuffers(group, size);
+    group_constant_data& data = InitBuffers(group, size);
 
-    vector<uint8_t>& bufferContent = groupBufferContent.at(group);
-    vector<uint8_t>& prevBufferContent = groupPrevBufferContent.at(group);
+    // Only the bytes of mapped variables are read, unless the whole buffer is on screen
+    const vector<ConstantSpan>* spans = viewedGroup.load(memory_order_relaxed) == group ? nullptr : &group->GetConstantReadSpans();
 
-    std::memcpy(prevBufferContent.data(), bufferContent.data(), size);
-    _constCopy->GetHostConstantBuffer(cmd_list, group, bufferContent, size, range.buffer.handle);
+    ConstantCopyBase::CopyConstantSpans(data.prevContent.data(), data.content.data(), size, spans);
+    _constCopy->GetHostConstantBuffer(cmd_list, group, data.content, size, range.buffer.handle, spans);
+
+    return &data;
 }
 
-void ConstantHandlerBase::InitBuffers(const ToggleGroup* group, size_t size)
+ConstantHandlerBase::group_constant_data& ConstantHandlerBase::InitBuffers(const ToggleGroup* group, size_t size)
 {
-    const auto& content = groupBufferContent.find(group);
+    group_constant_data& data = groupConstants[group];
 
-    if (content != groupBufferContent.end() && size != content->second.size())
-    {
-        groupBufferContent[group].resize(size, 0);
-        groupPrevBufferContent[group].resize(size, 0);
-        groupBufferSize[group] = size;
-    }
-    else if(content == groupBufferContent.end())
+    if (size != data.content.size())
     {
-        groupBufferContent.emplace(group, vector<uint8_t>(size, 0));
-        groupPrevBufferContent.emplace(group, vector<uint8_t>(size, 0));
-        groupBufferSize.emplace(group, size);
+        data.content.resize(size, 0);
+        data.prevContent.resize(size, 0);
     }
+
+    return data;
 }
 
 void ConstantHandlerBase::RemoveGroup(const ToggleGroup* group, device* dev)
 {
-    if (!groupBufferContent.contains(group))
     {
-        return;
+        unique_lock<shared_mutex> lock(groupBufferMutex);
+        groupConstants.erase(group);
     }
 
-    groupBufferContent.erase(group);
-    groupPrevBufferContent.erase(group);
-    groupBufferSize.erase(group);
-}
\ No newline at end of file
+    if (_constCopy != nullptr)
+    {
+        _constCopy->OnGroupRemoved(group, dev);
+    }
+}
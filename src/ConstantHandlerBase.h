@@ -6,6 +6,7 @@
 #include <unordered_map>
 #include <functional>
 #include <shared_mutex>
+#include <span>
 #include "ToggleGroup.h"
 #include "ShaderManager.h"
 #include "ConstantCopyBase.h"
@@ -75,15 +76,32 @@ namespace Shim
 
         static constexpr size_t CHAR_BUFFER_SIZE = 256;
 
+        /// <summary>
+        /// Variable mapping of a group resolved against the effect uniforms: where to read the value in the group's buffer and which
+        /// uniforms to write it to.
+        /// </summary>
+        struct uniform_binding
+        {
+            size_t offset;
+            size_t end;	// offset + size of the value
+            constant_type type;
+            uint32_t length;
+            bool usePrevious;
+            std::span<const reshade::api::effect_uniform_variable> variables;
+        };
+
         class __declspec(novtable) ConstantHandlerBase final {
         public:
             ConstantHandlerBase();
             ~ConstantHandlerBase();
 
-            void SetBufferRange(ShaderToggler::ToggleGroup* group, reshade::api::buffer_range range, reshade::api::device * dev, reshade::api::command_list* cmd_list);
-            void SetConstants(const ShaderToggler::ToggleGroup* group, const std::vector<uint32_t>& buf, reshade::api::device* dev, reshade::api::command_list* cmd_list);
             std::shared_mutex& GetBufferMutex() { return groupBufferMutex; }
             void RemoveGroup(const ShaderToggler::ToggleGroup*, reshade::api::device* dev);
+            /// <summary>
+            /// Sets the group whose constant buffer is shown in the UI. That group gets its whole buffer copied, all others only the
+            /// ranges covering their mapped variables.
+            /// </summary>
+            void SetViewedGroup(const ShaderToggler::ToggleGroup* group) { viewedGroup.store(group, std::memory_order_relaxed); }
             const uint8_t* GetConstantBuffer(const ShaderToggler::ToggleGroup* group);
             size_t GetConstantBufferSize(const ShaderToggler::ToggleGroup* group);
             void ReloadConstantVariables(reshade::api::effect_runtime* runtime);
@@ -98,19 +116,32 @@ namespace Shim
 
             static void SetConstantCopy(ConstantCopyBase* constantHandler);
         private:
-            std::unordered_map<const ShaderToggler::ToggleGroup*, std::vector<uint8_t>> groupBufferContent;
-            std::unordered_map<const ShaderToggler::ToggleGroup*, std::vector<uint8_t>> groupPrevBufferContent;
-            std::unordered_map<const ShaderToggler::ToggleGroup*, size_t> groupBufferSize;
+            struct group_constant_data
+            {
+                std::vector<uint8_t> content;
+                std::vector<uint8_t> prevContent;
+                std::vector<uniform_binding> bindings;
+                uint32_t varMappingVersion = UINT32_MAX;	// versions the bindings were compiled for
+                uint32_t variablesVersion = UINT32_MAX;
+            };
+
+            std::unordered_map<const ShaderToggler::ToggleGroup*, group_constant_data> groupConstants;
             int32_t previousEnableCount = std::numeric_limits<int32_t>::max();
+            std::atomic<const ShaderToggler::ToggleGroup*> viewedGroup = nullptr;
             std::shared_mutex varMutex;
             static std::shared_mutex groupBufferMutex;
 
             static std::unordered_map<std::string, std::tuple<constant_type, std::vector<reshade::api::effect_uniform_variable>>> restVariables;
+            static uint32_t restVariablesVersion;
             static char charBuffer[CHAR_BUFFER_SIZE];
 
             static ConstantCopyBase* _constCopy;
 
-            void InitBuffers(const ShaderToggler::ToggleGroup* group, size_t size);
+            group_constant_data& InitBuffers(const ShaderToggler::ToggleGroup* group, size_t size);
+            group_constant_data* SetBufferRange(ShaderToggler::ToggleGroup* group, reshade::api::buffer_range range, reshade::api::device * dev, reshade::api::command_list* cmd_list);
+            group_constant_data* SetConstants(const ShaderToggler::ToggleGroup* group, std::span<const uint32_t> buf, reshade::api::device* dev, reshade::api::command_list* cmd_list);
+            void ApplyBindings(reshade::api::effect_runtime* runtime, const ShaderToggler::ToggleGroup* group, group_constant_data& data, const std::unordered_map<std::string, std::tuple<constant_type, std::vector<reshade::api::effect_uniform_variable>>>& constants);
+            static void CompileBindings(group_constant_data& data, const ShaderToggler::ToggleGroup* group, const std::unordered_map<std::string, std::tuple<constant_type, std::vector<reshade::api::effect_uniform_variable>>>& constants);
             bool UpdateConstantEntries(reshade::api::command_list* cmd_list, CommandListDataContainer& cmdData, DeviceDataContainer& devData, ShaderToggler::ToggleGroup* group, uint32_t index);
             bool UpdateConstantBufferEntries(reshade::api::command_list* cmd_list, CommandListDataContainer& cmdData, DeviceDataContainer& devData, ShaderToggler::ToggleGroup* group, uint32_t index);
         };
@@ -4,18 +4,211 @@
  */
 
 #include <algorithm>
+#include <thread>
 #include "reshade.hpp"
 #include "DescriptorTracking.h"
 
 using namespace reshade::api;
 
+template<typename T>
+uint32_t descriptor_tracking::out_of_line_storage<T>::allocate(const T& value)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+
+    if (!free_indices.empty())
+    {
+        const uint32_t index = free_indices.back();
+        free_indices.pop_back();
+        values.get_or_create(index) = value;
+        return index;
+    }
+
+    values.get_or_create(count) = value;
+    return count++;
+}
+
+template<typename T>
+void descriptor_tracking::out_of_line_storage<T>::free(uint32_t index)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    free_indices.push_back(index);
+}
+
+static inline bool is_buffer_range(descriptor_type type)
+{
+    return type == descriptor_type::constant_buffer || type == descriptor_type::shader_storage_buffer;
+}
+
+static constexpr uint64_t TAG_TYPE_SHIFT = 32;
+static constexpr uint64_t TAG_SEQUENCE_SHIFT = 40;
+static constexpr uint64_t TAG_SEQUENCE_ONE = 1ull << TAG_SEQUENCE_SHIFT;
+
+static inline descriptor_type tag_type(uint64_t tag)
+{
+    return static_cast<descriptor_type>((tag >> TAG_TYPE_SHIFT) & 0xFF);
+}
+static inline uint32_t tag_out_of_line_index(uint64_t tag)
+{
+    return static_cast<uint32_t>(tag);
+}
+static inline bool tag_is_written(uint64_t tag)
+{
+    return (tag & TAG_SEQUENCE_ONE) != 0;
+}
+static inline uint64_t make_tag(descriptor_type type, uint32_t out_of_line_index, uint64_t sequence_tag)
+{
+    return (sequence_tag & ~(TAG_SEQUENCE_ONE - 1)) | (static_cast<uint64_t>(type) & 0xFF) << TAG_TYPE_SHIFT | out_of_line_index;
+}
+
+// The descriptor of type in descriptor as the source of a single descriptor update
+static inline const void* get_update_source(const descriptor_tracking::descriptor_data& descriptor)
+{
+    switch (descriptor.type)
+    {
+    case descriptor_type::sampler:
+        return &descriptor.sampler;
+    case descriptor_type::sampler_with_resource_view:
+        return &descriptor.sampler_and_view;
+    case descriptor_type::shader_resource_view:
+    case descriptor_type::unordered_access_view:
+        return &descriptor.view;
+    case descriptor_type::constant_buffer:
+    case descriptor_type::shader_storage_buffer:
+        return &descriptor.constant;
+    default:
+        return nullptr;
+    }
+}
+
+void descriptor_tracking::descriptor_heap_data::decode(const heap_entry& entry, descriptor_data& descriptor) const
+{
+    // Out of line payloads are overwritten in place or reused by another entry only after this entry's tag changed, so a payload read
+    // in between two equal tags is the one the entry referred to. Writes are short, a reader only spins while one is under way.
+    for (;;)
+    {
+        const uint64_t tag = entry.tag.load(std::memory_order_acquire);
+
+        if (tag_is_written(tag))
+        {
+            std::this_thread::yield();
+            continue;
+        }
+
+        const uint64_t handle = entry.handle.load(std::memory_order_relaxed);
+        descriptor.type = tag_type(tag);
+
+        switch (descriptor.type)
+        {
+        case descriptor_type::sampler:
+            descriptor.sampler = { handle };
+            break;
+        case descriptor_type::sampler_with_resource_view:
+        {
+            const sampler_with_resource_view* sampler_view = sampler_views.values.find(tag_out_of_line_index(tag));
+            descriptor.sampler_and_view = sampler_view != nullptr ? *sampler_view : sampler_with_resource_view{};
+            descriptor.view = descriptor.sampler_and_view.view;
+            descriptor.sampler = descriptor.sampler_and_view.sampler;
+            break;
+        }
+        case descriptor_type::shader_resource_view:
+        case descriptor_type::unordered_access_view:
+            descriptor.view = { handle };
+            break;
+        case descriptor_type::constant_buffer:
+        case descriptor_type::shader_storage_buffer:
+        {
+            const buffer_range* range = buffer_ranges.values.find(tag_out_of_line_index(tag));
+            descriptor.constant = range != nullptr ? *range : buffer_range{};
+            break;
+        }
+        }
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+
+        if (entry.tag.load(std::memory_order_relaxed) == tag)
+        {
+            return;
+        }
+    }
+}
+
+void descriptor_tracking::descriptor_heap_data::store(heap_entry& entry, descriptor_type type, const void* descriptors, uint32_t index)
+{
+    // The game serializes writes of the same descriptor, both APIs require it, so only readers have to be kept out
+    const uint64_t tag = entry.tag.load(std::memory_order_relaxed);
+    entry.tag.store(tag + TAG_SEQUENCE_ONE, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    const descriptor_type previous_type = tag_type(tag);
+    uint32_t out_of_line_index = tag_out_of_line_index(tag);
+    uint64_t handle = 0;
+
+    // A payload of the same kind is overwritten in place, any other is released
+    const bool reuse_out_of_line = (type == descriptor_type::sampler_with_resource_view && previous_type == descriptor_type::sampler_with_resource_view) ||
+        (is_buffer_range(type) && is_buffer_range(previous_type));
+
+    if (!reuse_out_of_line)
+    {
+        release(previous_type, out_of_line_index);
+        out_of_line_index = 0;
+    }
+
+    switch (type)
+    {
+    case descriptor_type::sampler:
+        handle = static_cast<const sampler*>(descriptors)[index].handle;
+        break;
+    case descriptor_type::sampler_with_resource_view:
+        if (reuse_out_of_line)
+            sampler_views.values.get_or_create(out_of_line_index) = static_cast<const sampler_with_resource_view*>(descriptors)[index];
+        else
+            out_of_line_index = sampler_views.allocate(static_cast<const sampler_with_resource_view*>(descriptors)[index]);
+        break;
+    case descriptor_type::shader_resource_view:
+    case descriptor_type::unordered_access_view:
+        handle = static_cast<const resource_view*>(descriptors)[index].handle;
+        break;
+    case descriptor_type::constant_buffer:
+    case descriptor_type::shader_storage_buffer:
+        if (reuse_out_of_line)
+            buffer_ranges.values.get_or_create(out_of_line_index) = static_cast<const buffer_range*>(descriptors)[index];
+        else
+            out_of_line_index = buffer_ranges.allocate(static_cast<const buffer_range*>(descriptors)[index]);
+        break;
+    }
+
+    entry.handle.store(handle, std::memory_order_relaxed);
+    entry.tag.store(make_tag(type, out_of_line_index, tag + 2 * TAG_SEQUENCE_ONE), std::memory_order_release);
+}
+
+void descriptor_tracking::descriptor_heap_data::copy(heap_entry& entry, const descriptor_heap_data& source, const heap_entry& source_entry)
+{
+    descriptor_data descriptor = {};
+    source.decode(source_entry, descriptor);
+    store(entry, descriptor.type, get_update_source(descriptor), 0);
+}
+
+void descriptor_tracking::descriptor_heap_data::release(descriptor_type type, uint32_t out_of_line_index)
+{
+    if (type == descriptor_type::sampler_with_resource_view)
+    {
+        sampler_views.free(out_of_line_index);
+    }
+    else if (is_buffer_range(type))
+    {
+        buffer_ranges.free(out_of_line_index);
+    }
+}
+
 sampler descriptor_tracking::get_sampler(descriptor_heap heap, uint32_t offset) const
 {
-    const descriptor_heap_data& heap_data = heaps.at(heap);
+    const descriptor_heap_data* heap_data = heaps.find(heap.handle);
+    const heap_entry* entry = heap_data != nullptr ? heap_data->descriptors.find(offset) : nullptr;
 
-    if (offset < heap_data.descriptors.size())
+    if (entry != nullptr)
     {
-        const descriptor_data& descriptor = heap_data.descriptors[offset];
+        descriptor_data descriptor = {};
+        heap_data->decode(*entry, descriptor);
 
         if (descriptor.type == descriptor_type::sampler)
             return descriptor.sampler;
@@ -27,11 +220,13 @@ sampler descriptor_tracking::get_sampler(descriptor_heap heap, uint32_t offset)
 }
 resource_view descriptor_tracking::get_shader_resource_view(descriptor_heap heap, uint32_t offset) const
 {
-    const descriptor_heap_data& heap_data = heaps.at(heap);
+    const descriptor_heap_data* heap_data = heaps.find(heap.handle);
+    const heap_entry* entry = heap_data != nullptr ? heap_data->descriptors.find(offset) : nullptr;
 
-    if (offset < heap_data.descriptors.size())
+    if (entry != nullptr)
     {
-        const descriptor_data& descriptor = heap_data.descriptors[offset];
+        descriptor_data descriptor = {};
+        heap_data->decode(*entry, descriptor);
 
         if (descriptor.type == descriptor_type::shader_resource_view)
             return descriptor.view;
@@ -43,11 +238,13 @@ resource_view descriptor_tracking::get_shader_resource_view(descriptor_heap heap
 }
 buffer_range descriptor_tracking::get_buffer_range(descriptor_heap heap, uint32_t offset) const
 {
-    const descriptor_heap_data& heap_data = heaps.at(heap);
+    const descriptor_heap_data* heap_data = heaps.find(heap.handle);
+    const heap_entry* entry = heap_data != nullptr ? heap_data->descriptors.find(offset) : nullptr;
 
-    if (offset < heap_data.descriptors.size())
+    if (entry != nullptr)
     {
-        const descriptor_data& descriptor = heap_data.descriptors[offset];
+        descriptor_data descriptor = {};
+        heap_data->decode(*entry, descriptor);
 
         if (descriptor.type == descriptor_type::constant_buffer)
             return descriptor.constant;
@@ -56,45 +253,130 @@ buffer_range descriptor_tracking::get_buffer_range(descriptor_heap heap, uint32_
     return { 0 };
 }
 
-void descriptor_tracking::set_all_descriptors(reshade::api::descriptor_heap heap, uint32_t offset, uint32_t count, std::vector<descriptor_tracking::descriptor_data>& descriptor_list, uint32_t list_offset) const
+void descriptor_tracking::set_all_descriptors(reshade::api::descriptor_heap heap, uint32_t offset, uint32_t count, descriptor_tracking::descriptor_data* descriptor_list, uint32_t list_offset) const
 {
-    const descriptor_heap_data& heap_data = heaps.at(heap);
+    const descriptor_heap_data* heap_data = heaps.find(heap.handle);
+
+    if (heap_data == nullptr)
+    {
+        return;
+    }
+
+    for (uint32_t i = offset; i < offset + count; i++)
+    {
+        const heap_entry* entry = heap_data->descriptors.find(i);
+
+        if (entry != nullptr)
+        {
+            heap_data->decode(*entry, descriptor_list[list_offset + i - offset]);
+        }
+    }
+}
+
+size_t descriptor_tracking::get_heap_mirror_memory() const
+{
+    std::unique_lock<std::mutex> lock(storage_mutex);
+    size_t size = 0;
+
+    for (const auto& heap_data : heap_storage)
+    {
+        size += heap_data->descriptors.memory();
+        size += heap_data->buffer_ranges.values.memory();
+        size += heap_data->sampler_views.values.memory();
+    }
+
+    return size;
+}
 
-    size_t mcount = std::min(static_cast<size_t>(offset) + count, heap_data.descriptors.size());
+const descriptor_tracking::descriptor_table_layout* descriptor_tracking::get_descriptor_table_layout(pipeline_layout layout, uint32_t param) const
+{
+    const pipeline_layout_data* layout_data = layouts.find(layout.handle);
 
-    for (uint32_t i = offset; i < mcount; i++)
+    if (layout_data == nullptr || param >= layout_data->tables.size())
     {
-        descriptor_list[list_offset + i - offset] = heap_data.descriptors[i];
+        return nullptr;
     }
+
+    return layout_data->tables[param].get();
 }
 
-pipeline_layout_param descriptor_tracking::get_pipeline_layout_param(pipeline_layout layout, uint32_t param) const
+descriptor_tracking::descriptor_heap_data& descriptor_tracking::get_or_create_heap(descriptor_heap heap)
 {
-    const pipeline_layout_data& layout_data = layouts.at(layout);
+    descriptor_heap_data* heap_data = heaps.find(heap.handle);
+
+    if (heap_data != nullptr)
+    {
+        return *heap_data;
+    }
+
+    std::unique_lock<std::mutex> lock(storage_mutex);
 
-    return layout_data.params[param];
+    // Another thread might have created it while waiting for the lock
+    heap_data = heaps.find(heap.handle);
+
+    if (heap_data == nullptr)
+    {
+        heap_data = heap_storage.emplace_back(std::make_unique<descriptor_heap_data>()).get();
+        heaps.insert_or_assign(heap.handle, heap_data);
+    }
+
+    return *heap_data;
 }
 
 void descriptor_tracking::register_pipeline_layout(pipeline_layout layout, uint32_t count, const pipeline_layout_param* params)
 {
-    pipeline_layout_data& layout_data = layouts[layout];
-    layout_data.params.assign(params, params + count);
-    layout_data.ranges.resize(count);
+    auto layout_data = std::make_unique<pipeline_layout_data>();
+    layout_data->tables.resize(count);
 
     for (uint32_t i = 0; i < count; ++i)
     {
-        if (params[i].type == pipeline_layout_param_type::descriptor_table)
+        if (params[i].type != pipeline_layout_param_type::descriptor_table)
+            continue;
+
+        auto table = std::make_unique<descriptor_table_layout>();
+
+        for (uint32_t k = 0; k < params[i].descriptor_table.count; ++k)
         {
-            layout_data.ranges[i].assign(params[i].descriptor_table.ranges, params[i].descriptor_table.ranges + params[i].descriptor_table.count);
-            layout_data.params[i].descriptor_table.ranges = layout_data.ranges[i].data();
+            const descriptor_range& range = params[i].descriptor_table.ranges[k];
+
+            if (range.count == UINT32_MAX || range.type == descriptor_type::sampler)
+                continue; // Skip unbounded ranges
+
+            table->ranges.push_back({ range.binding, range.count });
+            table->max_binding = std::max(table->max_binding, range.binding + range.count);
         }
+
+        layout_data->tables[i] = std::move(table);
     }
+
+    // Layout data is never modified once published, a recreated layout gets new data and the old one is retired for readers still using it
+    std::unique_lock<std::mutex> lock(storage_mutex);
+    layouts.insert_or_assign(layout.handle, layout_data.get());
+
+    std::unique_ptr<pipeline_layout_data>& stored = layout_storage[layout.handle];
+    if (stored != nullptr)
+    {
+        retired_layouts.push_back({ std::move(stored), present_count });
+    }
+    stored = std::move(layout_data);
 }
 void descriptor_tracking::unregister_pipeline_layout(pipeline_layout layout)
 {
-    pipeline_layout_data& layout_data = layouts[layout];
-    layout_data.params.clear();
-    layout_data.ranges.clear();
+    std::unique_lock<std::mutex> lock(storage_mutex);
+    layouts.erase(layout.handle);
+
+    if (const auto it = layout_storage.find(layout.handle); it != layout_storage.end())
+    {
+        retired_layouts.push_back({ std::move(it->second), present_count });
+        layout_storage.erase(it);
+    }
+}
+void descriptor_tracking::free_retired_layouts()
+{
+    std::unique_lock<std::mutex> lock(storage_mutex);
+    present_count++;
+
+    std::erase_if(retired_layouts, [this](const retired_layout& retired) { return present_count - retired.present_index >= LAYOUT_RETIRE_GRACE_PERIOD; });
 }
 
 static void on_init_device(device* device)
@@ -133,15 +415,18 @@ bool descriptor_tracking::on_copy_descriptor_tables(device* device, uint32_t cou
         descriptor_heap dst_heap;
         device->get_descriptor_heap_offset(copy.dest_table, copy.dest_binding, copy.dest_array_offset, &dst_heap, &dst_offset);
 
-        descriptor_heap_data& src_pool_data = ctx.heaps[src_heap];
-        descriptor_heap_data& dst_pool_data = ctx.heaps[dst_heap];
+        descriptor_heap_data& src_pool_data = ctx.get_or_create_heap(src_heap);
+        descriptor_heap_data& dst_pool_data = ctx.get_or_create_heap(dst_heap);
+
+        dst_pool_data.descriptors.allocate(dst_offset, copy.count);
 
-        if (dst_offset + copy.count > dst_pool_data.descriptors.size())
-            dst_pool_data.descriptors.grow_to_at_least(dst_offset + copy.count);
+        static const heap_entry empty_entry;
 
         for (uint32_t k = 0; k < copy.count; ++k)
         {
-            dst_pool_data.descriptors[dst_offset + k] = src_pool_data.descriptors[src_offset + k];
+            // Source descriptors which were never written are copied as empty ones
+            const heap_entry* source_entry = src_pool_data.descriptors.find(src_offset + k);
+            dst_pool_data.copy(*dst_pool_data.descriptors.find(dst_offset + k), src_pool_data, source_entry != nullptr ? *source_entry : empty_entry);
         }
     }
 
@@ -160,47 +445,34 @@ bool descriptor_tracking::on_update_descriptor_tables(device* device, uint32_t c
         descriptor_heap heap;
         device->get_descriptor_heap_offset(update.table, update.binding, update.array_offset, &heap, &offset);
 
-        descriptor_heap_data& heap_data = ctx.heaps[heap];
+        descriptor_heap_data& heap_data = ctx.get_or_create_heap(heap);
 
-        if (offset + update.count > heap_data.descriptors.size())
-            heap_data.descriptors.grow_to_at_least(offset + update.count);
+        heap_data.descriptors.allocate(offset, update.count);
 
         for (uint32_t k = 0; k < update.count; ++k)
         {
-            descriptor_data& descriptor = heap_data.descriptors[offset + k];
-
-            descriptor.type = update.type;
-
-            switch (update.type)
-            {
-            case descriptor_type::sampler:
-                descriptor.sampler = static_cast<const sampler*>(update.descriptors)[k];
-                break;
-            case descriptor_type::sampler_with_resource_view:
-                descriptor.sampler_and_view = static_cast<const sampler_with_resource_view*>(update.descriptors)[k];
-                descriptor.view = descriptor.sampler_and_view.view;
-                descriptor.sampler = descriptor.sampler_and_view.sampler;
-                break;
-            case descriptor_type::shader_resource_view:
-            case descriptor_type::unordered_access_view:
-                descriptor.view = static_cast<const resource_view*>(update.descriptors)[k];
-                break;
-            case descriptor_type::constant_buffer:
-            case descriptor_type::shader_storage_buffer:
-                descriptor.constant = static_cast<const buffer_range*>(update.descriptors)[k];
-            }
+            heap_data.store(*heap_data.descriptors.find(offset + k), update.type, update.descriptors, k);
         }
     }
 
     return false;
 }
 
+void descriptor_tracking::on_reshade_present(effect_runtime* runtime)
+{
+    descriptor_tracking& ctx = runtime->get_device()->get_private_data<descriptor_tracking>();
+    ctx.heaps.reclaim_retired();
+    ctx.layouts.reclaim_retired();
+    ctx.free_retired_layouts();
+}
+
 void descriptor_tracking::register_events(bool track_descriptors)
 {
     reshade::register_event<reshade::addon_event::init_device>(on_init_device);
     reshade::register_event<reshade::addon_event::destroy_device>(on_destroy_device);
     reshade::register_event<reshade::addon_event::init_pipeline_layout>(on_init_pipeline_layout);
     reshade::register_event<reshade::addon_event::destroy_pipeline_layout>(on_destroy_pipeline_layout);
+    reshade::register_event<reshade::addon_event::reshade_present>(on_reshade_present);
 
     if (track_descriptors)
     {
@@ -214,6 +486,7 @@ void descriptor_tracking::unregister_events(bool track_descriptors)
     reshade::unregister_event<reshade::addon_event::destroy_device>(on_destroy_device);
     reshade::unregister_event<reshade::addon_event::init_pipeline_layout>(on_init_pipeline_layout);
     reshade::unregister_event<reshade::addon_event::destroy_pipeline_layout>(on_destroy_pipeline_layout);
+    reshade::unregister_event<reshade::addon_event::reshade_present>(on_reshade_present);
 
     if (track_descriptors)
     {
@@ -6,9 +6,13 @@
 #pragma once
 
 #include <vector>
-#include <concurrent_vector.h>
-#include <concurrent_unordered_map.h>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
 #include "reshade.hpp"
+#include "PagedArray.h"
+#include "ReadMostlyHandleMap.h"
 
  /// <summary>
  /// An instance of this is automatically created for all devices and can be queried with <c>device->get_private_data&lt;descriptor_tracking&gt;()</c> (assuming descriptor tracking was registered via <see cref="descriptor_tracking::register_events"/>).
@@ -36,6 +40,22 @@ public:
         reshade::api::buffer_range constant;
     };
 
+    /// <summary>
+    /// Flattened description of a descriptor table parameter of a pipeline layout, built once when the layout is created and never
+    /// modified afterwards. Only the ranges which are mirrored into state snapshots are listed: unbounded and sampler ranges are skipped.
+    /// </summary>
+    struct descriptor_table_layout
+    {
+        struct range
+        {
+            uint32_t binding;
+            uint32_t count;
+        };
+
+        std::vector<range> ranges;
+        uint32_t max_binding = 0;   // one past the highest binding in ranges
+    };
+
     /// <summary>
     /// Registers all the necessary add-on events for descriptor tracking to work.
     /// </summary>
@@ -58,58 +78,100 @@ public:
     /// </summary>
     reshade::api::buffer_range get_buffer_range(reshade::api::descriptor_heap heap, uint32_t offset) const;
 
-    void set_all_descriptors(reshade::api::descriptor_heap heap, uint32_t offset, uint32_t count, std::vector<descriptor_tracking::descriptor_data>& descriptor_list, uint32_t list_offset) const;
+    void set_all_descriptors(reshade::api::descriptor_heap heap, uint32_t offset, uint32_t count, descriptor_tracking::descriptor_data* descriptor_list, uint32_t list_offset) const;
 
     /// <summary>
-    /// Gets the description that was used to create the specified pipeline layout parameter.
+    /// Gets the flattened description of the specified pipeline layout parameter, nullptr if it isn't a descriptor table. The returned
+    /// data stays valid for LAYOUT_RETIRE_GRACE_PERIOD presents after the layout is destroyed, so command lists recorded with it can still
+    /// read it until they're reset.
     /// </summary>
-    reshade::api::pipeline_layout_param get_pipeline_layout_param(reshade::api::pipeline_layout layout, uint32_t param) const;
+    const descriptor_table_layout* get_descriptor_table_layout(reshade::api::pipeline_layout layout, uint32_t param) const;
+
+    /// <summary>
+    /// Gets the number of bytes used by the descriptor heap mirrors of this device.
+    /// </summary>
+    size_t get_heap_mirror_memory() const;
 
 
 private:
     void register_pipeline_layout(reshade::api::pipeline_layout layout, uint32_t count, const reshade::api::pipeline_layout_param* params);
     void unregister_pipeline_layout(reshade::api::pipeline_layout layout);
+    void free_retired_layouts();
 
     static void on_init_pipeline_layout(reshade::api::device* device, uint32_t count, const reshade::api::pipeline_layout_param* params, reshade::api::pipeline_layout layout);
     static void on_destroy_pipeline_layout(reshade::api::device* device, reshade::api::pipeline_layout layout);
 
     static bool on_copy_descriptor_tables(reshade::api::device* device, uint32_t count, const reshade::api::descriptor_table_copy* copies);
     static bool on_update_descriptor_tables(reshade::api::device* device, uint32_t count, const reshade::api::descriptor_table_update* updates);
+    static void on_reshade_present(reshade::api::effect_runtime* runtime);
 
-    struct descriptor_heap_data
+    /// <summary>
+    /// Compact mirror entry of a single descriptor: the type and the one handle which matters for it. Buffer ranges and sampler/view
+    /// pairs don't fit and are stored out of line in the heap, in which case the out of line index refers to them. Entries are read
+    /// without a lock, so the type and out of line index are packed with a sequence number into tag, which is odd while the entry is
+    /// written. A reader retries if tag changed while it read the entry, see <see cref="descriptor_heap_data::decode"/>.
+    /// </summary>
+    struct heap_entry
     {
-        concurrency::concurrent_vector<descriptor_data> descriptors;
+        std::atomic<uint64_t> tag = 0;  // out of line index in the low 32 bits, type in the next 8, sequence number in the high 24
+        std::atomic<uint64_t> handle = 0;
     };
-    struct descriptor_heap_hash : std::hash<uint64_t>
+    static_assert(sizeof(heap_entry) == 16);
+
+    /// <summary>
+    /// Out of line payloads of a heap, slots are reused once no entry refers to them anymore.
+    /// </summary>
+    template<typename T>
+    struct out_of_line_storage
     {
-        size_t operator()(reshade::api::descriptor_heap handle) const
-        {
-            return std::hash<uint64_t>::operator()(handle.handle);
-        }
+        ShaderToggler::PagedArray<T, 1024> values;
+        std::vector<uint32_t> free_indices;
+        uint32_t count = 0;
+        std::mutex mutex;
+
+        uint32_t allocate(const T& value);
+        void free(uint32_t index);
     };
 
-    struct pipeline_layout_data
+    /// <summary>
+    /// Mirror of a descriptor heap. Entries live in fixed size pages which never move, so tables are read without a lock while other
+    /// threads update or copy descriptors elsewhere in the heap.
+    /// </summary>
+    struct descriptor_heap_data
     {
-        std::vector<reshade::api::pipeline_layout_param> params;
-        std::vector<std::vector<reshade::api::descriptor_range>> ranges;
+        ShaderToggler::PagedArray<heap_entry> descriptors;
+        out_of_line_storage<reshade::api::buffer_range> buffer_ranges;
+        out_of_line_storage<reshade::api::sampler_with_resource_view> sampler_views;
+
+        void decode(const heap_entry& entry, descriptor_data& descriptor) const;
+        void store(heap_entry& entry, reshade::api::descriptor_type type, const void* descriptors, uint32_t index);
+        void copy(heap_entry& entry, const descriptor_heap_data& source, const heap_entry& source_entry);
+        void release(reshade::api::descriptor_type type, uint32_t out_of_line_index);
     };
-    struct pipeline_layout_hash : std::hash<uint64_t>
+
+    struct pipeline_layout_data
     {
-        size_t operator()(reshade::api::pipeline_layout handle) const
-        {
-            return std::hash<uint64_t>::operator()(handle.handle);
-        }
+        std::vector<std::unique_ptr<const descriptor_table_layout>> tables;  // per layout param, nullptr if the param isn't a descriptor table
     };
 
-    struct pipeline_hash : std::hash<uint64_t>
+    descriptor_heap_data& get_or_create_heap(reshade::api::descriptor_heap heap);
+
+    struct retired_layout
     {
-        size_t operator()(reshade::api::pipeline handle) const
-        {
-            return std::hash<uint64_t>::operator()(handle.handle);
-        }
+        std::unique_ptr<pipeline_layout_data> data;
+        uint64_t present_index;
     };
 
-    concurrency::concurrent_unordered_map<reshade::api::descriptor_heap, descriptor_heap_data, descriptor_heap_hash> heaps;
-    concurrency::concurrent_unordered_map<reshade::api::pipeline_layout, pipeline_layout_data, pipeline_layout_hash> layouts;
-    concurrency::concurrent_unordered_map<reshade::api::pipeline, reshade::api::pipeline_layout, pipeline_hash> pipelines;
+    static constexpr uint64_t LAYOUT_RETIRE_GRACE_PERIOD = 8;
+
+    // Lookups go through the read mostly maps, the owning containers keep the data alive. Heaps live until the device is destroyed, the
+    // data of a destroyed layout is retired and freed LAYOUT_RETIRE_GRACE_PERIOD presents later. The tables the maps replace when they
+    // grow are reclaimed once per present as well.
+    ShaderToggler::ReadMostlyHandleMap<descriptor_heap_data*> heaps;
+    ShaderToggler::ReadMostlyHandleMap<pipeline_layout_data*> layouts;
+    std::vector<std::unique_ptr<descriptor_heap_data>> heap_storage;
+    std::unordered_map<uint64_t, std::unique_ptr<pipeline_layout_data>> layout_storage;
+    std::vector<retired_layout> retired_layouts;
+    uint64_t present_count = 0;
+    mutable std::mutex storage_mutex;
 };
@@ -0,0 +1,139 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Part of ShaderToggler, a shader toggler add on for Reshade 5+ which allows you
+// to define groups of shaders to toggle them on/off with one key press
+// 
+// (c) Frans 'Otis_Inf' Bouma.
+//
+// All rights reserved.
+// https://github.com/FransBouma/ShaderToggler
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met :
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+//	  list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and / or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+/////////////////////////////////////////////////////////////////////////
+
+#include <format>
+#include "EventManager.h"
+#include "AddonUIData.h"
+
+using namespace ShaderToggler;
+using namespace reshade::api;
+using namespace std;
+
+EventManager::EventManager(AddonImGui::AddonUIData& data) : uiData(data)
+{
+}
+
+void EventManager::AddCapabilityListener(EventCapability capability, function<void(bool)> setEnabled)
+{
+    _listeners.push_back({ capability, setEnabled });
+}
+
+void EventManager::EnableAll()
+{
+    UpdateCapabilities(EVENT_CAPABILITY_ALL);
+    _idlePresentCount = 0;
+}
+
+void EventManager::DisableAll()
+{
+    UpdateCapabilities(EVENT_CAPABILITY_NONE);
+}
+
+uint32_t EventManager::OnReshadePresent(effect_runtime* runtime)
+{
+    const uint32_t enabled = GetEnabledCapabilities();
+    const uint32_t required = GetRequiredCapabilities(runtime);
+    const uint32_t added = required & ~enabled;
+    const uint32_t unneeded = enabled & ~required;
+
+    if (unneeded == 0)
+    {
+        _idlePresentCount = 0;
+    }
+    else
+    {
+        _idlePresentCount++;
+    }
+
+    if (added != 0)
+    {
+        // enable what's needed right away, keep the rest until it's been unneeded long enough
+        UpdateCapabilities(enabled | required);
+    }
+
+    if (_idlePresentCount >= IDLE_PRESENTS_BEFORE_DISABLE)
+    {
+        UpdateCapabilities(required);
+        _idlePresentCount = 0;
+
+        reshade::log_message(reshade::log_level::info, format("Disabled unused hot events, remaining event capabilities: {:#x}", required).c_str());
+    }
+
+    return added;
+}
+
+uint32_t EventManager::GetRequiredCapabilities(effect_runtime* runtime) const
+{
+    // nothing gets collected nor rendered while the effects are turned off
+    if (!runtime->get_effects_state())
+    {
+        return EVENT_CAPABILITY_NONE;
+    }
+
+    uint32_t capabilities = EVENT_CAPABILITY_NONE;
+
+    if (*uiData.ActiveCollectorFrameCounter() > 0)
+    {
+        capabilities |= EVENT_CAPABILITY_BIND_PIPELINE;
+    }
+
+    // hunting and editing render previews, active groups render effects, bindings and extract constants. All of which are queued on
+    // bind_pipeline, executed on draw and rely on the tracked state to render on the command list
+    if (uiData.GetToggleGroupIdShaderEditing() >= 0 ||
+        uiData.GetToggleGroupIdEffectEditing() >= 0 ||
+        uiData.GetToggleGroupIdConstantEditing() >= 0 ||
+        uiData.GetPixelShaderManager()->isInHuntingMode() ||
+        uiData.GetVertexShaderManager()->isInHuntingMode() ||
+        uiData.GetComputeShaderManager()->isInHuntingMode() ||
+        uiData.GetToggleGroupIndex()->HasAnyActiveGroup())
+    {
+        capabilities |= EVENT_CAPABILITY_ALL;
+    }
+
+    return capabilities;
+}
+
+void EventManager::UpdateCapabilities(uint32_t capabilities)
+{
+    const uint32_t previous = _enabledCapabilities.exchange(capabilities, memory_order_relaxed);
+
+    for (const auto& listener : _listeners)
+    {
+        const bool wasEnabled = previous & listener.capability;
+        const bool enabled = capabilities & listener.capability;
+
+        if (enabled != wasEnabled)
+        {
+            listener.setEnabled(enabled);
+        }
+    }
+}
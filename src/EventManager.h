@@ -0,0 +1,110 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Part of ShaderToggler, a shader toggler add on for Reshade 5+ which allows you
+// to define groups of shaders to toggle them on/off with one key press
+// 
+// (c) Frans 'Otis_Inf' Bouma.
+//
+// All rights reserved.
+// https://github.com/FransBouma/ShaderToggler
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met :
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+//	  list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and / or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+/////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <atomic>
+#include <vector>
+#include <functional>
+#include "reshade.hpp"
+
+namespace AddonImGui
+{
+    class AddonUIData;
+}
+
+namespace ShaderToggler
+{
+    enum EventCapability : uint32_t
+    {
+        EVENT_CAPABILITY_NONE = 0,
+        EVENT_CAPABILITY_BIND_PIPELINE = 1 << 0,    // shader collection and matching of bound pipelines against the toggle groups
+        EVENT_CAPABILITY_DRAW = 1 << 1,             // draw/dispatch and render target events executing queued effects, bindings, constants and previews
+        EVENT_CAPABILITY_STATE_TRACKING = 1 << 2,   // per command list state, needed to render on and restore a command list
+        EVENT_CAPABILITY_ALL = EVENT_CAPABILITY_BIND_PIPELINE | EVENT_CAPABILITY_DRAW | EVENT_CAPABILITY_STATE_TRACKING
+    };
+
+    /// <summary>
+    /// Gates the hot (per draw call) events on what currently needs them. The events themselves are registered once for the lifetime of the
+    /// addon: ReShade doesn't lock its event lists, and d3d12/vulkan or deferred command lists recorded on other threads may be dispatching
+    /// at any time, so they can't be (un)registered safely while the game runs. Instead every event set is tied to a capability and its
+    /// callbacks return right away while the capability is disabled, which costs a single relaxed load.
+    /// Once per present the capabilities required by the active groups, hunting and editing are determined. Capabilities which are needed
+    /// are enabled right away, capabilities which are no longer needed are only disabled after they haven't been needed for
+    /// IDLE_PRESENTS_BEFORE_DISABLE presents, so toggling a group doesn't keep dropping the tracked state.
+    /// </summary>
+    class __declspec(novtable) EventManager final
+    {
+    public:
+        EventManager(AddonImGui::AddonUIData& data);
+
+        /// <summary>
+        /// Calls setEnabled whenever the passed in capability gets enabled or disabled. For callbacks living outside of Main.cpp which can't
+        /// query the event manager.
+        /// </summary>
+        void AddCapabilityListener(EventCapability capability, std::function<void(bool)> setEnabled);
+
+        /// <summary>
+        /// Enables all capabilities. Called when the addon is attached, the first presents will disable what isn't needed.
+        /// </summary>
+        void EnableAll();
+        /// <summary>
+        /// Disables all capabilities. Called when the addon is detached.
+        /// </summary>
+        void DisableAll();
+
+        /// <summary>
+        /// Updates the enabled capabilities to the currently required ones. Must only be called from reshade_present.
+        /// </summary>
+        /// <returns>the capabilities which got enabled during this call</returns>
+        uint32_t OnReshadePresent(reshade::api::effect_runtime* runtime);
+
+        bool IsEnabled(EventCapability capability) const { return (_enabledCapabilities.load(std::memory_order_relaxed) & capability) != 0; }
+        uint32_t GetEnabledCapabilities() const { return _enabledCapabilities.load(std::memory_order_relaxed); }
+
+    private:
+        struct CapabilityListener
+        {
+            EventCapability capability;
+            std::function<void(bool)> setEnabled;
+        };
+
+        uint32_t GetRequiredCapabilities(reshade::api::effect_runtime* runtime) const;
+        void UpdateCapabilities(uint32_t capabilities);
+
+        static constexpr uint32_t IDLE_PRESENTS_BEFORE_DISABLE = 120;
+
+        AddonImGui::AddonUIData& uiData;
+        std::vector<CapabilityListener> _listeners;
+        std::atomic<uint32_t> _enabledCapabilities = EVENT_CAPABILITY_NONE;
+        uint32_t _idlePresentCount = 0;
+    };
+}
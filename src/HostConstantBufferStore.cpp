@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <thread>
+#include "HostConstantBufferStore.h"
+
+using namespace Shim::Constants;
+using namespace std;
+
+void HostConstantBufferStore::Create(uint64_t handle, size_t size, uint32_t frame)
+{
+    Shard& shard = ShardFor(handle);
+
+    unique_lock<shared_mutex> lock(shard.mutex);
+    if (!shard.buffers.contains(handle))
+    {
+        shard.buffers.emplace(handle, make_unique<Buffer>(size, frame));
+    }
+}
+
+void HostConstantBufferStore::Erase(uint64_t handle)
+{
+    Shard& shard = ShardFor(handle);
+
+    unique_lock<shared_mutex> lock(shard.mutex);
+    shard.buffers.erase(handle);
+}
+
+bool HostConstantBufferStore::Contains(uint64_t handle) const
+{
+    const Shard& shard = ShardFor(handle);
+
+    shared_lock<shared_mutex> lock(shard.mutex);
+    return shard.buffers.contains(handle);
+}
+
+bool HostConstantBufferStore::Write(uint64_t handle, const void* src, size_t size, size_t offset)
+{
+    Shard& shard = ShardFor(handle);
+
+    shared_lock<shared_mutex> lock(shard.mutex);
+    const auto it = shard.buffers.find(handle);
+    if (it == shard.buffers.end())
+    {
+        return false;
+    }
+
+    Buffer& buffer = *it->second;
+    if (offset >= buffer.size)
+    {
+        return true;
+    }
+
+    const uint64_t sequence = BeginWrite(buffer);
+
+    memcpy(buffer.data.get() + offset, src, min(size, buffer.size - offset));
+    buffer.written.store(true, memory_order_release);
+
+    buffer.sequence.store(sequence + 2, memory_order_release);
+
+    return true;
+}
+
+bool HostConstantBufferStore::Seed(uint64_t handle, const void* src, size_t size)
+{
+    Shard& shard = ShardFor(handle);
+
+    shared_lock<shared_mutex> lock(shard.mutex);
+    const auto it = shard.buffers.find(handle);
+    if (it == shard.buffers.end())
+    {
+        return false;
+    }
+
+    Buffer& buffer = *it->second;
+    const uint64_t sequence = BeginWrite(buffer);
+
+    // Checked while holding the buffer, so a write can't slip in between and be overwritten
+    const bool seeded = !buffer.written.load(memory_order_relaxed);
+    if (seeded)
+    {
+        memcpy(buffer.data.get(), src, min(size, buffer.size));
+        buffer.written.store(true, memory_order_release);
+    }
+
+    buffer.sequence.store(sequence + 2, memory_order_release);
+
+    return seeded;
+}
+
+uint64_t HostConstantBufferStore::BeginWrite(Buffer& buffer)
+{
+    // Claim the buffer by making the sequence odd, only writers of this same buffer wait here
+    uint64_t sequence = buffer.sequence.load(memory_order_relaxed);
+    while ((sequence & 1) || !buffer.sequence.compare_exchange_weak(sequence, sequence + 1, memory_order_acquire, memory_order_relaxed))
+    {
+        if (sequence & 1)
+        {
+            this_thread::yield();
+            sequence = buffer.sequence.load(memory_order_relaxed);
+        }
+    }
+    atomic_thread_fence(memory_order_release);
+
+    return sequence;
+}
+
+void HostConstantBufferStore::EvictIdle(uint32_t frame, uint32_t idleFrames)
+{
+    for (Shard& shard : _shards)
+    {
+        unique_lock<shared_mutex> lock(shard.mutex);
+        erase_if(shard.buffers, [frame, idleFrames](const auto& entry) {
+            return frame - entry.second->lastReadFrame.load(memory_order_relaxed) > idleFrames;
+            });
+    }
+}
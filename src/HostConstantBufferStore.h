@@ -0,0 +1,136 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <cstdint>
+
+namespace Shim
+{
+    namespace Constants
+    {
+        /// <summary>
+        /// Host copies of constant buffers, spread over shards by handle so threads touching different buffers don't share a lock. The shard
+        /// lock is only taken exclusively to add or remove buffers; reads and writes of buffer content take it shared, just to keep the buffer
+        /// alive. The content itself is guarded by a per buffer sequence counter: writers make it odd while copying (and spin on each other
+        /// only when they write the same buffer), readers retry until they copied the content without the counter changing.
+        /// </summary>
+        class HostConstantBufferStore final
+        {
+        public:
+            enum class ReadResult
+            {
+                Missing,
+                WarmingUp,
+                Copied
+            };
+
+            HostConstantBufferStore() = default;
+
+            HostConstantBufferStore(const HostConstantBufferStore&) = delete;
+            HostConstantBufferStore& operator=(const HostConstantBufferStore&) = delete;
+
+            /// <summary>
+            /// Adds a zeroed buffer of size bytes for handle, created in frame. It's reported as WarmingUp until it's seeded or written. Does
+            /// nothing if handle already has a buffer.
+            /// </summary>
+            void Create(uint64_t handle, size_t size, uint32_t frame);
+            void Erase(uint64_t handle);
+            bool Contains(uint64_t handle) const;
+
+            /// <summary>
+            /// Copies size bytes from src to offset in the buffer of handle, clamped to the buffer size. Returns false if handle has no buffer.
+            /// </summary>
+            bool Write(uint64_t handle, const void* src, size_t size, size_t offset);
+
+            /// <summary>
+            /// Fills the buffer of handle with the first size bytes of src, the content it had before it was created. Returns false and leaves
+            /// the buffer alone if handle has no buffer or it was written already, those writes are newer than src.
+            /// </summary>
+            bool Seed(uint64_t handle, const void* src, size_t size);
+
+            /// <summary>
+            /// Calls copy(data, size) with the content of the buffer of handle and marks it as read in frame. copy is called again until it
+            /// ran without a write in between, so whatever it copied is a consistent snapshot. Buffers which weren't seeded or written yet
+            /// are reported as WarmingUp and aren't passed to copy: their zeroes aren't the content of the buffer.
+            /// </summary>
+            template<typename F>
+            ReadResult Read(uint64_t handle, uint32_t frame, F&& copy)
+            {
+                Shard& shard = ShardFor(handle);
+
+                std::shared_lock<std::shared_mutex> lock(shard.mutex);
+                const auto it = shard.buffers.find(handle);
+                if (it == shard.buffers.end())
+                {
+                    return ReadResult::Missing;
+                }
+
+                Buffer& buffer = *it->second;
+                buffer.lastReadFrame.store(frame, std::memory_order_relaxed);
+
+                if (!buffer.written.load(std::memory_order_acquire))
+                {
+                    return ReadResult::WarmingUp;
+                }
+
+                for (;;)
+                {
+                    const uint64_t sequence = buffer.sequence.load(std::memory_order_acquire);
+
+                    if (sequence & 1)
+                    {
+                        std::this_thread::yield();
+                        continue;
+                    }
+
+                    copy(static_cast<const uint8_t*>(buffer.data.get()), buffer.size);
+
+                    std::atomic_thread_fence(std::memory_order_acquire);
+
+                    if (buffer.sequence.load(std::memory_order_relaxed) == sequence)
+                    {
+                        return ReadResult::Copied;
+                    }
+                }
+            }
+
+            /// <summary>
+            /// Removes the buffers which weren't read in the last idleFrames frames before frame.
+            /// </summary>
+            void EvictIdle(uint32_t frame, uint32_t idleFrames);
+
+        private:
+            static constexpr size_t SHARD_COUNT = 16;
+
+            struct Buffer
+            {
+                Buffer(size_t s, uint32_t frame) : size(s), lastReadFrame(frame), data(new uint8_t[s]()) {}
+
+                const size_t size;
+                std::atomic<uint32_t> lastReadFrame;
+                std::atomic<bool> written = false;
+                std::atomic<uint64_t> sequence = 0;
+                std::unique_ptr<uint8_t[]> data;
+            };
+
+            struct alignas(64) Shard
+            {
+                mutable std::shared_mutex mutex;
+                std::unordered_map<uint64_t, std::unique_ptr<Buffer>> buffers;
+            };
+
+            // Claims buffer for writing by making its sequence odd and returns the sequence to publish the write with
+            static uint64_t BeginWrite(Buffer& buffer);
+
+            Shard& ShardFor(uint64_t handle) { return _shards[(handle * 0x9E3779B97F4A7C15ull) >> 60]; }
+            const Shard& ShardFor(uint64_t handle) const { return _shards[(handle * 0x9E3779B97F4A7C15ull) >> 60]; }
+
+            std::array<Shard, SHARD_COUNT> _shards;
+        };
+    }
+}
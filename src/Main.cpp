@@ -42,6 +42,8 @@
 #include <MinHook.h>
 #include "crc32_hash.hpp"
 #include "ShaderManager.h"
+#include "PipelineShaderCache.h"
+#include "EventManager.h"
 #include "CDataFile.h"
 #include "ToggleGroup.h"
 #include "AddonUIData.h"
@@ -85,6 +87,8 @@ static bool constantHandlerHooked = false;
 
 static atomic_uint32_t g_activeCollectorFrameCounter = 0;
 static AddonUIData g_addonUIData(&g_pixelShaderManager, &g_vertexShaderManager, &g_computeShaderManager, constantHandler, &g_activeCollectorFrameCounter);
+static ShaderToggler::PipelineShaderCache g_pipelineShaderCache(g_addonUIData);
+static ShaderToggler::EventManager g_eventManager(g_addonUIData);
 
 static KeyMonitor keyMonitor;
 static Rendering::ResourceManager resourceManager;
@@ -130,6 +134,11 @@ static void onDestroyDevice(device* device)
     resourceManager.OnDestroyDevice(device);
     renderingShaderManager.DestroyShaders(device);
 
+    if (constantCopy != nullptr)
+    {
+        constantCopy->OnDestroyDevice(device);
+    }
+
     device->destroy_private_data<DeviceDataContainer>();
 }
 
@@ -320,6 +329,10 @@ static void onDestroyEffectRuntime(effect_runtime* runtime)
 
 static void onInitPipeline(device* device, pipeline_layout, uint32_t subobjectCount, const pipeline_subobject* subobjects, pipeline pipelineHandle)
 {
+    uint32_t pixelShaderHash = 0;
+    uint32_t vertexShaderHash = 0;
+    uint32_t computeShaderHash = 0;
+
     // shader has been created, we will now create a hash and store it with the handle we got.
     for (uint32_t i = 0; i < subobjectCount; ++i)
     {
@@ -327,21 +340,26 @@ static void onInitPipeline(device* device, pipeline_layout, uint32_t subobjectCo
         {
         case pipeline_subobject_type::vertex_shader:
         {
-            g_vertexShaderManager.addHashHandlePair(calculateShaderHash(subobjects[i].data), pipelineHandle.handle);
+            vertexShaderHash = calculateShaderHash(subobjects[i].data);
+            g_vertexShaderManager.addHashHandlePair(vertexShaderHash, pipelineHandle.handle);
         }
         break;
         case pipeline_subobject_type::pixel_shader:
         {
-            g_pixelShaderManager.addHashHandlePair(calculateShaderHash(subobjects[i].data), pipelineHandle.handle);
+            pixelShaderHash = calculateShaderHash(subobjects[i].data);
+            g_pixelShaderManager.addHashHandlePair(pixelShaderHash, pipelineHandle.handle);
         }
         break;
         case pipeline_subobject_type::compute_shader:
         {
-            g_computeShaderManager.addHashHandlePair(calculateShaderHash(subobjects[i].data), pipelineHandle.handle);
+            computeShaderHash = calculateShaderHash(subobjects[i].data);
+            g_computeShaderManager.addHashHandlePair(computeShaderHash, pipelineHandle.handle);
         }
         break;
         }
     }
+
+    g_pipelineShaderCache.AddPipeline(pipelineHandle.handle, pixelShaderHash, vertexShaderHash, computeShaderHash);
 }
 
 
@@ -350,19 +368,32 @@ static void onDestroyPipeline(device* device, pipeline pipelineHandle)
     g_pixelShaderManager.removeHandle(pipelineHandle.handle);
     g_vertexShaderManager.removeHandle(pipelineHandle.handle);
     g_computeShaderManager.removeHandle(pipelineHandle.handle);
+    g_pipelineShaderCache.RemovePipeline(pipelineHandle.handle);
 }
 
 
 static void onBindPipeline(command_list* commandList, pipeline_stage stages, pipeline pipelineHandle)
 {
+    if (!g_eventManager.IsEnabled(ShaderToggler::EVENT_CAPABILITY_BIND_PIPELINE))
+    {
+        return;
+    }
+
     if (nullptr == commandList || pipelineHandle.handle == 0 || !((uint32_t)(stages & pipeline_stage::pixel_shader) || (uint32_t)(stages & pipeline_stage::vertex_shader) || (uint32_t)(stages & pipeline_stage::compute_shader)))
     {
         return;
     }
 
-    const uint32_t handleHasPixelShaderAttached = (uint32_t)(stages & pipeline_stage::pixel_shader) ? g_pixelShaderManager.safeGetShaderHash(pipelineHandle.handle) : 0;
-    const uint32_t handleHasVertexShaderAttached = (uint32_t)(stages & pipeline_stage::vertex_shader) ? g_vertexShaderManager.safeGetShaderHash(pipelineHandle.handle) : 0;
-    const uint32_t handleHasComputeShaderAttached = (uint32_t)(stages & pipeline_stage::compute_shader) ? g_computeShaderManager.safeGetShaderHash(pipelineHandle.handle) : 0;
+    PipelineShaderRecord record;
+    if (!g_pipelineShaderCache.GetPipeline(pipelineHandle.handle, record))
+    {
+        // draw call with unknown handle, don't collect it
+        return;
+    }
+
+    const uint32_t handleHasPixelShaderAttached = (uint32_t)(stages & pipeline_stage::pixel_shader) ? record.pixelShaderHash : 0;
+    const uint32_t handleHasVertexShaderAttached = (uint32_t)(stages & pipeline_stage::vertex_shader) ? record.vertexShaderHash : 0;
+    const uint32_t handleHasComputeShaderAttached = (uint32_t)(stages & pipeline_stage::compute_shader) ? record.computeShaderHash : 0;
 
     if (!handleHasPixelShaderAttached && !handleHasVertexShaderAttached && !handleHasComputeShaderAttached)
     {
@@ -392,7 +423,8 @@ static void onBindPipeline(command_list* commandList, pipeline_stage stages, pip
             commandListData.ps.constantBuffersToUpdate.clear();
         }
 
-        commandListData.ps.blockedShaderGroups = g_addonUIData.GetToggleGroupsForPixelShaderHash(handleHasPixelShaderAttached);
+        commandListData.ps.shaderGroupBits = record.pixelShaderGroupBits;
+        commandListData.ps.shaderGroupEpoch = record.groupEpoch;
         commandListData.ps.activeShaderHash = handleHasPixelShaderAttached;
     }
 
@@ -409,7 +441,8 @@ static void onBindPipeline(command_list* commandList, pipeline_stage stages, pip
             commandListData.vs.constantBuffersToUpdate.clear();
         }
 
-        commandListData.vs.blockedShaderGroups = g_addonUIData.GetToggleGroupsForVertexShaderHash(handleHasVertexShaderAttached);
+        commandListData.vs.shaderGroupBits = record.vertexShaderGroupBits;
+        commandListData.vs.shaderGroupEpoch = record.groupEpoch;
         commandListData.vs.activeShaderHash = handleHasVertexShaderAttached;
     }
 
@@ -426,7 +459,8 @@ static void onBindPipeline(command_list* commandList, pipeline_stage stages, pip
             commandListData.cs.constantBuffersToUpdate.clear();
         }
 
-        commandListData.cs.blockedShaderGroups = g_addonUIData.GetToggleGroupsForComputeShaderHash(handleHasComputeShaderAttached);
+        commandListData.cs.shaderGroupBits = record.computeShaderGroupBits;
+        commandListData.cs.shaderGroupEpoch = record.groupEpoch;
         commandListData.cs.activeShaderHash = handleHasComputeShaderAttached;
     }
 
@@ -456,6 +490,11 @@ static void onBindPipeline(command_list* commandList, pipeline_stage stages, pip
 
 static void onBindRenderTargetsAndDepthStencil(command_list* cmd_list, uint32_t count, const resource_view* rtvs, resource_view dsv)
 {
+    if (!g_eventManager.IsEnabled(ShaderToggler::EVENT_CAPABILITY_DRAW))
+    {
+        return;
+    }
+
     if (cmd_list == nullptr || cmd_list->get_device() == nullptr)
     {
         return;
@@ -489,6 +528,11 @@ static void onBindRenderTargetsAndDepthStencil(command_list* cmd_list, uint32_t
 
 static void onBeginRenderPass(command_list* cmd_list, uint32_t count, const render_pass_render_target_desc* rts, const render_pass_depth_stencil_desc* ds)
 {
+    if (!g_eventManager.IsEnabled(ShaderToggler::EVENT_CAPABILITY_DRAW))
+    {
+        return;
+    }
+
     if (cmd_list == nullptr || cmd_list->get_device() == nullptr)
     {
         return;
@@ -569,11 +613,38 @@ static void onReshadePresent(effect_runtime* runtime)
 
     techniqueManager.OnReshadePresent(runtime);
 
+    if (constantCopy != nullptr)
+    {
+        constantCopy->OnReshadePresent();
+    }
+
     deviceData.bindingsUpdated.clear();
     deviceData.constantsUpdated.clear();
     deviceData.huntPreview.Reset();
 
+    g_pixelShaderManager.mergeActiveShaderHashes();
+    g_vertexShaderManager.mergeActiveShaderHashes();
+    g_computeShaderManager.mergeActiveShaderHashes();
+    g_pixelShaderManager.reclaimRetiredHandleTables();
+    g_vertexShaderManager.reclaimRetiredHandleTables();
+    g_computeShaderManager.reclaimRetiredHandleTables();
+    g_pipelineShaderCache.ReclaimRetired();
+    g_addonUIData.ReleaseRetiredToggleGroupIndices();
+
     CheckHotkeys(g_addonUIData, runtime);
+
+    g_addonUIData.UpdateStateTrackingInterest();
+
+    const uint32_t enabledCapabilities = g_eventManager.OnReshadePresent(runtime);
+
+    // The immediate command list is never reset, so drop whatever it tracked before the hot events were last disabled. Command lists
+    // of d3d12/vulkan get reset before they're recorded again.
+    if (enabledCapabilities != ShaderToggler::EVENT_CAPABILITY_NONE && dev->get_api() != device_api::d3d12 && dev->get_api() != device_api::vulkan)
+    {
+        command_list* immediateCommandList = queue->get_immediate_command_list();
+        onResetCommandList(immediateCommandList);
+        immediateCommandList->get_private_data<state_tracking>().clear();
+    }
 }
 
 
@@ -613,6 +684,12 @@ static void Init()
     constantManager.Init(g_addonUIData, groupResourceManager, &constantCopy, &constantHandler);
 
     g_addonUIData.AddToggleGroupRemovalCallback(std::bind(&Rendering::ToggleGroupResourceManager::ToggleGroupRemoved, &groupResourceManager, std::placeholders::_1, std::placeholders::_2));
+    g_addonUIData.AddToggleGroupRemovalCallback([](effect_runtime* runtime, ShaderToggler::ToggleGroup* group) {
+        if (constantHandler != nullptr)
+        {
+            constantHandler->RemoveGroup(group, runtime->get_device());
+        }
+        });
     techniqueManager.AddEffectsReloadingCallback(std::bind(&Shim::Constants::ConstantHandlerBase::OnEffectsReloading, constantHandler, std::placeholders::_1));
     techniqueManager.AddEffectsReloadedCallback(std::bind(&Shim::Constants::ConstantHandlerBase::OnEffectsReloaded, constantHandler, std::placeholders::_1));
     techniqueManager.AddEffectsReloadingCallback(std::bind(&Rendering::ResourceManager::OnEffectsReloading, &resourceManager, std::placeholders::_1));
@@ -656,6 +733,11 @@ static void CheckDrawCall(command_list* cmd_list, const uint64_t match_modifier
 
 static bool onDraw(command_list* cmd_list, uint32_t vertex_count, uint32_t instance_count, uint32_t first_vertex, uint32_t first_instance)
 {
+    if (!g_eventManager.IsEnabled(ShaderToggler::EVENT_CAPABILITY_DRAW))
+    {
+        return false;
+    }
+
     CheckDrawCall(cmd_list, Rendering::MATCH_PS | Rendering::MATCH_VS);
 
     return false;
@@ -663,6 +745,11 @@ static bool onDraw(command_list* cmd_list, uint32_t vertex_count, uint32_t insta
 
 static bool onDispatch(command_list* cmd_list, uint32_t group_count_x, uint32_t group_count_y, uint32_t group_count_z)
 {
+    if (!g_eventManager.IsEnabled(ShaderToggler::EVENT_CAPABILITY_DRAW))
+    {
+        return false;
+    }
+
     CheckDrawCall(cmd_list, Rendering::MATCH_CS);
 
     return false;
@@ -670,6 +757,11 @@ static bool onDispatch(command_list* cmd_list, uint32_t group_count_x, uint32_t
 
 static bool onDrawIndexed(command_list* cmd_list, uint32_t index_count, uint32_t instance_count, uint32_t first_index, int32_t vertex_offset, uint32_t first_instance)
 {
+    if (!g_eventManager.IsEnabled(ShaderToggler::EVENT_CAPABILITY_DRAW))
+    {
+        return false;
+    }
+
     CheckDrawCall(cmd_list, Rendering::MATCH_PS | Rendering::MATCH_VS);
 
     return false;
@@ -677,6 +769,11 @@ static bool onDrawIndexed(command_list* cmd_list, uint32_t index_count, uint32_t
 
 static bool onDrawOrDispatchIndirect(command_list* cmd_list, indirect_command type, resource buffer, uint64_t offset, uint32_t draw_count, uint32_t stride)
 {
+    if (!g_eventManager.IsEnabled(ShaderToggler::EVENT_CAPABILITY_DRAW))
+    {
+        return false;
+    }
+
     switch (type)
     {
     case indirect_command::unknown:
@@ -758,6 +855,10 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD fdwReason, LPVOID)
         reshade::register_event<reshade::addon_event::draw_indexed>(onDrawIndexed);
         reshade::register_event<reshade::addon_event::draw_or_dispatch_indirect>(onDrawOrDispatchIndirect);
 
+        // the hot events above stay registered, the event manager only enables what's needed, see EventManager
+        g_eventManager.AddCapabilityListener(ShaderToggler::EVENT_CAPABILITY_STATE_TRACKING, &state_tracking::set_state_events_enabled);
+        g_eventManager.EnableAll();
+
         reshade::register_overlay(nullptr, &displaySettings);
         break;
     case DLL_PROCESS_DETACH:
@@ -798,6 +899,8 @@ BOOL APIENTRY DllMain(HMODULE hModule, DWORD fdwReason, LPVOID)
         reshade::unregister_event<reshade::addon_event::draw_indexed>(onDrawIndexed);
         reshade::unregister_event<reshade::addon_event::draw_or_dispatch_indirect>(onDrawOrDispatchIndirect);
 
+        g_eventManager.DisableAll();
+
         reshade::unregister_overlay(nullptr, &displaySettings);
 
         state_tracking::unregister_events();
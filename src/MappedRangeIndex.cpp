@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <thread>
+#include "MappedRangeIndex.h"
+
+using namespace Shim::Constants;
+using namespace std;
+
+size_t MappedRangeIndex::ThreadStripe()
+{
+    static atomic<size_t> nextStripe = 0;
+    thread_local const size_t stripe = nextStripe.fetch_add(1, memory_order_relaxed) % READ_INDICATOR_STRIPES;
+
+    return stripe;
+}
+
+bool MappedRangeIndex::Find(uintptr_t address, MappedRange& range) const
+{
+    ReadIndicatorStripe& indicator = _readIndicators[_versionIndex.load()][ThreadStripe()];
+    indicator.readers.fetch_add(1);
+
+    const vector<Entry>& entries = _instances[_readInstance.load()];
+
+    // First entry which starts after address, the one before it is the candidate
+    const auto next = upper_bound(entries.begin(), entries.end(), address, [](uintptr_t a, const Entry& entry) { return a < entry.first; });
+    const bool found = next != entries.begin() && address <= prev(next)->last;
+
+    if (found)
+    {
+        range.resource = prev(next)->resource;
+        range.destination = prev(next)->first;
+        range.bufferSize = prev(next)->bufferSize;
+    }
+
+    indicator.readers.fetch_sub(1, memory_order_release);
+
+    return found;
+}
+
+void MappedRangeIndex::AddTo(vector<Entry>& entries, const Entry& entry)
+{
+    const auto position = upper_bound(entries.begin(), entries.end(), entry.first, [](uintptr_t a, const Entry& e) { return a < e.first; });
+    entries.insert(position, entry);
+}
+
+void MappedRangeIndex::RemoveFrom(vector<Entry>& entries, const Entry& entry)
+{
+    // Ranges can share a start address, look for the one of this resource among those
+    auto it = lower_bound(entries.begin(), entries.end(), entry.first, [](const Entry& e, uintptr_t a) { return e.first < a; });
+
+    for (; it != entries.end() && it->first == entry.first; ++it)
+    {
+        if (it->resource == entry.resource)
+        {
+            entries.erase(it);
+            return;
+        }
+    }
+}
+
+template<typename F>
+void MappedRangeIndex::Write(F&& update)
+{
+    const uint32_t readInstance = _readInstance.load(memory_order_relaxed);
+
+    update(_instances[readInstance ^ 1]);
+    _readInstance.store(readInstance ^ 1);
+
+    // Readers which announced themselves before the switch may still search the old instance
+    const uint32_t versionIndex = _versionIndex.load(memory_order_relaxed);
+    WaitForReaders(_readIndicators[versionIndex ^ 1]);
+    _versionIndex.store(versionIndex ^ 1);
+    WaitForReaders(_readIndicators[versionIndex]);
+
+    update(_instances[readInstance]);
+}
+
+void MappedRangeIndex::WaitForReaders(const ReadIndicator& indicator) const
+{
+    for (const ReadIndicatorStripe& stripe : indicator)
+    {
+        while (stripe.readers.load(memory_order_acquire) != 0)
+        {
+            this_thread::yield();
+        }
+    }
+}
+
+bool MappedRangeIndex::Add(uint64_t resource, uintptr_t first, uintptr_t last, uint64_t bufferSize)
+{
+    unique_lock<mutex> lock(_writeMutex);
+
+    const Entry entry = { first, last, resource, bufferSize };
+    const auto previous = _resourceEntries.find(resource);
+    const bool inserted = previous == _resourceEntries.end();
+
+    if (!inserted)
+    {
+        const Entry replaced = previous->second;
+
+        Write([&](vector<Entry>& entries) {
+            RemoveFrom(entries, replaced);
+            AddTo(entries, entry);
+        });
+
+        _lasts.erase(_lasts.find(replaced.last));
+        previous->second = entry;
+    }
+    else
+    {
+        Write([&](vector<Entry>& entries) { AddTo(entries, entry); });
+
+        _resourceEntries.emplace(resource, entry);
+    }
+
+    _lasts.insert(last);
+    UpdateBoundsLocked();
+
+    return inserted;
+}
+
+bool MappedRangeIndex::Remove(uint64_t resource)
+{
+    unique_lock<mutex> lock(_writeMutex);
+
+    const auto it = _resourceEntries.find(resource);
+
+    if (it == _resourceEntries.end())
+    {
+        return false;
+    }
+
+    const Entry removed = it->second;
+    _resourceEntries.erase(it);
+
+    Write([&](vector<Entry>& entries) { RemoveFrom(entries, removed); });
+
+    _lasts.erase(_lasts.find(removed.last));
+    UpdateBoundsLocked();
+
+    return true;
+}
+
+void MappedRangeIndex::UpdateBoundsLocked()
+{
+    // Both instances are equal again once a write returns
+    const vector<Entry>& entries = _instances[_readInstance.load(memory_order_relaxed)];
+
+    const uintptr_t lowest = entries.empty() ? UINTPTR_MAX : entries.front().first;
+    const uintptr_t highest = _lasts.empty() ? 0 : *_lasts.rbegin();
+
+    _count.store(entries.size(), memory_order_relaxed);
+    _lowest.store(lowest, memory_order_relaxed);
+    _highest.store(highest, memory_order_relaxed);
+
+    // Still under the write mutex, so listeners see the bounds in the order of the writes
+    if (_onBoundsChanged != nullptr)
+    {
+        _onBoundsChanged(lowest, highest);
+    }
+}
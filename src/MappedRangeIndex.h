@@ -0,0 +1,110 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_map>
+#include <vector>
+#include <cstdint>
+
+namespace Shim
+{
+    namespace Constants
+    {
+        struct MappedRange
+        {
+            uint64_t resource = 0;
+            uintptr_t destination = 0;
+            uint64_t bufferSize = 0;
+        };
+
+        /// <summary>
+        /// Mapped buffer memory ranges sorted by start address, so the range containing an address is found with a binary search. Lookups
+        /// are wait free, the index is a left-right pair: readers announce themselves on a read indicator and search the instance writers
+        /// currently leave alone. A writer, serialized by a mutex, updates the other instance, points new readers at it, waits for the
+        /// readers still on the first one to leave and then repeats the update there. Readers never wait, only writers do, for lookups
+        /// already in progress.
+        /// </summary>
+        class MappedRangeIndex final
+        {
+        public:
+            using BoundsListener = void (*)(uintptr_t lowest, uintptr_t highest);
+
+            /// <summary>
+            /// onBoundsChanged, if not nullptr, is called with the new Lowest and Highest after every Add and Remove, in the order of those
+            /// and before they return.
+            /// </summary>
+            explicit MappedRangeIndex(BoundsListener onBoundsChanged = nullptr) : _onBoundsChanged(onBoundsChanged) {}
+
+            MappedRangeIndex(const MappedRangeIndex&) = delete;
+            MappedRangeIndex& operator=(const MappedRangeIndex&) = delete;
+
+            /// <summary>
+            /// Adds the range [first, last] mapped for resource, replacing the range the resource had before. Returns true if resource had
+            /// none, false if it was replaced.
+            /// </summary>
+            bool Add(uint64_t resource, uintptr_t first, uintptr_t last, uint64_t bufferSize);
+            /// <summary>
+            /// Removes the range of resource, returns false if resource had none.
+            /// </summary>
+            bool Remove(uint64_t resource);
+
+            /// <summary>
+            /// Finds the range with the highest start address at or below address and returns true if address lies in it.
+            /// </summary>
+            bool Find(uintptr_t address, MappedRange& range) const;
+
+            bool Empty() const { return _count.load(std::memory_order_relaxed) == 0; }
+            size_t Size() const { return _count.load(std::memory_order_relaxed); }
+
+            /// <summary>
+            /// Lowest first and highest last address over all ranges, UINTPTR_MAX and 0 while the index is empty.
+            /// </summary>
+            uintptr_t Lowest() const { return _lowest.load(std::memory_order_relaxed); }
+            uintptr_t Highest() const { return _highest.load(std::memory_order_relaxed); }
+
+        private:
+            static constexpr size_t READ_INDICATOR_STRIPES = 16;
+
+            struct Entry
+            {
+                uintptr_t first;
+                uintptr_t last;
+                uint64_t resource;
+                uint64_t bufferSize;
+            };
+
+            // Readers of different threads count themselves on different cache lines
+            struct alignas(64) ReadIndicatorStripe
+            {
+                std::atomic<int64_t> readers = 0;
+            };
+
+            using ReadIndicator = std::array<ReadIndicatorStripe, READ_INDICATOR_STRIPES>;
+
+            static size_t ThreadStripe();
+            static void AddTo(std::vector<Entry>& entries, const Entry& entry);
+            static void RemoveFrom(std::vector<Entry>& entries, const Entry& entry);
+
+            template<typename F>
+            void Write(F&& update);
+            void WaitForReaders(const ReadIndicator& indicator) const;
+            void UpdateBoundsLocked();
+
+            std::array<std::vector<Entry>, 2> _instances;
+            std::atomic<uint32_t> _readInstance = 0;         // instance readers search
+            std::atomic<uint32_t> _versionIndex = 0;         // read indicator readers announce themselves on
+            mutable std::array<ReadIndicator, 2> _readIndicators;
+            std::atomic<size_t> _count = 0;
+            std::atomic<uintptr_t> _lowest = UINTPTR_MAX;
+            std::atomic<uintptr_t> _highest = 0;
+
+            const BoundsListener _onBoundsChanged;
+            std::mutex _writeMutex;
+            std::unordered_map<uint64_t, Entry> _resourceEntries;  // range of each resource, only touched by writers
+            std::multiset<uintptr_t> _lasts;                        // end addresses of all ranges, so the highest one is known without a scan
+        };
+    }
+}
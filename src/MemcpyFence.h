@@ -0,0 +1,39 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace Shim
+{
+    namespace Constants
+    {
+        /// <summary>
+        /// Decides in the memcpy detour whether a call can write into a mapped constant buffer: only if the calling thread has one mapped
+        /// and the destination lies between the lowest and highest mapped address. Everything else is rejected before any virtual call
+        /// or lock. The copiers keep both up to date when buffers are mapped and unmapped.
+        /// </summary>
+        class MemcpyFence final
+        {
+        public:
+            static void OnThreadMapped() { _threadMapCount++; }
+            static void OnThreadUnmapped() { _threadMapCount = _threadMapCount > 0 ? _threadMapCount - 1 : 0; }
+            static uint32_t ThreadMapCount() { return _threadMapCount; }
+
+            static void Set(uintptr_t lowest, uintptr_t highest)
+            {
+                _mappedLowest.store(lowest, std::memory_order_relaxed);
+                _mappedHighest.store(highest, std::memory_order_relaxed);
+            }
+
+            static bool Admits(uintptr_t destination)
+            {
+                return _threadMapCount > 0 && destination >= _mappedLowest.load(std::memory_order_relaxed) && destination <= _mappedHighest.load(std::memory_order_relaxed);
+            }
+
+        private:
+            static inline thread_local uint32_t _threadMapCount = 0;
+            static inline std::atomic<uintptr_t> _mappedLowest = UINTPTR_MAX;
+            static inline std::atomic<uintptr_t> _mappedHighest = 0;
+        };
+    }
+}
@@ -0,0 +1,232 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Part of ShaderToggler, a shader toggler add on for Reshade 5+ which allows you
+// to define groups of shaders to toggle them on/off with one key press
+// 
+// (c) Frans 'Otis_Inf' Bouma.
+//
+// All rights reserved.
+// https://github.com/FransBouma/ShaderToggler
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met :
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+//	  list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and / or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+/////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+namespace ShaderToggler
+{
+    /// <summary>
+    /// Array of value-initialized elements split in fixed size pages which are allocated on first use. Elements never move once their page
+    /// is allocated, so readers and writers of existing elements don't take a lock. Pages are published through an atomic page directory;
+    /// allocating a page or growing the directory is serialized by a mutex. Superseded directories are kept alive until the array is
+    /// destroyed so readers still using them never touch freed memory, as every directory doubles the previous one they're bounded by
+    /// the active one.
+    /// </summary>
+    template<typename T, size_t PageSize = 4096>
+    class PagedArray final
+    {
+        static_assert((PageSize & (PageSize - 1)) == 0, "PageSize has to be a power of two");
+
+    public:
+        PagedArray()
+        {
+            _directories.push_back(std::make_unique<Directory>(MIN_DIRECTORY_CAPACITY));
+            _directory.store(_directories.back().get(), std::memory_order_release);
+        }
+
+        ~PagedArray()
+        {
+            const Directory* directory = _directory.load(std::memory_order_relaxed);
+
+            for (size_t i = 0; i < directory->capacity; i++)
+            {
+                delete[] directory->pages[i].load(std::memory_order_relaxed);
+            }
+        }
+
+        PagedArray(const PagedArray&) = delete;
+        PagedArray& operator=(const PagedArray&) = delete;
+
+        /// <summary>
+        /// Returns the element at index, nullptr if its page wasn't allocated yet. Lock free.
+        /// </summary>
+        const T* find(size_t index) const
+        {
+            const Directory* directory = _directory.load(std::memory_order_acquire);
+            const size_t page = index / PageSize;
+
+            if (page >= directory->capacity)
+            {
+                return nullptr;
+            }
+
+            const T* pageData = directory->pages[page].load(std::memory_order_acquire);
+            return pageData != nullptr ? &pageData[index % PageSize] : nullptr;
+        }
+
+        T* find(size_t index)
+        {
+            return const_cast<T*>(static_cast<const PagedArray*>(this)->find(index));
+        }
+
+        /// <summary>
+        /// Returns the element at index, allocating its page if needed.
+        /// </summary>
+        T& get_or_create(size_t index)
+        {
+            T* element = find(index);
+
+            if (element == nullptr)
+            {
+                allocate(index, 1);
+                element = find(index);
+            }
+
+            return *element;
+        }
+
+        /// <summary>
+        /// Makes sure the pages of the elements [first, first + count) are allocated and size() is at least first + count.
+        /// </summary>
+        void allocate(size_t first, size_t count)
+        {
+            if (count == 0)
+            {
+                return;
+            }
+
+            const size_t firstPage = first / PageSize;
+            const size_t lastPage = (first + count - 1) / PageSize;
+
+            if (isAllocated(firstPage, lastPage) && _size.load(std::memory_order_relaxed) >= first + count)
+            {
+                return;
+            }
+
+            std::unique_lock lock(_writeMutex);
+
+            Directory* directory = _directory.load(std::memory_order_relaxed);
+
+            if (lastPage >= directory->capacity)
+            {
+                directory = grow(directory, lastPage + 1);
+            }
+
+            for (size_t page = firstPage; page <= lastPage; page++)
+            {
+                if (directory->pages[page].load(std::memory_order_relaxed) == nullptr)
+                {
+                    directory->pages[page].store(new T[PageSize](), std::memory_order_release);
+                    _pageCount.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+
+            if (_size.load(std::memory_order_relaxed) < first + count)
+            {
+                _size.store(first + count, std::memory_order_relaxed);
+            }
+        }
+
+        /// <summary>
+        /// One past the highest index which was allocated.
+        /// </summary>
+        size_t size() const
+        {
+            return _size.load(std::memory_order_relaxed);
+        }
+
+        /// <summary>
+        /// Bytes taken by the allocated pages.
+        /// </summary>
+        size_t memory() const
+        {
+            return _pageCount.load(std::memory_order_relaxed) * PageSize * sizeof(T);
+        }
+
+    private:
+        static constexpr size_t MIN_DIRECTORY_CAPACITY = 16;
+
+        bool isAllocated(size_t firstPage, size_t lastPage) const
+        {
+            const Directory* directory = _directory.load(std::memory_order_acquire);
+
+            if (lastPage >= directory->capacity)
+            {
+                return false;
+            }
+
+            for (size_t page = firstPage; page <= lastPage; page++)
+            {
+                if (directory->pages[page].load(std::memory_order_acquire) == nullptr)
+                {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        struct Directory
+        {
+            explicit Directory(size_t c) : capacity(c), pages(new std::atomic<T*>[c]())
+            {
+            }
+
+            const size_t capacity;
+            std::unique_ptr<std::atomic<T*>[]> pages;
+        };
+
+        Directory* grow(Directory* old, size_t pageCount)
+        {
+            size_t capacity = old->capacity * 2;
+            while (capacity < pageCount)
+            {
+                capacity *= 2;
+            }
+
+            auto directory = std::make_unique<Directory>(capacity);
+
+            for (size_t i = 0; i < old->capacity; i++)
+            {
+                directory->pages[i].store(old->pages[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            }
+
+            Directory* result = directory.get();
+            _directories.push_back(std::move(directory));
+            _directory.store(result, std::memory_order_release);
+
+            return result;
+        }
+
+        std::atomic<Directory*> _directory;
+        std::atomic<size_t> _size = 0;
+        std::atomic<size_t> _pageCount = 0;
+        std::mutex _writeMutex;
+        std::vector<std::unique_ptr<Directory>> _directories;  // active directory is the last one, the others are retired
+    };
+}
@@ -29,7 +29,8 @@ struct __declspec(novtable) ShaderData final {
     std::unordered_set<ShaderToggler::ToggleGroup*> constantBuffersToUpdate;
     effect_queue techniquesToRender;
     std::unordered_set<ShaderToggler::ToggleGroup*> srvToUpdate;
-    const std::vector<ShaderToggler::ToggleGroup*>* blockedShaderGroups = nullptr;
+    const uint64_t* shaderGroupBits = nullptr;      // toggle groups activeShaderHash is part of, see ShaderToggler::ToggleGroupIndex
+    uint32_t shaderGroupEpoch = UINT32_MAX;         // epoch of the toggle group index shaderGroupBits was taken from
     uint32_t id = 0;
 
     ShaderData(uint32_t _id) : id(_id) { }
@@ -41,7 +42,8 @@ struct __declspec(novtable) ShaderData final {
         constantBuffersToUpdate.clear();
         techniquesToRender.clear();
         srvToUpdate.clear();
-        blockedShaderGroups = nullptr;
+        shaderGroupBits = nullptr;
+        shaderGroupEpoch = UINT32_MAX;
     }
 };
 
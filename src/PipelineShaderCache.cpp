@@ -0,0 +1,140 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Part of ShaderToggler, a shader toggler add on for Reshade 5+ which allows you
+// to define groups of shaders to toggle them on/off with one key press
+// 
+// (c) Frans 'Otis_Inf' Bouma.
+//
+// All rights reserved.
+// https://github.com/FransBouma/ShaderToggler
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met :
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+//	  list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and / or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+/////////////////////////////////////////////////////////////////////////
+#include "PipelineShaderCache.h"
+#include "AddonUIData.h"
+
+using namespace ShaderToggler;
+using namespace std;
+
+PipelineShaderCache::PipelineShaderCache(AddonImGui::AddonUIData& data) : uiData(data)
+{
+}
+
+void PipelineShaderCache::AddPipeline(uint64_t pipelineHandle, uint32_t pixelShaderHash, uint32_t vertexShaderHash, uint32_t computeShaderHash)
+{
+    if (pipelineHandle == 0 || (pixelShaderHash == 0 && vertexShaderHash == 0 && computeShaderHash == 0))
+    {
+        return;
+    }
+
+    auto entry = make_unique<PipelineShaderEntry>();
+    entry->pixelShaderHash = pixelShaderHash;
+    entry->vertexShaderHash = vertexShaderHash;
+    entry->computeShaderHash = computeShaderHash;
+
+    unique_lock<mutex> lock(storageMutex);
+    RetireEntryLocked(pipelineHandle);
+    pipelineEntries.insert_or_assign(pipelineHandle, entry.get());
+    entryStorage.emplace(pipelineHandle, std::move(entry));
+}
+
+void PipelineShaderCache::RemovePipeline(uint64_t pipelineHandle)
+{
+    unique_lock<mutex> lock(storageMutex);
+    RetireEntryLocked(pipelineHandle);
+}
+
+void PipelineShaderCache::RetireEntryLocked(uint64_t pipelineHandle)
+{
+    const auto it = entryStorage.find(pipelineHandle);
+    if (it == entryStorage.end())
+    {
+        return;
+    }
+
+    // Binds on other threads may still be reading the entry, it's freed once they're done
+    pipelineEntries.erase(pipelineHandle);
+    pipelineEntries.retire(std::move(it.value()));
+    entryStorage.erase(it);
+}
+
+void PipelineShaderCache::ResolveGroups(PipelineShaderRecord& record, const ToggleGroupIndex* groupIndex)
+{
+    record.pixelShaderGroupBits = groupIndex->Find(0, record.pixelShaderHash);
+    record.vertexShaderGroupBits = groupIndex->Find(1, record.vertexShaderHash);
+    record.computeShaderGroupBits = groupIndex->Find(2, record.computeShaderHash);
+    record.groupEpoch = groupIndex->GetEpoch();
+}
+
+bool PipelineShaderCache::GetPipeline(uint64_t pipelineHandle, PipelineShaderRecord& record)
+{
+    const ToggleGroupIndex* groupIndex = uiData.GetToggleGroupIndex();
+    const uint32_t epoch = groupIndex->GetEpoch();
+
+    const ReadMostlyHandleMap<PipelineShaderEntry*>::read_guard guard(pipelineEntries);
+    PipelineShaderEntry* entry = pipelineEntries.find(guard, pipelineHandle);
+
+    if (entry == nullptr)
+    {
+        return false;
+    }
+
+    record.pixelShaderHash = entry->pixelShaderHash;
+    record.vertexShaderHash = entry->vertexShaderHash;
+    record.computeShaderHash = entry->computeShaderHash;
+
+    const uint32_t sequence = entry->sequence.load(memory_order_acquire);
+
+    if (!(sequence & 1) && entry->groupEpoch.load(memory_order_relaxed) == epoch)
+    {
+        record.pixelShaderGroupBits = entry->pixelShaderGroupBits.load(memory_order_relaxed);
+        record.vertexShaderGroupBits = entry->vertexShaderGroupBits.load(memory_order_relaxed);
+        record.computeShaderGroupBits = entry->computeShaderGroupBits.load(memory_order_relaxed);
+
+        atomic_thread_fence(memory_order_acquire);
+
+        if (entry->sequence.load(memory_order_relaxed) == sequence)
+        {
+            record.groupEpoch = epoch;
+            return true;
+        }
+    }
+
+    // Toggle groups changed since the last bind of this pipeline, or another bind is storing them right now. Resolve them for this bind
+    // and store them for the next ones, unless someone else got there first.
+    ResolveGroups(record, groupIndex);
+
+    uint32_t expected = sequence;
+    if (!(sequence & 1) && entry->sequence.compare_exchange_strong(expected, sequence + 1, memory_order_acquire, memory_order_relaxed))
+    {
+        atomic_thread_fence(memory_order_release);
+
+        entry->pixelShaderGroupBits.store(record.pixelShaderGroupBits, memory_order_relaxed);
+        entry->vertexShaderGroupBits.store(record.vertexShaderGroupBits, memory_order_relaxed);
+        entry->computeShaderGroupBits.store(record.computeShaderGroupBits, memory_order_relaxed);
+        entry->groupEpoch.store(record.groupEpoch, memory_order_relaxed);
+
+        entry->sequence.store(sequence + 2, memory_order_release);
+    }
+
+    return true;
+}
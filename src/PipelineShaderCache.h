@@ -0,0 +1,111 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Part of ShaderToggler, a shader toggler add on for Reshade 5+ which allows you
+// to define groups of shaders to toggle them on/off with one key press
+// 
+// (c) Frans 'Otis_Inf' Bouma.
+//
+// All rights reserved.
+// https://github.com/FransBouma/ShaderToggler
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met :
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+//	  list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and / or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+/////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <tsl/robin_map.h>
+#include "ReadMostlyHandleMap.h"
+#include "ToggleGroupIndex.h"
+
+namespace AddonImGui
+{
+    class AddonUIData;
+}
+
+namespace ShaderToggler
+{
+    /// <summary>
+    /// Per pipeline record with the shader hashes attached to the pipeline and the toggle group bitsets they have in the toggle group
+    /// index. The bitsets are resolved lazily and re-resolved whenever the toggle group index got rebuilt since the last resolve.
+    /// </summary>
+    struct PipelineShaderRecord
+    {
+        uint32_t pixelShaderHash = 0;
+        uint32_t vertexShaderHash = 0;
+        uint32_t computeShaderHash = 0;
+        uint32_t groupEpoch = UINT32_MAX;
+        const uint64_t* pixelShaderGroupBits = nullptr;
+        const uint64_t* vertexShaderGroupBits = nullptr;
+        const uint64_t* computeShaderGroupBits = nullptr;
+    };
+
+    /// <summary>
+    /// Cache of pipeline handle to <see cref="PipelineShaderRecord"/>, filled at init_pipeline so bind_pipeline only needs a single lock free
+    /// lookup and an epoch compare.
+    /// </summary>
+    class __declspec(novtable) PipelineShaderCache final
+    {
+    public:
+        PipelineShaderCache(AddonImGui::AddonUIData& data);
+
+        void AddPipeline(uint64_t pipelineHandle, uint32_t pixelShaderHash, uint32_t vertexShaderHash, uint32_t computeShaderHash);
+        void RemovePipeline(uint64_t pipelineHandle);
+
+        /// <summary>
+        /// Copies the record for the passed in pipeline handle into record, resolving the toggle groups first if they're stale.
+        /// </summary>
+        /// <returns>false if the pipeline handle is unknown</returns>
+        bool GetPipeline(uint64_t pipelineHandle, PipelineShaderRecord& record);
+
+        /// <summary>
+        /// Frees the entries of destroyed pipelines no bind can still be reading. Called once per present.
+        /// </summary>
+        void ReclaimRetired() { pipelineEntries.reclaim_retired(); }
+
+    private:
+        /// <summary>
+        /// The shader hashes of a pipeline and the group bitsets last resolved for them. The resolved part is published under a sequence
+        /// counter: a bind which finds it stale or being written resolves the groups itself and stores them if no other bind is at it.
+        /// </summary>
+        struct PipelineShaderEntry
+        {
+            uint32_t pixelShaderHash = 0;
+            uint32_t vertexShaderHash = 0;
+            uint32_t computeShaderHash = 0;
+            std::atomic<uint32_t> sequence = 0;
+            std::atomic<uint32_t> groupEpoch = UINT32_MAX;
+            std::atomic<const uint64_t*> pixelShaderGroupBits = nullptr;
+            std::atomic<const uint64_t*> vertexShaderGroupBits = nullptr;
+            std::atomic<const uint64_t*> computeShaderGroupBits = nullptr;
+        };
+
+        void ResolveGroups(PipelineShaderRecord& record, const ToggleGroupIndex* groupIndex);
+        void RetireEntryLocked(uint64_t pipelineHandle);
+
+        AddonImGui::AddonUIData& uiData;
+        ReadMostlyHandleMap<PipelineShaderEntry*> pipelineEntries;
+        tsl::robin_map<uint64_t, std::unique_ptr<PipelineShaderEntry>> entryStorage;      // owns the entries, only touched by writers
+        std::mutex storageMutex;
+    };
+}
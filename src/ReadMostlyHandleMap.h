@@ -0,0 +1,396 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Part of ShaderToggler, a shader toggler add on for Reshade 5+ which allows you
+// to define groups of shaders to toggle them on/off with one key press
+// 
+// (c) Frans 'Otis_Inf' Bouma.
+//
+// All rights reserved.
+// https://github.com/FransBouma/ShaderToggler
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met :
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+//	  list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and / or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+/////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <cstdint>
+
+namespace ShaderToggler
+{
+    /// <summary>
+    /// Open addressing map of (non-zero) 64-bit handles to small trivially copyable values, optimized for lookups vastly outnumbering updates.
+    /// Lookups don't take a lock: every slot is an atomic key/value pair and the table pointer is published atomically. Updates are serialized
+    /// by a mutex. When the table needs to grow or drop its tombstones a new table is built and published. A rebuild only grows the table when
+    /// the live entries need the room, so handle churn at a flat live count keeps the capacity flat.
+    /// Readers announce themselves on a striped counter of the current read epoch for as long as they hold a read_guard (find takes one
+    /// itself). Superseded tables, and values the owner hands to retire, are freed by reclaim_retired once the counters of both epochs were
+    /// seen drained after they were retired, so no reader can still reach them.
+    /// A value equal to TValue{} means 'not present', so it can't be stored.
+    /// </summary>
+    template<typename TValue>
+    class ReadMostlyHandleMap final
+    {
+    public:
+        /// <summary>
+        /// Announces a reader of the map for its lifetime. Tables and retired values a reader reached while holding the guard stay valid
+        /// until the guard is destroyed.
+        /// </summary>
+        class read_guard final
+        {
+        public:
+            explicit read_guard(const ReadMostlyHandleMap& map) :
+                _readers(map._readIndicators[map._readEpoch.load(std::memory_order_acquire) & 1][ThreadStripe()].readers)
+            {
+                _readers.fetch_add(1, std::memory_order_seq_cst);
+            }
+
+            ~read_guard()
+            {
+                _readers.fetch_sub(1, std::memory_order_release);
+            }
+
+            read_guard(const read_guard&) = delete;
+            read_guard& operator=(const read_guard&) = delete;
+
+        private:
+            std::atomic<int64_t>& _readers;
+        };
+
+        ReadMostlyHandleMap()
+        {
+            _active = std::make_unique<Table>(MIN_CAPACITY);
+            _current.store(_active.get(), std::memory_order_release);
+        }
+
+        ReadMostlyHandleMap(const ReadMostlyHandleMap&) = delete;
+        ReadMostlyHandleMap& operator=(const ReadMostlyHandleMap&) = delete;
+
+        /// <summary>
+        /// Returns the value stored for handle, TValue{} if the handle isn't present. Lock free.
+        /// </summary>
+        TValue find(uint64_t handle) const
+        {
+            const read_guard guard(*this);
+            return find(guard, handle);
+        }
+
+        /// <summary>
+        /// Same as find(handle), for callers which keep using the value (e.g. a pointer the owner retires on erase) while holding guard.
+        /// </summary>
+        TValue find(const read_guard&, uint64_t handle) const
+        {
+            if (handle == EMPTY_KEY || handle == TOMBSTONE_KEY)
+            {
+                return TValue{};
+            }
+
+            const Table* table = _current.load(std::memory_order_seq_cst);
+            const size_t mask = table->capacity - 1;
+
+            for (size_t i = slotFor(handle, mask), probes = 0; probes < table->capacity; i = (i + 1) & mask, probes++)
+            {
+                const uint64_t key = table->slots[i].key.load(std::memory_order_seq_cst);
+
+                if (key == EMPTY_KEY)
+                {
+                    return TValue{};
+                }
+
+                if (key == handle)
+                {
+                    const TValue value = table->slots[i].value.load(std::memory_order_seq_cst);
+
+                    // The slot can be erased and reused between reading the key and the value, only trust the value if the key didn't move
+                    if (table->slots[i].key.load(std::memory_order_acquire) == handle)
+                    {
+                        return value;
+                    }
+
+                    return TValue{};
+                }
+            }
+
+            return TValue{};
+        }
+
+        bool contains(uint64_t handle) const
+        {
+            return find(handle) != TValue{};
+        }
+
+        size_t size() const
+        {
+            return _size.load(std::memory_order_relaxed);
+        }
+
+        size_t capacity() const
+        {
+            return _current.load(std::memory_order_acquire)->capacity;
+        }
+
+        /// <summary>
+        /// Number of superseded tables and retired values which aren't freed yet.
+        /// </summary>
+        size_t retired_count()
+        {
+            std::unique_lock lock(_writeMutex);
+            return _retired.size();
+        }
+
+        /// <summary>
+        /// Hands a value which was erased from the map to the map, which frees it once no reader can reach it anymore.
+        /// </summary>
+        template<typename TOwned>
+        void retire(std::unique_ptr<TOwned> owned)
+        {
+            std::unique_lock lock(_writeMutex);
+            retireLocked(std::move(owned));
+        }
+
+        /// <summary>
+        /// Frees what was retired before the current read epoch if the readers of the previous epoch are gone, and moves readers on to the
+        /// next epoch. Everything retired is seen drained on both epochs before it's freed: readers which got hold of it announced
+        /// themselves before it was retired, readers announcing themselves after a drained check can't find it anymore. Never waits for
+        /// readers, the owner calls it once per present.
+        /// </summary>
+        void reclaim_retired()
+        {
+            std::unique_lock lock(_writeMutex);
+
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            const uint64_t epoch = _readEpoch.load(std::memory_order_relaxed);
+            for (const ReadIndicatorStripe& stripe : _readIndicators[(epoch - 1) & 1])
+            {
+                if (stripe.readers.load(std::memory_order_seq_cst) != 0)
+                {
+                    return;
+                }
+            }
+
+            std::erase_if(_retired, [epoch](const Retired& retired) { return retired.epoch < epoch; });
+
+            _readEpoch.store(epoch + 1, std::memory_order_seq_cst);
+        }
+
+        /// <summary>
+        /// Inserts or overwrites the value for handle. Returns the value it replaced, TValue{} if the handle wasn't present.
+        /// </summary>
+        TValue insert_or_assign(uint64_t handle, TValue value)
+        {
+            if (handle == EMPTY_KEY || handle == TOMBSTONE_KEY || value == TValue{})
+            {
+                return TValue{};
+            }
+
+            std::unique_lock lock(_writeMutex);
+
+            Table* table = _current.load(std::memory_order_relaxed);
+
+            if ((table->used + 1) * 4 > table->capacity * 3)
+            {
+                table = rebuild(table, _size.load(std::memory_order_relaxed) + 1);
+            }
+
+            const size_t mask = table->capacity - 1;
+            size_t target = SIZE_MAX;
+
+            for (size_t i = slotFor(handle, mask), probes = 0; probes < table->capacity; i = (i + 1) & mask, probes++)
+            {
+                const uint64_t key = table->slots[i].key.load(std::memory_order_relaxed);
+
+                if (key == handle)
+                {
+                    return table->slots[i].value.exchange(value, std::memory_order_seq_cst);
+                }
+
+                if (key == TOMBSTONE_KEY && target == SIZE_MAX)
+                {
+                    target = i;
+                }
+                else if (key == EMPTY_KEY)
+                {
+                    if (target == SIZE_MAX)
+                    {
+                        target = i;
+                        table->used++;
+                    }
+                    break;
+                }
+            }
+
+            // Publish the value before the key so a reader which finds the key sees a valid value
+            table->slots[target].value.store(value, std::memory_order_seq_cst);
+            table->slots[target].key.store(handle, std::memory_order_release);
+            _size.fetch_add(1, std::memory_order_relaxed);
+
+            return TValue{};
+        }
+
+        /// <summary>
+        /// Removes handle from the map. Returns the value it had, TValue{} if it wasn't present.
+        /// </summary>
+        TValue erase(uint64_t handle)
+        {
+            if (handle == EMPTY_KEY || handle == TOMBSTONE_KEY)
+            {
+                return TValue{};
+            }
+
+            std::unique_lock lock(_writeMutex);
+
+            Table* table = _current.load(std::memory_order_relaxed);
+            const size_t mask = table->capacity - 1;
+
+            for (size_t i = slotFor(handle, mask), probes = 0; probes < table->capacity; i = (i + 1) & mask, probes++)
+            {
+                const uint64_t key = table->slots[i].key.load(std::memory_order_relaxed);
+
+                if (key == EMPTY_KEY)
+                {
+                    return TValue{};
+                }
+
+                if (key == handle)
+                {
+                    const TValue value = table->slots[i].value.load(std::memory_order_relaxed);
+                    table->slots[i].key.store(TOMBSTONE_KEY, std::memory_order_seq_cst);
+                    table->slots[i].value.store(TValue{}, std::memory_order_seq_cst);
+                    _size.fetch_sub(1, std::memory_order_relaxed);
+                    return value;
+                }
+            }
+
+            return TValue{};
+        }
+
+    private:
+        static constexpr uint64_t EMPTY_KEY = 0;
+        static constexpr uint64_t TOMBSTONE_KEY = UINT64_MAX;
+        static constexpr size_t MIN_CAPACITY = 1024;
+        static constexpr size_t READ_INDICATOR_STRIPES = 16;
+
+        struct Slot
+        {
+            std::atomic<uint64_t> key = EMPTY_KEY;
+            std::atomic<TValue> value = TValue{};
+        };
+
+        struct Table
+        {
+            explicit Table(size_t c) : capacity(c), slots(new Slot[c]) {}
+
+            const size_t capacity;
+            size_t used = 0;                            // live + tombstoned slots, only touched by writers
+            std::unique_ptr<Slot[]> slots;
+        };
+
+        struct Retired
+        {
+            std::unique_ptr<void, void(*)(void*)> object;
+            uint64_t epoch;                             // read epoch at the time it was retired
+        };
+
+        // Readers of different threads count themselves on different cache lines
+        struct alignas(64) ReadIndicatorStripe
+        {
+            std::atomic<int64_t> readers = 0;
+        };
+
+        static size_t ThreadStripe()
+        {
+            static std::atomic<size_t> nextStripe = 0;
+            thread_local const size_t stripe = nextStripe.fetch_add(1, std::memory_order_relaxed) % READ_INDICATOR_STRIPES;
+
+            return stripe;
+        }
+
+        template<typename TOwned>
+        void retireLocked(std::unique_ptr<TOwned> owned)
+        {
+            if (owned != nullptr)
+            {
+                _retired.push_back({ { owned.release(), [](void* object) { delete static_cast<TOwned*>(object); } }, _readEpoch.load(std::memory_order_relaxed) });
+            }
+        }
+
+        static size_t slotFor(uint64_t handle, size_t mask)
+        {
+            // Handles are mostly pointers, mix the bits so aligned addresses don't cluster
+            return static_cast<size_t>((handle * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+        }
+
+        Table* rebuild(Table* old, size_t liveCount)
+        {
+            // Only grow when the live entries need it. A rebuild triggered by tombstones alone keeps the size, so streaming pipelines in and
+            // out doesn't inflate the table.
+            size_t capacity = old->capacity;
+            while (liveCount * 2 > capacity)
+            {
+                capacity *= 2;
+            }
+
+            auto table = std::make_unique<Table>(capacity);
+            const size_t mask = capacity - 1;
+
+            for (size_t s = 0; s < old->capacity; s++)
+            {
+                const uint64_t key = old->slots[s].key.load(std::memory_order_relaxed);
+
+                if (key == EMPTY_KEY || key == TOMBSTONE_KEY)
+                {
+                    continue;
+                }
+
+                size_t i = slotFor(key, mask);
+                while (table->slots[i].key.load(std::memory_order_relaxed) != EMPTY_KEY)
+                {
+                    i = (i + 1) & mask;
+                }
+
+                table->slots[i].value.store(old->slots[s].value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+                table->slots[i].key.store(key, std::memory_order_relaxed);
+                table->used++;
+            }
+
+            Table* result = table.get();
+            _current.store(result, std::memory_order_seq_cst);
+            retireLocked(std::move(_active));
+            _active = std::move(table);
+
+            return result;
+        }
+
+        std::atomic<Table*> _current;
+        std::atomic<size_t> _size = 0;
+        std::mutex _writeMutex;
+        std::unique_ptr<Table> _active;                 // owns the table _current points to
+        std::vector<Retired> _retired;                  // superseded tables and erased values readers may still be using
+        std::atomic<uint64_t> _readEpoch = 0;           // readers announce themselves on the indicator of its parity
+        mutable std::array<std::array<ReadIndicatorStripe, READ_INDICATOR_STRIPES>, 2> _readIndicators;
+    };
+}
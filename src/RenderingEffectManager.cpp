@@ -267,7 +267,16 @@ void RenderingEffectManager::RenderEffects(command_list* cmd_list, uint64_t call
 
     if (rendered)
     {
-        cmd_list->get_private_data<state_tracking>().apply(cmd_list);
+        // The game's state is only restored once it depends on it again, whatever it rebinds itself until then isn't. At a render target
+        // bind the game's targets are already bound and recorded, the effects replaced them, so they're restored like everything else.
+        // Right before a draw everything has to be restored now.
+        state_tracking& state = cmd_list->get_private_data<state_tracking>();
+        state.apply_deferred(cmd_list);
+
+        if (callLocation == CALL_DRAW)
+        {
+            state.flush_deferred(cmd_list);
+        }
     }
 }
 
@@ -26,106 +26,112 @@ void RenderingQueueManager::_CheckCallForCommandList(ShaderData& sData, CommandL
     const uint64_t match_const = MATCH_CONST_PS << sData.id;
     const uint64_t match_preview = MATCH_PREVIEW_PS << sData.id;
 
-    if (sData.blockedShaderGroups != nullptr)
+    const ToggleGroupIndex* groupIndex = uiData.GetToggleGroupIndex();
+
+    if (sData.shaderGroupEpoch != groupIndex->GetEpoch())
+    {
+        // Toggle groups changed since the shader got bound, look its groups up again
+        sData.shaderGroupBits = groupIndex->Find(sData.id, sData.activeShaderHash);
+        sData.shaderGroupEpoch = groupIndex->GetEpoch();
+    }
+
+    if (sData.shaderGroupBits != nullptr)
     {
-        for (auto group : *sData.blockedShaderGroups)
+        groupIndex->ForEachActiveGroup(sData.shaderGroupBits, [&](ToggleGroup* group)
         {
-            if (group->isActive())
+            if (group->getExtractConstants() && !deviceData.constantsUpdated.contains(group))
             {
-                if (group->getExtractConstants() && !deviceData.constantsUpdated.contains(group))
+                if (!sData.constantBuffersToUpdate.contains(group))
                 {
-                    if (!sData.constantBuffersToUpdate.contains(group))
-                    {
-                        sData.constantBuffersToUpdate.emplace(group);
-                        queue_mask |= match_const;
-                    }
+                    sData.constantBuffersToUpdate.emplace(group);
+                    queue_mask |= match_const;
                 }
+            }
 
-                if (group->getId() == uiData.GetToggleGroupIdShaderEditing() && !deviceData.huntPreview.matched)
+            if (group->getId() == uiData.GetToggleGroupIdShaderEditing() && !deviceData.huntPreview.matched)
+            {
+                if (uiData.GetCurrentTabType() == AddonImGui::TAB_RENDER_TARGET)
                 {
-                    if (uiData.GetCurrentTabType() == AddonImGui::TAB_RENDER_TARGET)
+                    if (group->getRenderToResourceViews())
                     {
-                        if (group->getRenderToResourceViews())
-                        {
-                            queue_mask |= match_preview << (CALL_DRAW * MATCH_DELIMITER);
-                            deviceData.huntPreview.target_invocation_location = CALL_DRAW;
-                        }
-                        else
-                        {
-                            queue_mask |= (match_preview << (group->getInvocationLocation() * MATCH_DELIMITER)) | (match_preview << (CALL_DRAW * MATCH_DELIMITER));
-                            deviceData.huntPreview.target_invocation_location = group->getInvocationLocation();
-                        }
+                        queue_mask |= match_preview << (CALL_DRAW * MATCH_DELIMITER);
+                        deviceData.huntPreview.target_invocation_location = CALL_DRAW;
+                    }
+                    else
+                    {
+                        queue_mask |= (match_preview << (group->getInvocationLocation() * MATCH_DELIMITER)) | (match_preview << (CALL_DRAW * MATCH_DELIMITER));
+                        deviceData.huntPreview.target_invocation_location = group->getInvocationLocation();
                     }
                 }
+            }
 
-                if (group->isProvidingTextureBinding() && !deviceData.bindingsUpdated.contains(group))
+            if (group->isProvidingTextureBinding() && !deviceData.bindingsUpdated.contains(group))
+            {
+                if (!sData.bindingsToUpdate.contains(group))
                 {
-                    if (!sData.bindingsToUpdate.contains(group))
+                    if (!group->getCopyTextureBinding() || group->getExtractResourceViews())
                     {
-                        if (!group->getCopyTextureBinding() || group->getExtractResourceViews())
-                        {
-                            sData.bindingsToUpdate.emplace(group, ResourceRenderData{ group, CALL_DRAW, resource{ 0 }, format::unknown });
-                            queue_mask |= (match_binding << CALL_DRAW * MATCH_DELIMITER);
-                        }
-                        else
-                        {
-                            sData.bindingsToUpdate.emplace(group, ResourceRenderData{ group, group->getBindingInvocationLocation(), resource{ 0 }, format::unknown });
-                            queue_mask |= (match_binding << (group->getBindingInvocationLocation() * MATCH_DELIMITER)) | (match_binding << (CALL_DRAW * MATCH_DELIMITER));
-                        }
+                        sData.bindingsToUpdate.emplace(group, ResourceRenderData{ group, CALL_DRAW, resource{ 0 }, format::unknown });
+                        queue_mask |= (match_binding << CALL_DRAW * MATCH_DELIMITER);
+                    }
+                    else
+                    {
+                        sData.bindingsToUpdate.emplace(group, ResourceRenderData{ group, group->getBindingInvocationLocation(), resource{ 0 }, format::unknown });
+                        queue_mask |= (match_binding << (group->getBindingInvocationLocation() * MATCH_DELIMITER)) | (match_binding << (CALL_DRAW * MATCH_DELIMITER));
                     }
                 }
+            }
 
-                if (group->getAllowAllTechniques())
-                {
-                    auto& preferred = group->GetPreferredTechniqueData();
+            if (group->getAllowAllTechniques())
+            {
+                auto& preferred = group->GetPreferredTechniqueData();
 
-                    for (const auto& techData : runtimeData.allEnabledTechniques)
+                for (const auto& techData : runtimeData.allEnabledTechniques)
+                {
+                    if (group->getHasTechniqueExceptions() && preferred.contains(techData))
                     {
-                        if (group->getHasTechniqueExceptions() && preferred.contains(techData))
-                        {
-                            continue;
-                        }
-
-                        if (!techData->rendered)
-                        {
-                            if (!sData.techniquesToRender.contains(techData))
-                            {
-                                if (group->getRenderToResourceViews())
-                                {
-                                    sData.techniquesToRender.emplace(techData, ResourceRenderData{ group, CALL_DRAW, resource{ 0 }, format::unknown });
-                                    queue_mask |= (match_effect << CALL_DRAW * MATCH_DELIMITER);
-                                }
-                                else
-                                {
-                                    sData.techniquesToRender.emplace(techData, ResourceRenderData{ group, group->getInvocationLocation(), resource{ 0 }, format::unknown });
-                                    queue_mask |= (match_effect << (group->getInvocationLocation() * MATCH_DELIMITER)) | (match_effect << (CALL_DRAW * MATCH_DELIMITER));
-                                }
-                            }
-                        }
+                        continue;
                     }
-                }
-                else if (group->preferredTechniques().size() > 0) {
-                    auto& preferred = group->GetPreferredTechniqueData();
 
-                    for (auto& eff : preferred)
+                    if (!techData->rendered)
                     {
-                        if (!eff->rendered && !sData.techniquesToRender.contains(eff))
+                        if (!sData.techniquesToRender.contains(techData))
                         {
                             if (group->getRenderToResourceViews())
                             {
-                                sData.techniquesToRender.emplace(eff, ResourceRenderData{ group, CALL_DRAW, resource{ 0 }, format::unknown });
+                                sData.techniquesToRender.emplace(techData, ResourceRenderData{ group, CALL_DRAW, resource{ 0 }, format::unknown });
                                 queue_mask |= (match_effect << CALL_DRAW * MATCH_DELIMITER);
                             }
                             else
                             {
-                                sData.techniquesToRender.emplace(eff, ResourceRenderData{ group, group->getInvocationLocation(), resource{ 0 }, format::unknown });
+                                sData.techniquesToRender.emplace(techData, ResourceRenderData{ group, group->getInvocationLocation(), resource{ 0 }, format::unknown });
                                 queue_mask |= (match_effect << (group->getInvocationLocation() * MATCH_DELIMITER)) | (match_effect << (CALL_DRAW * MATCH_DELIMITER));
                             }
                         }
                     }
                 }
             }
-        }
+            else if (group->preferredTechniques().size() > 0) {
+                auto& preferred = group->GetPreferredTechniqueData();
+
+                for (auto& eff : preferred)
+                {
+                    if (!eff->rendered && !sData.techniquesToRender.contains(eff))
+                    {
+                        if (group->getRenderToResourceViews())
+                        {
+                            sData.techniquesToRender.emplace(eff, ResourceRenderData{ group, CALL_DRAW, resource{ 0 }, format::unknown });
+                            queue_mask |= (match_effect << CALL_DRAW * MATCH_DELIMITER);
+                        }
+                        else
+                        {
+                            sData.techniquesToRender.emplace(eff, ResourceRenderData{ group, group->getInvocationLocation(), resource{ 0 }, format::unknown });
+                            queue_mask |= (match_effect << (group->getInvocationLocation() * MATCH_DELIMITER)) | (match_effect << (CALL_DRAW * MATCH_DELIMITER));
+                        }
+                    }
+                }
+            }
+        });
     }
 
     commandListData.commandQueue |= queue_mask;
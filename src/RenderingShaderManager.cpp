@@ -181,7 +181,9 @@ void RenderingShaderManager::ApplyShader(command_list* cmd_list, resource_view s
         return;
     }
 
-    cmd_list->get_private_data<state_tracking>().capture(cmd_list, true);
+    cmd_list->get_private_data<state_tracking>().capture(cmd_list, true,
+        StateTracking::state_category_render_targets | StateTracking::state_category_graphics_pipeline | StateTracking::state_category_viewports |
+        StateTracking::state_category_scissor_rects | StateTracking::state_category_graphics_descriptors);
 
     cmd_list->bind_render_targets_and_depth_stencil(1, &rtv_dst);
 
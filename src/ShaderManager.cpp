@@ -37,7 +37,9 @@ using namespace std;
 
 namespace ShaderToggler
 {
-    ShaderManager::ShaderManager() : _activeHuntedShaderHash(0)
+    atomic_uint32_t ShaderManager::_managerCount = 0;
+
+    ShaderManager::ShaderManager() : _activeHuntedShaderHash(0), _managerIndex(_managerCount++)
     {
     }
 
@@ -46,23 +48,126 @@ namespace ShaderToggler
     {
         if (pipelineHandle > 0 && shaderHash > 0)
         {
+            const uint32_t previousHash = _handleToShaderHash.insert_or_assign(pipelineHandle, shaderHash);
+            if (previousHash == shaderHash)
+            {
+                return;
+            }
+
             unique_lock lock(_hashHandlesMutex);
-            _handleToShaderHash[pipelineHandle] = shaderHash;
-            _shaderHashes.emplace(shaderHash);
+            _shaderHashRefCount[shaderHash]++;
+
+            // handle got reused without a destroy in between, drop the reference to the shader it had
+            if (previousHash > 0)
+            {
+                releaseShaderHash(previousHash);
+            }
+
+            _uniqueShaderCount.store(_shaderHashRefCount.size(), std::memory_order_relaxed);
         }
     }
 
 
     void ShaderManager::removeHandle(uint64_t handle)
     {
-        unique_lock ulock(_hashHandlesMutex);
-        if (_handleToShaderHash.contains(handle))
+        const uint32_t shaderHash = _handleToShaderHash.erase(handle);
+        if (shaderHash > 0)
         {
-            const auto& it = _handleToShaderHash.find(handle);
-            const auto& shaderHash = it->second;
-            _handleToShaderHash.erase(handle);
-            _collectedActiveShaderHashes.erase(shaderHash);
-            _shaderHashes.erase(shaderHash);
+            unique_lock ulock(_hashHandlesMutex);
+            releaseShaderHash(shaderHash);
+            _uniqueShaderCount.store(_shaderHashRefCount.size(), std::memory_order_relaxed);
+        }
+    }
+
+
+    void ShaderManager::releaseShaderHash(uint32_t shaderHash)
+    {
+        // _hashHandlesMutex has to be held by the caller
+        auto it = _shaderHashRefCount.find(shaderHash);
+        if (it == _shaderHashRefCount.end())
+        {
+            return;
+        }
+
+        if (--it.value() > 0)
+        {
+            // other pipelines still use this shader
+            return;
+        }
+
+        _shaderHashRefCount.erase(it);
+
+        unique_lock lock(_collectedActiveHandlesMutex);
+        const auto collected = _collectedActiveShaderIndices.find(shaderHash);
+        if (collected == _collectedActiveShaderIndices.end())
+        {
+            return;
+        }
+
+        // leave a 0 in the slot so removal is O(1) and no other hash moves, the list is compacted at the next merge
+        {
+            unique_lock markedLock(_markedShaderHashMutex);
+            _markedCollectedIndices.erase(static_cast<int32_t>(collected->second));
+        }
+        _collectedActiveShaderHashes[collected->second] = 0;
+        _collectedActiveShaderIndices.erase(collected);
+        _releasedCollectedShaderCount++;
+    }
+
+
+    void ShaderManager::compactCollectedShaderHashes()
+    {
+        // _collectedActiveHandlesMutex and _markedShaderHashMutex have to be held by the caller
+        if (_releasedCollectedShaderCount == 0)
+        {
+            return;
+        }
+
+        // keeps the first seen order. The hunt stays on the hunted shader, or continues at the first shader after it if it was released.
+        int32_t huntedIndex = -1;
+        uint32_t write = 0;
+        for (uint32_t read = 0; read < _collectedActiveShaderHashes.size(); read++)
+        {
+            if (static_cast<int32_t>(read) == _activeHuntedShaderIndex)
+            {
+                huntedIndex = static_cast<int32_t>(write);
+            }
+
+            const uint32_t hash = _collectedActiveShaderHashes[read];
+            if (hash == 0)
+            {
+                continue;
+            }
+
+            _collectedActiveShaderHashes[write] = hash;
+            _collectedActiveShaderIndices[hash] = write;
+            write++;
+        }
+        _collectedActiveShaderHashes.resize(write);
+        _releasedCollectedShaderCount = 0;
+
+        // the marked shaders moved along
+        _markedCollectedIndices.clear();
+        for (const auto hash : _markedShaderHashes)
+        {
+            updateMarkedCollectedIndex(hash, true);
+        }
+
+        if (_activeHuntedShaderIndex >= 0)
+        {
+            _activeHuntedShaderIndex = std::min(huntedIndex, static_cast<int32_t>(write) - 1);
+            setActiveHuntedShaderHandle();
+        }
+    }
+
+
+    void ShaderManager::skipReleasedShaders(bool forward)
+    {
+        // released shaders leave a 0 behind until the next merge, the hunt steps over them
+        const int32_t count = static_cast<int32_t>(_collectedActiveShaderHashes.size());
+        for (int32_t steps = 0; steps < count && _activeHuntedShaderIndex >= 0 && _collectedActiveShaderHashes[_activeHuntedShaderIndex] == 0; steps++)
+        {
+            _activeHuntedShaderIndex = forward ? (_activeHuntedShaderIndex + 1) % count : (_activeHuntedShaderIndex + count - 1) % count;
         }
     }
 
@@ -77,6 +182,8 @@ namespace ShaderToggler
             {
                 _markedShaderHashes.emplace(hash);
             }
+            // nothing is collected yet
+            _markedCollectedIndices.clear();
         }
 
         // switch on hunting mode
@@ -86,6 +193,16 @@ namespace ShaderToggler
         {
             unique_lock lock(_collectedActiveHandlesMutex);
             _collectedActiveShaderHashes.clear();			// clear it so we start with a clean slate
+            _collectedActiveShaderIndices.clear();
+            _releasedCollectedShaderCount = 0;
+        }
+        {
+            lock_guard lock(_collectionBuffersMutex);
+            for (auto& buffer : _collectionBuffers)
+            {
+                lock_guard bufferLock(buffer->mutex);
+                buffer->hashes.clear();
+            }
         }
     }
 
@@ -106,22 +223,68 @@ namespace ShaderToggler
         {
             unique_lock lock(_markedShaderHashMutex);
             _markedShaderHashes.clear();
+            _markedCollectedIndices.clear();
         }
     }
 
 
     void ShaderManager::setActiveHuntedShaderHandle()
     {
-        if (_activeHuntedShaderIndex < 0 || _collectedActiveShaderHashes.size() == 0 || static_cast<size_t>(_activeHuntedShaderIndex) >= _collectedActiveShaderHashes.size())
+        if (_activeHuntedShaderIndex < 0 || static_cast<size_t>(_activeHuntedShaderIndex) >= _collectedActiveShaderHashes.size())
         {
             _activeHuntedShaderHash = 0;
             return;
         }
 
         // no lock needed, collecting phase is over
-        auto it = _collectedActiveShaderHashes.begin();
-        std::advance(it, _activeHuntedShaderIndex);
-        _activeHuntedShaderHash = *it;
+        _activeHuntedShaderHash = _collectedActiveShaderHashes[_activeHuntedShaderIndex];
+    }
+
+
+    int32_t ShaderManager::findMarkedShaderIndex(bool forward)
+    {
+        // Returns the marked shader closest to the active one in the requested direction, wrapping around, -1 if there's no other marked
+        // shader. The collected indices of the marked shaders are kept sorted, so this is a single bound lookup.
+        shared_lock lock(_markedShaderHashMutex);
+
+        if (_markedCollectedIndices.empty())
+        {
+            return -1;
+        }
+
+        int32_t index;
+        if (forward)
+        {
+            auto it = _markedCollectedIndices.upper_bound(_activeHuntedShaderIndex);
+            index = it == _markedCollectedIndices.end() ? *_markedCollectedIndices.begin() : *it;
+        }
+        else
+        {
+            auto it = _markedCollectedIndices.lower_bound(_activeHuntedShaderIndex < 0 ? INT32_MAX : _activeHuntedShaderIndex);
+            index = it == _markedCollectedIndices.begin() ? *_markedCollectedIndices.rbegin() : *std::prev(it);
+        }
+
+        return index == _activeHuntedShaderIndex ? -1 : index;
+    }
+
+
+    void ShaderManager::updateMarkedCollectedIndex(uint32_t shaderHash, bool marked)
+    {
+        // _markedShaderHashMutex has to be held exclusively by the caller
+        const int32_t index = getCollectedShaderIndex(shaderHash);
+        if (index < 0)
+        {
+            return;
+        }
+
+        if (marked)
+        {
+            _markedCollectedIndices.insert(index);
+        }
+        else
+        {
+            _markedCollectedIndices.erase(index);
+        }
     }
 
 
@@ -137,46 +300,17 @@ namespace ShaderToggler
         }
         if (ctrlPressed)
         {
-            if (_markedShaderHashes.size() == 0 || (_markedShaderHashes.size() == 1 && _markedShaderHashes.contains(_activeHuntedShaderHash)))
-            {
-                // optimization: if the current active shader is part of marked shader hashes and there is
-                // just 1 marked, then we can also stop. We then don't need to do anything so we can return
-                // also if there are no marked shaders, we won't find a next, so return now too.
-                return;
-            }
-
-            // we have marked shaders, find the next one in collected active shader hashes that's part of this set.
-            auto it = _collectedActiveShaderHashes.begin();
-            int index = _activeHuntedShaderIndex + 1;
-            std::advance(it, index);
-            bool foundHash = false;
-            uint32_t hash = 0;
-            while (index != _activeHuntedShaderIndex)
-            {
-                if (it == _collectedActiveShaderHashes.end())
-                {
-                    it = _collectedActiveShaderHashes.begin();
-                    index = 0;
-                }
-                hash = *it;
-                if (_markedShaderHashes.contains(hash))
-                {
-                    // found one
-                    foundHash = true;
-                    break;
-                }
-                ++it;
-                index++;
-            }
-            if (foundHash)
+            // step to the next marked shader, if there's none other than the current one, we stay on the current shader.
+            const int32_t index = findMarkedShaderIndex(true);
+            if (index >= 0)
             {
                 _activeHuntedShaderIndex = index;
-                _activeHuntedShaderHash = hash;
+                _activeHuntedShaderHash = _collectedActiveShaderHashes[index];
             }
             // always done
             return;
         }
-        if (static_cast<size_t>(_activeHuntedShaderIndex) < _collectedActiveShaderHashes.size() - 1)
+        if (_activeHuntedShaderIndex >= 0 && static_cast<size_t>(_activeHuntedShaderIndex) < _collectedActiveShaderHashes.size() - 1)
         {
             _activeHuntedShaderIndex++;
         }
@@ -184,6 +318,7 @@ namespace ShaderToggler
         {
             _activeHuntedShaderIndex = 0;
         }
+        skipReleasedShaders(true);
         setActiveHuntedShaderHandle();
     }
 
@@ -200,45 +335,15 @@ namespace ShaderToggler
         }
         if (ctrlPressed)
         {
-            if (_markedShaderHashes.size() == 0 || (_markedShaderHashes.size() == 1 && _markedShaderHashes.contains(_activeHuntedShaderHash)))
-            {
-                // optimization: if the current active shader is part of marked shader hashes and there is
-                // just 1 marked, then we can also stop. We then don't need to do anything so we can return
-                // also if there are no marked shaders, we won't find a next, so return now too.
-                return;
-            }
-            // we have marked shaders, find the next one in collected active shader hashes that's part of this set.
-            auto it = _collectedActiveShaderHashes.begin();
-            int32_t index = _activeHuntedShaderIndex - 1;
-            std::advance(it, index);
-            bool foundHash = false;
-            uint32_t hash = 0;
-            while (index != _activeHuntedShaderIndex)
-            {
-                if (it == _collectedActiveShaderHashes.begin())
-                {
-                    it = _collectedActiveShaderHashes.end();
-                    --it;
-                    index = static_cast<int32_t>(_collectedActiveShaderHashes.size()) - 1;
-                }
-                hash = *it;
-                if (_markedShaderHashes.contains(hash))
-                {
-                    // found one
-                    foundHash = true;
-                    break;
-                }
-                --it;
-                index--;
-            }
-            if (foundHash)
+            // step to the previous marked shader, if there's none other than the current one, we stay on the current shader.
+            const int32_t index = findMarkedShaderIndex(false);
+            if (index >= 0)
             {
                 _activeHuntedShaderIndex = index;
-                _activeHuntedShaderHash = hash;
+                _activeHuntedShaderHash = _collectedActiveShaderHashes[index];
             }
             // always done
             return;
-
         }
         if (_activeHuntedShaderIndex <= 0)
         {
@@ -248,6 +353,7 @@ namespace ShaderToggler
         {
             --_activeHuntedShaderIndex;
         }
+        skipReleasedShaders(false);
         setActiveHuntedShaderHandle();
     }
 
@@ -294,14 +400,83 @@ namespace ShaderToggler
     }
 
 
+    ShaderManager::CollectionBuffer& ShaderManager::getThreadCollectionBuffer()
+    {
+        // indexed by manager, the buffers are shared with the manager so they survive the thread until they're merged
+        static thread_local vector<shared_ptr<CollectionBuffer>> threadBuffers;
+
+        if (threadBuffers.size() <= _managerIndex)
+        {
+            threadBuffers.resize(_managerIndex + 1);
+        }
+
+        shared_ptr<CollectionBuffer>& buffer = threadBuffers[_managerIndex];
+        if (buffer == nullptr)
+        {
+            buffer = make_shared<CollectionBuffer>();
+
+            lock_guard lock(_collectionBuffersMutex);
+            _collectionBuffers.push_back(buffer);
+        }
+
+        return *buffer;
+    }
+
+
     void ShaderManager::addActivePipelineHandle(uint64_t handle)
     {
         // get the shader hash bound to this pipeline handle
         const auto shaderHash = getShaderHash(handle);
         if (shaderHash > 0)
         {
-            unique_lock lock(_collectedActiveHandlesMutex);
-            _collectedActiveShaderHashes.emplace(shaderHash);
+            CollectionBuffer& buffer = getThreadCollectionBuffer();
+
+            lock_guard lock(buffer.mutex);
+            // consecutive binds of the same shader are common, drop those right away
+            if (buffer.hashes.empty() || buffer.hashes.back() != shaderHash)
+            {
+                buffer.hashes.push_back(shaderHash);
+            }
+        }
+    }
+
+
+    void ShaderManager::mergeActiveShaderHashes()
+    {
+        lock_guard lock(_collectionBuffersMutex);
+        unique_lock collectedLock(_collectedActiveHandlesMutex);
+        unique_lock markedLock(_markedShaderHashMutex);
+
+        compactCollectedShaderHashes();
+
+        for (auto it = _collectionBuffers.begin(); it != _collectionBuffers.end();)
+        {
+            {
+                lock_guard bufferLock((*it)->mutex);
+                for (const auto shaderHash : (*it)->hashes)
+                {
+                    if (_collectedActiveShaderIndices.try_emplace(shaderHash, static_cast<uint32_t>(_collectedActiveShaderHashes.size())).second)
+                    {
+                        _collectedActiveShaderHashes.push_back(shaderHash);
+
+                        if (_markedShaderHashes.contains(shaderHash))
+                        {
+                            _markedCollectedIndices.insert(static_cast<int32_t>(_collectedActiveShaderHashes.size()) - 1);
+                        }
+                    }
+                }
+                (*it)->hashes.clear();
+            }
+
+            // the owning thread is gone
+            if (it->use_count() == 1)
+            {
+                it = _collectionBuffers.erase(it);
+            }
+            else
+            {
+                ++it;
+            }
         }
     }
 
@@ -317,21 +492,19 @@ namespace ShaderToggler
         {
             // remove it
             _markedShaderHashes.erase(_activeHuntedShaderHash);
+            updateMarkedCollectedIndex(_activeHuntedShaderHash, false);
         }
         else
         {
             // add it
             _markedShaderHashes.emplace(_activeHuntedShaderHash);
+            updateMarkedCollectedIndex(_activeHuntedShaderHash, true);
         }
     }
 
 
     uint32_t ShaderManager::getShaderHash(uint64_t handle)
     {
-        if (!_handleToShaderHash.contains(handle))
-        {
-            return 0;
-        }
-        return _handleToShaderHash.at(handle);
+        return _handleToShaderHash.find(handle);
     }
 }
@@ -32,13 +32,19 @@
 
 #pragma once
 
+#include <atomic>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <vector>
 #include <reshade_api_device.hpp>
 #include <reshade_api_pipeline.hpp>
 #include <shared_mutex>
 #include <unordered_set>
 #include <tsl/robin_map.h>
 #include "CDataFile.h"
+#include "ReadMostlyHandleMap.h"
 #include "ToggleGroup.h"
 
 
@@ -87,13 +93,35 @@ namespace ShaderToggler
         /// <param name="handle"></param>
         /// <returns></returns>
         uint32_t getShaderHash(uint64_t handle);
+        /// <summary>
+        /// Records the shader of the passed in pipeline as active during the collection phase. Appends to a buffer owned by the calling thread,
+        /// the buffers are merged into the collected shader hashes by mergeActiveShaderHashes.
+        /// </summary>
         void addActivePipelineHandle(uint64_t handle);
+        /// <summary>
+        /// Merges and deduplicates the per thread buffers filled by addActivePipelineHandle into the collected shader hashes. Called once per present.
+        /// </summary>
+        void mergeActiveShaderHashes();
+        /// <summary>
+        /// Frees the superseded handle tables no lookup can still be reading, see ReadMostlyHandleMap::reclaim_retired. Called once per present.
+        /// </summary>
+        void reclaimRetiredHandleTables() { _handleToShaderHash.reclaim_retired(); }
         void toggleMarkOnHuntedShader();
         void resetActiveHuntedShader();
 
-        size_t getPipelineCount() { return _handleToShaderHash.size(); }
-        size_t getShaderCount() { return _shaderHashes.size(); }
-        const std::unordered_set<uint32_t>& getCollectedShaderHashes() const { return _collectedActiveShaderHashes; }
+        /// <summary>
+        /// Number of live pipelines with a shader of this manager's type attached.
+        /// </summary>
+        size_t getPipelineCount() const { return _handleToShaderHash.size(); }
+        /// <summary>
+        /// Number of unique shaders referenced by the live pipelines.
+        /// </summary>
+        size_t getShaderCount() const { return _uniqueShaderCount.load(std::memory_order_relaxed); }
+        /// <summary>
+        /// The shader hashes collected during the last collection phase, in the order they were first seen. A released shader leaves a 0 in
+        /// its slot until the next merge compacts the list. Indices into this list are the indices used by the hunting functions.
+        /// </summary>
+        const std::vector<uint32_t>& getCollectedShaderHashes() const { return _collectedActiveShaderHashes; }
         void setActivedHuntedShaderIndex(uint32_t index);
         size_t getAmountShaderHashesCollected() { return _collectedActiveShaderHashes.size(); }
         bool isInHuntingMode() const { return _isInHuntingMode; }
@@ -121,15 +149,22 @@ namespace ShaderToggler
 
         uint32_t getCollectedShaderHash(uint32_t index)
         {
-            if (index < 0 || _collectedActiveShaderHashes.size() <= 0 || index >= _collectedActiveShaderHashes.size())
+            if (index >= _collectedActiveShaderHashes.size())
             {
                 return 0;
             }
 
             // no lock needed, collecting phase is over
-            auto it = _collectedActiveShaderHashes.begin();
-            std::advance(it, index);
-            return *it;
+            return _collectedActiveShaderHashes[index];
+        }
+
+        /// <summary>
+        /// Returns the index of the passed in hash in the collected shader hashes, -1 if it wasn't collected.
+        /// </summary>
+        int32_t getCollectedShaderIndex(uint32_t shaderHash)
+        {
+            const auto it = _collectedActiveShaderIndices.find(shaderHash);
+            return it == _collectedActiveShaderIndices.end() ? -1 : static_cast<int32_t>(it->second);
         }
 
         size_t getMarkedShaderCount()
@@ -138,33 +173,44 @@ namespace ShaderToggler
             return _markedShaderHashes.size();
         }
 
-        bool isKnownHandle(uint64_t pipelineHandle)
+        bool isKnownHandle(uint64_t pipelineHandle) const
         {
-            std::shared_lock lock(_hashHandlesMutex);
             return _handleToShaderHash.contains(pipelineHandle);
         }
 
-        inline uint32_t safeGetShaderHash(uint64_t pipelineHandle)
-        {
-            std::shared_lock lock(_hashHandlesMutex);
-            const auto& it = _handleToShaderHash.find(pipelineHandle);
-
-            return it == _handleToShaderHash.end() ? 0 : it->second;
-        }
-
     private:
         void setActiveHuntedShaderHandle();
+        void releaseShaderHash(uint32_t shaderHash);
+        void compactCollectedShaderHashes();
+        void skipReleasedShaders(bool forward);
+        int32_t findMarkedShaderIndex(bool forward);
+        void updateMarkedCollectedIndex(uint32_t shaderHash, bool marked);
 
-        std::unordered_set<uint32_t> _shaderHashes;				// all shader hashes added through init pipeline
-        //std::unordered_map<uint64_t, uint32_t> _handleToShaderHash;		// pipeline handle per shader hash. Handle is removed when a pipeline is destroyed.
-        tsl::robin_map<uint64_t, uint32_t> _handleToShaderHash;
-        std::unordered_set<uint32_t> _collectedActiveShaderHashes;	// shader hashes bound to pipeline handles which were collected during the collection phase after hunting was enabled, which are the pipeline handles active during the last X frames
+        struct CollectionBuffer
+        {
+            std::mutex mutex;               // only contended while the buffer is being merged
+            std::vector<uint32_t> hashes;
+        };
+
+        CollectionBuffer& getThreadCollectionBuffer();
+
+        tsl::robin_map<uint32_t, uint32_t> _shaderHashRefCount;	// all shader hashes added through init pipeline with the number of live pipelines using them
+        std::atomic<size_t> _uniqueShaderCount = 0;
+        ReadMostlyHandleMap<uint32_t> _handleToShaderHash;		// pipeline handle per shader hash. Handle is removed when a pipeline is destroyed.
+        std::vector<uint32_t> _collectedActiveShaderHashes;	// shader hashes bound to pipeline handles which were collected during the collection phase after hunting was enabled, which are the pipeline handles active during the last X frames. In first seen order, a released hash is 0 until the next merge.
+        tsl::robin_map<uint32_t, uint32_t> _collectedActiveShaderIndices;	// collected shader hash -> index in _collectedActiveShaderHashes
+        uint32_t _releasedCollectedShaderCount = 0;		// number of 0 slots in _collectedActiveShaderHashes
         std::unordered_set<uint32_t> _markedShaderHashes;		// the hashes for shaders which are currently marked.
+        std::set<int32_t> _markedCollectedIndices;		// indices in _collectedActiveShaderHashes of the marked shaders, guarded by _markedShaderHashMutex
 
         bool _isInHuntingMode = false;
         int32_t _activeHuntedShaderIndex = -1;
         uint32_t _activeHuntedShaderHash;
         std::shared_mutex _collectedActiveHandlesMutex;
+        std::vector<std::shared_ptr<CollectionBuffer>> _collectionBuffers;	// one per thread which collected shaders for this manager
+        std::mutex _collectionBuffersMutex;
+        const uint32_t _managerIndex;
+        static std::atomic_uint32_t _managerCount;
         std::shared_mutex _hashHandlesMutex;
         std::shared_mutex _markedShaderHashMutex;
         bool _hideMarkedShaders = false;
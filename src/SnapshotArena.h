@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2022 Patrick Mours
+ * SPDX-License-Identifier: BSD-3-Clause OR MIT
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace StateTracking
+{
+    /// <summary>
+    /// Bump allocator backing the descriptor and constant snapshots of a command list. Memory is only released as a whole in reset, which
+    /// coalesces the blocks into a single one large enough for everything allocated before, so a steady state doesn't allocate at all.
+    /// </summary>
+    class snapshot_arena
+    {
+    public:
+        /// <summary>
+        /// Returns count value-initialized elements. Only for trivially copyable types, nothing is ever destructed.
+        /// </summary>
+        template<typename T>
+        T* allocate(size_t count)
+        {
+            static_assert(std::is_trivially_copyable_v<T> && alignof(T) <= alignof(std::max_align_t));
+
+            T* ptr = static_cast<T*>(allocate_bytes(count * sizeof(T), alignof(T)));
+            std::uninitialized_value_construct_n(ptr, count);
+            return ptr;
+        }
+
+        void reset()
+        {
+            if (blocks.size() > 1)
+            {
+                size_t total_size = 0;
+                for (const auto& b : blocks)
+                {
+                    total_size += b.size;
+                }
+
+                blocks.clear();
+                blocks.push_back({ std::make_unique<std::byte[]>(total_size), total_size });
+                block_allocation_count.fetch_add(1, std::memory_order_relaxed);
+            }
+
+            offset = 0;
+        }
+
+        /// <summary>
+        /// Number of blocks allocated from the heap by all arenas, used to verify the snapshots don't allocate once warmed up.
+        /// </summary>
+        static uint64_t get_block_allocation_count() { return block_allocation_count.load(std::memory_order_relaxed); }
+
+    private:
+        void* allocate_bytes(size_t size, size_t alignment)
+        {
+            size_t aligned_offset = (offset + alignment - 1) & ~(alignment - 1);
+
+            if (blocks.empty() || aligned_offset + size > blocks.back().size)
+            {
+                const size_t block_size = std::max(size, blocks.empty() ? static_cast<size_t>(4096) : blocks.back().size * 2);
+                blocks.push_back({ std::make_unique<std::byte[]>(block_size), block_size });
+                block_allocation_count.fetch_add(1, std::memory_order_relaxed);
+                aligned_offset = 0;
+            }
+
+            offset = aligned_offset + size;
+            return blocks.back().data.get() + aligned_offset;
+        }
+
+        struct block
+        {
+            std::unique_ptr<std::byte[]> data;
+            size_t size = 0;
+        };
+
+        std::vector<block> blocks;
+        size_t offset = 0;      // into the last block
+
+        static inline std::atomic<uint64_t> block_allocation_count = 0;
+    };
+}
@@ -11,13 +11,108 @@ using namespace reshade::api;
 using namespace StateTracking;
 
 bool state_tracking::track_descriptors = true;
+bool state_tracking::state_events_registered = false;
+std::atomic<bool> state_tracking::state_events_enabled = true;
+state_tracking::api_family state_tracking::device_api_family = state_tracking::api_family::none;
+std::mutex state_tracking::api_events_mutex;
+std::array<std::atomic<uint64_t>, TRACKED_SHADER_STAGES_SIZE> state_tracking::tracked_slots = {};
+std::array<std::atomic<int32_t>, TRACKED_SHADER_STAGES_SIZE> state_tracking::tracked_max_slot = { -1, -1, -1 };
+std::atomic<uint32_t> barrier_track_list::total_count = 0;
+std::atomic<uint32_t> state_block::state_calls_issued = 0;
+std::atomic<uint32_t> state_block::state_calls_saved = 0;
+std::atomic<uint32_t> state_block::last_frame_state_calls_issued = 0;
+std::atomic<uint32_t> state_block::last_frame_state_calls_saved = 0;
+std::atomic<uint32_t> state_block::deferred_block_count = 0;
+
+descriptor_tracking::descriptor_data* state_block::allocate_descriptors(root_entry& entry, uint32_t count)
+{
+    if (entry.descriptors == nullptr || count > entry.capacity)
+    {
+        const uint32_t capacity = std::max(count, entry.capacity * 2);
+        descriptor_tracking::descriptor_data* descriptors = snapshot_arenas[current_arena].allocate<descriptor_tracking::descriptor_data>(capacity);
+
+        if (entry.descriptors != nullptr)
+        {
+            std::copy_n(entry.descriptors, entry.count, descriptors);
+        }
+
+        entry.descriptors = descriptors;
+        entry.capacity = capacity;
+    }
+
+    entry.count = std::max(entry.count, count);
+    return entry.descriptors;
+}
+
+uint32_t* state_block::allocate_constants(root_entry& entry, uint32_t count)
+{
+    if (entry.constants == nullptr || count > entry.capacity)
+    {
+        const uint32_t capacity = std::max(count, entry.capacity * 2);
+        uint32_t* constants = snapshot_arenas[current_arena].allocate<uint32_t>(capacity);
+
+        if (entry.constants != nullptr)
+        {
+            std::copy_n(entry.constants, entry.count, constants);
+        }
+
+        entry.constants = constants;
+        entry.capacity = capacity;
+    }
+
+    entry.count = std::max(entry.count, count);
+    return entry.constants;
+}
+
+void tracking_interest::add(uint32_t stage_index, uint32_t slot)
+{
+    stage_index = std::min(TRACKED_SHADER_STAGES_SIZE - 1, stage_index);
+
+    if (slot < 64)
+    {
+        slots[stage_index] |= 1ull << slot;
+    }
+
+    max_slot[stage_index] = std::max(max_slot[stage_index], static_cast<int32_t>(std::min(slot, static_cast<uint32_t>(INT32_MAX))));
+}
 
-void state_block::apply_descriptors_dx12_vulkan(command_list* cmd_list) const
+void state_tracking::set_interest(const tracking_interest& interest)
+{
+    for (uint32_t i = 0; i < TRACKED_SHADER_STAGES_SIZE; i++)
+    {
+        tracked_slots[i].store(interest.slots[i], std::memory_order_relaxed);
+        tracked_max_slot[i].store(interest.max_slot[i], std::memory_order_relaxed);
+    }
+}
+
+bool state_tracking::is_tracked(int32_t stage_index, uint32_t layout_param, size_t root_table_size)
+{
+    if (stage_index < 0 || stage_index >= static_cast<int32_t>(TRACKED_SHADER_STAGES_SIZE))
+    {
+        return false;
+    }
+
+    const int32_t max_slot = tracked_max_slot[stage_index].load(std::memory_order_relaxed);
+
+    if (max_slot < 0)
+    {
+        return false;
+    }
+
+    if (layout_param < 64 ? (tracked_slots[stage_index].load(std::memory_order_relaxed) & (1ull << layout_param)) != 0 : static_cast<int32_t>(layout_param) == max_slot)
+    {
+        return true;
+    }
+
+    // Slots beyond the root table are clamped to its last entry by the readers
+    return layout_param + 1 == root_table_size && static_cast<int32_t>(layout_param) < max_slot;
+}
+
+void state_block::apply_descriptors_dx12_vulkan(command_list* cmd_list, uint32_t dirty, state_call_count& calls) const
 {
     uint32_t shader_stages_set = 0;
     for (uint32_t stageIdx = 0; stageIdx < ALL_SHADER_STAGES_SIZE; stageIdx++)
     {
-        auto& descriptor_data = cmd_list->get_device()->get_private_data<descriptor_tracking>();
         const auto& [pipelinelayout, root_table] = root_tables[stageIdx];
         shader_stage stages = root_table_stages[stageIdx];
 
@@ -28,43 +123,57 @@ void state_block::apply_descriptors_dx12_vulkan(command_list* cmd_list) const
 
         shader_stages_set |= static_cast<uint32_t>(stages);
 
-        // Restore root signature and descriptor heaps
-        if (pipelinelayout != 0)
-        {
-            cmd_list->bind_descriptor_tables(stages, pipelinelayout, 0, 0, nullptr);
-        }
-        else
+        if (pipelinelayout == 0)
         {
             continue;
         }
 
+        const bool issue = (dirty & (stages == shader_stage::compute ? state_category_compute_descriptors : state_category_graphics_descriptors)) != 0;
+
+        // Restore root signature and descriptor heaps
+        if (issue)
+            cmd_list->bind_descriptor_tables(stages, pipelinelayout, 0, 0, nullptr);
+        calls.add(issue);
+
         // Restore tables in first pass to assure heaps are restored, do constants in a second pass,
         // pushed descriptors should be restored along with the tables when the heap is restored to the game internal one
         for (uint32_t i = 0; i < root_table.size(); i++)
         {
             if (root_table[i].type == root_entry_type::descriptor_table && root_table[i].descriptor_table.handle != 0)
             {
-                cmd_list->bind_descriptor_tables(stages, pipelinelayout, i, 1, &root_table[i].descriptor_table);
+                if (issue)
+                    cmd_list->bind_descriptor_tables(stages, pipelinelayout, i, 1, &root_table[i].descriptor_table);
+                calls.add(issue);
             }
 
-            if (root_table[i].type == root_entry_type::push_constants && root_table[i].buffer_index >= 0 && constant_buffer[root_table[i].buffer_index].size() > 0)
+            if (root_table[i].type == root_entry_type::push_constants && root_table[i].count > 0)
             {
-                cmd_list->push_constants(stages, pipelinelayout, i, 0, static_cast<uint32_t>(constant_buffer[root_table[i].buffer_index].size()), constant_buffer[root_table[i].buffer_index].data());
+                if (issue)
+                    cmd_list->push_constants(stages, pipelinelayout, i, 0, root_table[i].count, root_table[i].constants);
+                calls.add(issue);
             }
         }
     }
 }
 
-void state_block::apply_descriptors(command_list* cmd_list) const
+void state_block::apply_descriptors(command_list* cmd_list, uint32_t dirty, state_call_count& calls) const
 {
     auto& [desc_layout, descriptors] = cmd_list->get_private_data<state_tracking>().root_tables[0];
     const size_t it = std::min(static_cast<size_t>(2), descriptors.size());
+    const bool issue = (dirty & state_category_graphics_descriptors) != 0;
 
     for (uint32_t i = 0; i < it; i++)
     {
-        if (descriptors[i].type == root_entry_type::push_descriptors && descriptors[i].buffer_index >= 0 && descriptor_buffer[0][descriptors[i].buffer_index].size() > 0)
+        if (descriptors[i].type == root_entry_type::push_descriptors && descriptors[i].count > 0)
         {
-            const descriptor_tracking::descriptor_data* desc = &descriptor_buffer[0][descriptors[i].buffer_index][0];
+            calls.add(issue);
+
+            if (!issue)
+            {
+                continue;
+            }
+
+            const descriptor_tracking::descriptor_data* desc = descriptors[i].descriptors;
 
             switch (desc->type)
             {
@@ -88,8 +197,10 @@ void state_block::apply_descriptors(command_list* cmd_list) const
     }
 }
 
-void state_block::capture(command_list* cmd_list, bool force_restore)
+void state_block::capture(command_list* cmd_list, bool force_restore, uint32_t categories)
 {
+    dirty_categories = categories;
+
     if (force_restore && cmd_list->get_device()->get_api() == device_api::d3d9 && dx_state == nullptr)
     {
         IDirect3DDevice9* device = reinterpret_cast<IDirect3DDevice9*>(cmd_list->get_device()->get_native());
@@ -111,6 +222,55 @@ void state_block::apply(command_list* cmd_list, bool force_restore)
     default:
         apply_default(cmd_list, force_restore);
     }
+
+    dirty_categories = state_category_all;
+}
+
+void state_block::apply_deferred(command_list* cmd_list, uint32_t categories)
+{
+    const device_api api = cmd_list->get_device()->get_api();
+
+    // Only d3d12 and Vulkan restore without being forced to, and their state doesn't outlive the command list
+    if (api != device_api::d3d12 && api != device_api::vulkan)
+    {
+        dirty_categories = categories;
+        apply(cmd_list);
+        return;
+    }
+
+    if (deferred_categories == state_category_none && categories != state_category_none)
+    {
+        deferred_block_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    deferred_categories |= categories;
+}
+
+void state_block::flush_deferred(command_list* cmd_list)
+{
+    if (deferred_categories == state_category_none)
+    {
+        return;
+    }
+
+    dirty_categories = deferred_categories;
+    discard_deferred(state_category_all);
+    apply(cmd_list);
+}
+
+void state_block::discard_deferred(uint32_t categories)
+{
+    if (deferred_categories == state_category_none)
+    {
+        return;
+    }
+
+    deferred_categories &= ~categories;
+
+    if (deferred_categories == state_category_none)
+    {
+        deferred_block_count.fetch_sub(1, std::memory_order_relaxed);
+    }
 }
 
 void state_block::apply_dx9(reshade::api::command_list* cmd_list, bool force_restore)
@@ -140,50 +300,108 @@ void state_block::apply_default(reshade::api::command_list* cmd_list, bool force
         return;
     }
 
+    // Binding a pipeline resets the dynamic states baked into it, so those have to be restored along with it
+    const uint32_t dirty = (dirty_categories & (state_category_graphics_pipeline | state_category_compute_pipeline)) != 0 ?
+        dirty_categories | state_category_dynamic_states : dirty_categories;
+    state_call_count calls;
+
     if (!render_targets.empty() || depth_stencil != 0)
-        cmd_list->bind_render_targets_and_depth_stencil(static_cast<uint32_t>(render_targets.size()), render_targets.data(), depth_stencil);
+    {
+        if (dirty & state_category_render_targets)
+            cmd_list->bind_render_targets_and_depth_stencil(static_cast<uint32_t>(render_targets.size()), render_targets.data(), depth_stencil);
+        calls.add((dirty & state_category_render_targets) != 0);
+    }
 
     uint32_t pipeline_stages_set = 0;
     for (uint32_t s = 0; s < ALL_PIPELINE_STAGES_SIZE; s++)
     {
         if ((static_cast<uint32_t>(current_pipeline_stage[s]) | pipeline_stages_set) > pipeline_stages_set)
         {
+            const bool issue = (dirty & (current_pipeline_stage[s] == pipeline_stage::compute_shader ? state_category_compute_pipeline : state_category_graphics_pipeline)) != 0;
+
             pipeline_stages_set |= static_cast<uint32_t>(current_pipeline_stage[s]);
-            cmd_list->bind_pipeline(current_pipeline_stage[s], current_pipeline[s]);
+            if (issue)
+                cmd_list->bind_pipeline(current_pipeline_stage[s], current_pipeline[s]);
+            calls.add(issue);
         }
     }
 
+    const bool dynamic_states = (dirty & state_category_dynamic_states) != 0;
+
     if (primitive_topology != primitive_topology::undefined)
-        cmd_list->bind_pipeline_state(dynamic_state::primitive_topology, static_cast<uint32_t>(primitive_topology));
+    {
+        if (dynamic_states)
+            cmd_list->bind_pipeline_state(dynamic_state::primitive_topology, static_cast<uint32_t>(primitive_topology));
+        calls.add(dynamic_states);
+    }
     if (blend_constant != 0)
-        cmd_list->bind_pipeline_state(dynamic_state::blend_constant, blend_constant);
+    {
+        if (dynamic_states)
+            cmd_list->bind_pipeline_state(dynamic_state::blend_constant, blend_constant);
+        calls.add(dynamic_states);
+    }
     if (sample_mask != 0xFFFFFFFF)
-        cmd_list->bind_pipeline_state(dynamic_state::sample_mask, sample_mask);
+    {
+        if (dynamic_states)
+            cmd_list->bind_pipeline_state(dynamic_state::sample_mask, sample_mask);
+        calls.add(dynamic_states);
+    }
     if (front_stencil_reference_value != 0)
-        cmd_list->bind_pipeline_state(dynamic_state::front_stencil_reference_value, front_stencil_reference_value);
+    {
+        if (dynamic_states)
+            cmd_list->bind_pipeline_state(dynamic_state::front_stencil_reference_value, front_stencil_reference_value);
+        calls.add(dynamic_states);
+    }
     if (cmd_list->get_device()->get_api() >= device_api::d3d12)
     {
         if (back_stencil_reference_value != 0)
-            cmd_list->bind_pipeline_state(dynamic_state::back_stencil_reference_value, back_stencil_reference_value);
+        {
+            if (dynamic_states)
+                cmd_list->bind_pipeline_state(dynamic_state::back_stencil_reference_value, back_stencil_reference_value);
+            calls.add(dynamic_states);
+        }
     }
 
     if (!viewports.empty())
-        cmd_list->bind_viewports(0, static_cast<uint32_t>(viewports.size()), viewports.data());
+    {
+        if (dirty & state_category_viewports)
+            cmd_list->bind_viewports(0, static_cast<uint32_t>(viewports.size()), viewports.data());
+        calls.add((dirty & state_category_viewports) != 0);
+    }
     if (!scissor_rects.empty())
-        cmd_list->bind_scissor_rects(0, static_cast<uint32_t>(scissor_rects.size()), scissor_rects.data());
+    {
+        if (dirty & state_category_scissor_rects)
+            cmd_list->bind_scissor_rects(0, static_cast<uint32_t>(scissor_rects.size()), scissor_rects.data());
+        calls.add((dirty & state_category_scissor_rects) != 0);
+    }
 
     if (cmd_list->get_device()->get_api() == device_api::d3d12 || cmd_list->get_device()->get_api() == device_api::vulkan)
     {
-        apply_descriptors_dx12_vulkan(cmd_list);
+        apply_descriptors_dx12_vulkan(cmd_list, dirty, calls);
     }
     else
     {
-        apply_descriptors(cmd_list);
+        apply_descriptors(cmd_list, dirty, calls);
     }
+
+    state_calls_issued.fetch_add(calls.issued, std::memory_order_relaxed);
+    state_calls_saved.fetch_add(calls.saved, std::memory_order_relaxed);
+}
+
+state_call_count state_block::get_state_call_stats()
+{
+    return { last_frame_state_calls_issued.load(std::memory_order_relaxed), last_frame_state_calls_saved.load(std::memory_order_relaxed) };
+}
+
+void state_block::end_state_call_frame()
+{
+    last_frame_state_calls_issued.store(state_calls_issued.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
+    last_frame_state_calls_saved.store(state_calls_saved.exchange(0, std::memory_order_relaxed), std::memory_order_relaxed);
 }
 
 void state_block::clear()
 {
+    discard_deferred(state_category_all);
     render_targets.clear();
     depth_stencil = { 0 };
     primitive_topology = primitive_topology::undefined;
@@ -193,10 +411,10 @@ void state_block::clear()
     sample_mask = 0xFFFFFFFF;
     viewports.clear();
     scissor_rects.clear();
-    root_tables.fill(make_pair(pipeline_layout{ 0 }, std::vector<root_entry>()));
+    // Keep the capacity of the root tables around, they're filled again right away
+    std::for_each(root_tables.begin(), root_tables.end(), [](std::pair<pipeline_layout, std::vector<root_entry>>& t) { t.first = { 0 }; t.second.clear(); });
     root_table_stages.fill(static_cast<shader_stage>(0));
-    std::for_each(constant_buffer.begin(), constant_buffer.end(), [](std::vector<std::vector<uint32_t>>& v) { v.clear(); });
-    std::for_each(descriptor_buffer.begin(), descriptor_buffer.end(), [](std::vector<std::vector<descriptor_tracking::descriptor_data>>& v) { v.clear(); });
+    std::for_each(snapshot_arenas.begin(), snapshot_arenas.end(), [](snapshot_arena& a) { a.reset(); });
     current_pipeline.fill(pipeline{ 0 });
     current_pipeline_stage.fill(static_cast<pipeline_stage>(0));
     resource_barrier_track.clear();
@@ -206,6 +424,38 @@ void state_block::clear_present(effect_runtime* runtime)
 {
      render_targets.clear();
      depth_stencil = { 0 };
+
+     // Move the snapshots which are still bound into the other arena, so the current one can be reset
+     const uint32_t previous_arena = current_arena;
+     current_arena ^= 1;
+     snapshot_arenas[current_arena].reset();
+
+     for (auto& [layout, root_table] : root_tables)
+     {
+         for (auto& entry : root_table)
+         {
+             const uint32_t count = entry.count;
+
+             if (entry.descriptors != nullptr)
+             {
+                 const descriptor_tracking::descriptor_data* descriptors = entry.descriptors;
+                 entry.descriptors = nullptr;
+                 entry.count = 0;
+                 entry.capacity = 0;
+                 std::copy_n(descriptors, count, allocate_descriptors(entry, count));
+             }
+             else if (entry.constants != nullptr)
+             {
+                 const uint32_t* constants = entry.constants;
+                 entry.constants = nullptr;
+                 entry.count = 0;
+                 entry.capacity = 0;
+                 std::copy_n(constants, count, allocate_constants(entry, count));
+             }
+         }
+     }
+
+     snapshot_arenas[previous_arena].reset();
 }
 
 static inline int32_t get_shader_stage_index(shader_stage stages)
@@ -238,9 +488,44 @@ static inline int32_t get_pipeline_stage_index(pipeline_stage stages)
     return -1;
 }
 
+// Restores what apply_deferred left to restore before the game issues a command depending on it
+static inline void flush_deferred_state(command_list* cmd_list)
+{
+    if (state_block::has_deferred())
+    {
+        cmd_list->get_private_data<state_tracking>().flush_deferred(cmd_list);
+    }
+}
+
+static bool on_draw(command_list* cmd_list, uint32_t, uint32_t, uint32_t, uint32_t)
+{
+    flush_deferred_state(cmd_list);
+    return false;
+}
+static bool on_draw_indexed(command_list* cmd_list, uint32_t, uint32_t, uint32_t, int32_t, uint32_t)
+{
+    flush_deferred_state(cmd_list);
+    return false;
+}
+static bool on_dispatch(command_list* cmd_list, uint32_t, uint32_t, uint32_t)
+{
+    flush_deferred_state(cmd_list);
+    return false;
+}
+static bool on_draw_or_dispatch_indirect(command_list* cmd_list, indirect_command, resource, uint64_t, uint32_t, uint32_t)
+{
+    flush_deferred_state(cmd_list);
+    return false;
+}
+static void on_execute_secondary_command_list(command_list* cmd_list, command_list*)
+{
+    // Bundles inherit the bound descriptors
+    flush_deferred_state(cmd_list);
+}
+
 static void on_init_command_list(command_list* cmd_list)
 {
-    cmd_list->create_private_data<state_tracking>();
+    cmd_list->create_private_data<state_tracking>().cmd_list_device = cmd_list->get_device();
 
     auto& deviceState = cmd_list->get_device()->get_private_data<DeviceStateTracking>();
     std::unique_lock<std::shared_mutex> lock(deviceState.cmd_list_mutex);
@@ -248,6 +533,7 @@ static void on_init_command_list(command_list* cmd_list)
 }
 static void on_destroy_command_list(command_list* cmd_list)
 {
+    cmd_list->get_private_data<state_tracking>().discard_deferred(state_category_all);
     cmd_list->destroy_private_data<state_tracking>();
 
     auto& deviceState = cmd_list->get_device()->get_private_data<DeviceStateTracking>();
@@ -257,19 +543,41 @@ static void on_destroy_command_list(command_list* cmd_list)
 
 static void on_bind_render_targets_and_depth_stencil(command_list* cmd_list, uint32_t count, const resource_view* rtvs, resource_view dsv)
 {
+    if (!state_tracking::is_enabled())
+        return;
+
     auto& state = cmd_list->get_private_data<state_tracking>();
     state.render_targets.assign(rtvs, rtvs + count);
     state.depth_stencil = dsv;
+    state.discard_deferred(state_category_render_targets);
+}
+
+static void on_begin_render_pass(command_list* cmd_list, uint32_t, const render_pass_render_target_desc*, const render_pass_depth_stencil_desc*)
+{
+    // The render pass replaces the bound render targets, restoring the ones bound before would break it
+    if (state_block::has_deferred())
+    {
+        cmd_list->get_private_data<state_tracking>().discard_deferred(state_category_render_targets);
+    }
 }
 
 static void on_bind_pipeline(command_list* cmd_list, pipeline_stage stages, pipeline pipeline)
 {
+    if (!state_tracking::is_enabled())
+        return;
+
     auto& state = cmd_list->get_private_data<state_tracking>();
 
     uint32_t idx = get_pipeline_stage_index(stages);
 
     state.current_pipeline[idx] = pipeline;
     state.current_pipeline_stage[idx] = stages;
+
+    // d3d12 binds a single pipeline state object for all stages, Vulkan graphics and compute pipelines separately
+    if ((stages & pipeline_stage::all_graphics) == pipeline_stage::all_graphics)
+        state.discard_deferred(state_category_graphics_pipeline);
+    if (stages == pipeline_stage::compute_shader || stages == pipeline_stage::all)
+        state.discard_deferred(state_category_compute_pipeline);
 }
 
 static void on_destroy_pipeline(device* device, pipeline pipeline)
@@ -313,6 +621,9 @@ static void on_destroy_pipeline(device* device, pipeline pipeline)
 
 static void on_bind_pipeline_states(command_list* cmd_list, uint32_t count, const dynamic_state* states, const uint32_t* values)
 {
+    if (!state_tracking::is_enabled())
+        return;
+
     auto& state = cmd_list->get_private_data<state_tracking>();
 
     for (uint32_t i = 0; i < count; ++i)
@@ -340,6 +651,9 @@ static void on_bind_pipeline_states(command_list* cmd_list, uint32_t count, cons
 
 static void on_bind_viewports(command_list* cmd_list, uint32_t first, uint32_t count, const viewport* viewports)
 {
+    if (!state_tracking::is_enabled())
+        return;
+
     auto& state = cmd_list->get_private_data<state_tracking>();
 
     if (state.viewports.size() < (first + count))
@@ -347,10 +661,16 @@ static void on_bind_viewports(command_list* cmd_list, uint32_t first, uint32_t c
 
     for (uint32_t i = 0; i < count; ++i)
         state.viewports[i + first] = viewports[i];
+
+    if (first == 0 && count == state.viewports.size())
+        state.discard_deferred(state_category_viewports);
 }
 
 static void on_bind_scissor_rects(command_list* cmd_list, uint32_t first, uint32_t count, const rect* rects)
 {
+    if (!state_tracking::is_enabled())
+        return;
+
     auto& state = cmd_list->get_private_data<state_tracking>();
 
     if (state.scissor_rects.size() < (first + count))
@@ -358,73 +678,57 @@ static void on_bind_scissor_rects(command_list* cmd_list, uint32_t first, uint32
 
     for (uint32_t i = 0; i < count; ++i)
         state.scissor_rects[i + first] = rects[i];
+
+    if (first == 0 && count == state.scissor_rects.size())
+        state.discard_deferred(state_category_scissor_rects);
 }
 
-static void on_bind_descriptor_tables(command_list* cmd_list, shader_stage stages, pipeline_layout layout, uint32_t first, uint32_t count, const descriptor_table* tables)
+// What has to be tracked differs per API family: d3d9-11 and OpenGL have no descriptor tables and bind everything through pushed
+// descriptors, of which pixel slots 0 and 1 are restored after the addon's own passes. d3d12 and Vulkan bind tables and get their pushed
+// constants restored. Everything else is only captured for the slots groups read. The callbacks below are instantiated per family and
+// the ones of the family of the devices created so far are registered, see register_api_events.
+struct immediate_api_traits
 {
-    int32_t idx = get_shader_stage_index(stages);
-
-    if (idx < 0)
-        return;
+    static constexpr bool binds_descriptor_tables = false;
 
-    auto& state_tracker = cmd_list->get_private_data<state_tracking>();
-    const auto& descriptor_state = cmd_list->get_device()->get_private_data<descriptor_tracking>();
-    auto& [desc_layout, root_table] = state_tracker.root_tables[idx];
-    auto& state_stages = state_tracker.root_table_stages[idx];
-    auto& descriptor_buffer = state_tracker.descriptor_buffer[idx];
-    auto& constant_buffer = state_tracker.constant_buffer[idx];
+    static bool restores_push_descriptors(command_list*, int32_t stage_index, uint32_t layout_param) { return stage_index == 0 && layout_param < 2; }
+    static bool restores_push_constants(command_list*) { return false; }
+};
 
-    if (desc_layout != layout)
-    {
-        root_table.clear(); // Layout changed, which resets all descriptor set bindings
-        descriptor_buffer.clear();
-        constant_buffer.clear();
-    }
+struct explicit_api_traits
+{
+    static constexpr bool binds_descriptor_tables = true;
 
-    desc_layout = layout;
-    state_stages = stages;
+    static bool restores_push_descriptors(command_list*, int32_t, uint32_t) { return false; }
+    static bool restores_push_constants(command_list*) { return true; }
+};
 
-    if (root_table.size() < (first + count))
-        root_table.resize(first + count);
+// Devices of both families were created, decide per command list
+struct mixed_api_traits
+{
+    static constexpr bool binds_descriptor_tables = true;
 
-    for (uint32_t i = 0; i < count; ++i)
+    static bool restores_push_descriptors(command_list* cmd_list, int32_t stage_index, uint32_t layout_param)
     {
-        const pipeline_layout_param param = descriptor_state.get_pipeline_layout_param(layout, first + i);
-        if (param.type != pipeline_layout_param_type::descriptor_table)
-            continue;
-    
-        uint32_t max_descriptor_size = 0;
-        for (uint32_t k = 0; k < param.descriptor_table.count; ++k)
-        {
-            const descriptor_range& range = param.descriptor_table.ranges[k];
-            if (range.count != UINT32_MAX && range.type != descriptor_type::sampler)
-                max_descriptor_size = std::max(max_descriptor_size, range.binding + range.count);
-        }
-
-        std::vector<descriptor_tracking::descriptor_data> descriptors(max_descriptor_size);
-    
-        for (uint32_t k = 0; k < param.descriptor_table.count; ++k)
-        {
-            const descriptor_range& range = param.descriptor_table.ranges[k];
-    
-            if (range.count == UINT32_MAX || range.type == descriptor_type::sampler)
-                continue; // Skip unbounded ranges
-    
-            uint32_t base_offset = 0;
-            descriptor_heap heap = { 0 };
-            cmd_list->get_device()->get_descriptor_heap_offset(tables[i], range.binding, 0, &heap, &base_offset);
-    
-            descriptor_state.set_all_descriptors(heap, base_offset, range.count, descriptors, range.binding);
-        }
-
-        descriptor_buffer.push_back(std::move(descriptors));
-
-        root_table[i + first] = { root_entry_type::descriptor_table, static_cast<int32_t>(descriptor_buffer.size()) - 1, tables[i]};
+        return !restores_push_constants(cmd_list) && immediate_api_traits::restores_push_descriptors(cmd_list, stage_index, layout_param);
     }
-}
+    static bool restores_push_constants(command_list* cmd_list)
+    {
+        const device_api api = cmd_list->get_device()->get_api();
+        return api == device_api::d3d12 || api == device_api::vulkan;
+    }
+};
 
-static void on_bind_descriptor_tables_no_track(command_list* cmd_list, shader_stage stages, pipeline_layout layout, uint32_t first, uint32_t count, const descriptor_table* tables)
+// Instantiated with and without descriptor tracking, see register_family_events
+template<bool resolve_tables>
+static void on_bind_descriptor_tables(command_list* cmd_list, shader_stage stages, pipeline_layout layout, uint32_t first, uint32_t count, const descriptor_table* tables)
 {
+    if (!state_tracking::is_enabled())
+        return;
+
+    // Descriptors are bound relative to the pipeline layout, which has to be the game's one again first
+    flush_deferred_state(cmd_list);
+
     int32_t idx = get_shader_stage_index(stages);
 
     if (idx < 0)
@@ -433,14 +737,10 @@ static void on_bind_descriptor_tables_no_track(command_list* cmd_list, shader_st
     auto& state_tracker = cmd_list->get_private_data<state_tracking>();
     auto& [desc_layout, root_table] = state_tracker.root_tables[idx];
     auto& state_stages = state_tracker.root_table_stages[idx];
-    auto& constant_buffer = state_tracker.constant_buffer[idx];
-    auto& descriptor_buffer = state_tracker.descriptor_buffer[idx];
 
     if (desc_layout != layout)
     {
         root_table.clear(); // Layout changed, which resets all descriptor set bindings
-        constant_buffer.clear();
-        descriptor_buffer.clear();
     }
 
     desc_layout = layout;
@@ -449,13 +749,19 @@ static void on_bind_descriptor_tables_no_track(command_list* cmd_list, shader_st
     if (root_table.size() < (first + count))
         root_table.resize(first + count);
 
+    // Only remember the tables, their descriptors are resolved when they're read, see state_block::get_descriptor_at
     for (uint32_t i = 0; i < count; ++i)
     {
         root_table[i + first] = tables[i];
+
+        if constexpr (resolve_tables)
+        {
+            root_table[i + first].resolve_descriptors = tables[i].handle != 0 && state_tracking::is_tracked(idx, first + i, root_table.size());
+        }
     }
 }
 
-static inline void fill_descriptors(std::vector<descriptor_tracking::descriptor_data>& table, const descriptor_table_update& update)
+static inline void fill_descriptors(descriptor_tracking::descriptor_data* table, const descriptor_table_update& update)
 {
     for (uint32_t i = 0; i < update.count; i++)
     {
@@ -484,117 +790,165 @@ static inline void fill_descriptors(std::vector<descriptor_tracking::descriptor_
     }
 }
 
-static void on_push_descriptors(command_list* cmd_list, shader_stage stages, pipeline_layout layout, uint32_t layout_param, const descriptor_table_update& update)
+void state_block::push_descriptors(int32_t stage_index, shader_stage stages, pipeline_layout layout, uint32_t layout_param, const descriptor_table_update& update, bool restored)
 {
-    int32_t idx = get_shader_stage_index(stages);
+    auto& [desc_layout, root_table] = root_tables[stage_index];
 
-    if (idx < 0)
-        return;
-
-    auto& state_tracker = cmd_list->get_private_data<state_tracking>();
-    auto& [desc_layout, root_table] = state_tracker.root_tables[idx];
-    auto& state_stages = state_tracker.root_table_stages[idx];
-    auto& descriptor_buffer = state_tracker.descriptor_buffer[idx];
-    
     desc_layout = layout;
-    state_stages = stages;
+    root_table_stages[stage_index] = stages;
 
     if (root_table.size() < layout_param + 1)
     {
         root_table.resize(layout_param + 1);
     }
 
+    if (!restored && !state_tracking::is_tracked(stage_index, layout_param, root_table.size()))
+    {
+        return;
+    }
+
     auto& root_table_entry = root_table[layout_param];
 
     // Initialize table for descriptors
-    if (root_table_entry.type == root_entry_type::undefined)
+    if (root_table_entry.type != root_entry_type::push_descriptors)
     {
-        std::vector<descriptor_tracking::descriptor_data> buf(update.binding + update.count);
+        root_table_entry = {};
+        root_table_entry.type = root_entry_type::push_descriptors;
+    }
 
-        fill_descriptors(buf, update);
+    fill_descriptors(allocate_descriptors(root_table_entry, update.binding + update.count), update);
+}
 
-        descriptor_buffer.push_back(std::move(buf));
-        root_table_entry = { root_entry_type::push_descriptors, static_cast<int32_t>(descriptor_buffer.size()) - 1, {} };
+void state_block::push_constants(int32_t stage_index, shader_stage stages, pipeline_layout layout, uint32_t layout_param, uint32_t first, uint32_t count, const void* values, bool restored)
+{
+    auto& [desc_layout, root_table] = root_tables[stage_index];
+
+    desc_layout = layout;
+    root_table_stages[stage_index] = stages;
+
+    if (root_table.size() < layout_param + 1)
+    {
+        root_table.resize(layout_param + 1);
     }
-    else
+
+    if (!restored && !state_tracking::is_tracked(stage_index, layout_param, root_table.size()))
     {
-        auto& buf = descriptor_buffer[root_table_entry.buffer_index];
+        return;
+    }
 
-        if (buf.size() < update.binding + update.count)
-        {
-            buf.resize(update.binding + update.count);
-        }
+    auto& root_table_entry = root_table[layout_param];
 
-        fill_descriptors(buf, update);
+    // Not buffered yet, initialize
+    if (root_table_entry.type != root_entry_type::push_constants)
+    {
+        root_table_entry = {};
+        root_table_entry.type = root_entry_type::push_constants;
     }
+
+    uint32_t* buf = allocate_constants(root_table_entry, first + count);
+    std::copy_n(reinterpret_cast<const uint32_t*>(values), count, buf + first);
 }
 
-static void on_push_constants(command_list* cmd_list, shader_stage stages, pipeline_layout layout, uint32_t layout_param, uint32_t first, uint32_t count, const void* values)
+template<typename api_traits>
+static void on_push_descriptors(command_list* cmd_list, shader_stage stages, pipeline_layout layout, uint32_t layout_param, const descriptor_table_update& update)
 {
+    if (!state_tracking::is_enabled())
+        return;
+
+    // Descriptors are bound relative to the pipeline layout, which has to be the game's one again first
+    flush_deferred_state(cmd_list);
+
     int32_t idx = get_shader_stage_index(stages);
 
     if (idx < 0)
         return;
 
-    auto& state_tracker = cmd_list->get_private_data<state_tracking>();
-    auto& [desc_layout, root_table] = state_tracker.root_tables[idx];
-    auto& state_stages = state_tracker.root_table_stages[idx];
-    auto& constant_buffer = state_tracker.constant_buffer[idx];
-    
-    desc_layout = layout;
-    state_stages = stages;
+    // Pushed descriptors restored on d3d9-11 are kept for every slot, see apply_descriptors
+    cmd_list->get_private_data<state_tracking>().push_descriptors(idx, stages, layout, layout_param, update, api_traits::restores_push_descriptors(cmd_list, idx, layout_param));
+}
 
-    if (root_table.size() < layout_param + 1)
-    {
-        root_table.resize(layout_param + 1);
-    }
+template<typename api_traits>
+static void on_push_constants(command_list* cmd_list, shader_stage stages, pipeline_layout layout, uint32_t layout_param, uint32_t first, uint32_t count, const void* values)
+{
+    if (!state_tracking::is_enabled())
+        return;
 
-    auto& root_table_entry = root_table[layout_param];
+    // Descriptors are bound relative to the pipeline layout, which has to be the game's one again first
+    flush_deferred_state(cmd_list);
 
-    // Not buffered yet, initialize
-    if (root_table_entry.type == root_entry_type::undefined)
+    int32_t idx = get_shader_stage_index(stages);
+
+    if (idx < 0)
+        return;
+
+    // Pushed constants are only restored on d3d12 and vulkan, see apply_descriptors_dx12_vulkan
+    cmd_list->get_private_data<state_tracking>().push_constants(idx, stages, layout, layout_param, first, count, values, api_traits::restores_push_constants(cmd_list));
+}
+
+bool state_block::prepare_descriptor_table(pipeline_layout layout, uint32_t layout_param, root_entry& entry)
+{
+    if (entry.table_layout == nullptr)
     {
-        std::vector<uint32_t> buf(first + count);
+        entry.table_layout = cmd_list_device->get_private_data<descriptor_tracking>().get_descriptor_table_layout(layout, layout_param);
 
-        for (uint32_t i = 0; i < count; i++)
+        if (entry.table_layout == nullptr)
         {
-            buf[first + i] = reinterpret_cast<const uint32_t*>(values)[i];
+            entry.resolve_descriptors = false;
+            return false;
         }
 
-        constant_buffer.push_back(std::move(buf));
+        allocate_descriptors(entry, entry.table_layout->max_binding);
+        entry.resolved_ranges = 0;
+    }
+
+    return true;
+}
 
-        root_table_entry = { root_entry_type::push_constants, static_cast<int32_t>(constant_buffer.size()) - 1, {} };
+void state_block::resolve_descriptor_table(pipeline_layout layout, uint32_t layout_param, root_entry& entry, uint32_t binding)
+{
+    if (!prepare_descriptor_table(layout, layout_param, entry))
+    {
+        return;
     }
-    else // Write to existing buffer index
+
+    const auto& ranges = entry.table_layout->ranges;
+
+    for (uint32_t k = 0; k < ranges.size(); ++k)
     {
-        auto& buf = constant_buffer[root_table_entry.buffer_index];
+        const descriptor_tracking::descriptor_table_layout::range& range = ranges[k];
 
-        if (buf.size() < first + count)
-        {
-            buf.resize(first + count);
-        }
+        if (binding < range.binding || binding >= range.binding + range.count)
+            continue;
 
-        for (uint32_t i = 0; i < count; i++)
-        {
-            buf[first + i] = reinterpret_cast<const uint32_t*>(values)[i];
-        }
+        const uint64_t range_bit = k < 64 ? 1ull << k : 0;
+
+        if (entry.resolved_ranges & range_bit)
+            return;
+
+        uint32_t base_offset = 0;
+        descriptor_heap heap = { 0 };
+        cmd_list_device->get_descriptor_heap_offset(entry.descriptor_table, range.binding, 0, &heap, &base_offset);
+
+        cmd_list_device->get_private_data<descriptor_tracking>().set_all_descriptors(heap, base_offset, range.count, entry.descriptors, range.binding);
+        entry.resolved_ranges |= range_bit;
+        return;
     }
 }
 
-const descriptor_tracking::descriptor_data* state_block::get_descriptor_at(uint32_t stageIndex, uint32_t layout_param, uint32_t binding) const
+const descriptor_tracking::descriptor_data* state_block::get_descriptor_at(uint32_t stageIndex, uint32_t layout_param, uint32_t binding)
 {
     if (root_tables[stageIndex].second.size() > layout_param)
     {
-        const auto& root_entry = root_tables[stageIndex].second[layout_param];
+        auto& root_entry = root_tables[stageIndex].second[layout_param];
 
-        if ((root_entry.type == root_entry_type::push_descriptors || root_entry.type == root_entry_type::descriptor_table) && root_entry.buffer_index >= 0)
+        if (root_entry.type == root_entry_type::descriptor_table && root_entry.resolve_descriptors)
         {
-            const auto& table_entry = descriptor_buffer[stageIndex][root_entry.buffer_index];
+            resolve_descriptor_table(root_tables[stageIndex].first, layout_param, root_entry, binding);
+        }
 
-            if (table_entry.size() > binding)
-            {
-                return &table_entry[binding];
-            }
+        if ((root_entry.type == root_entry_type::push_descriptors || root_entry.type == root_entry_type::descriptor_table) && root_entry.descriptors != nullptr && root_entry.count > binding)
+        {
+            return &root_entry.descriptors[binding];
         }
     }
 
@@ -602,19 +956,24 @@ const descriptor_tracking::descriptor_data* state_block::get_descriptor_at(uint3
 }
 
 
-const size_t state_block::get_root_table_entry_size_at(uint32_t stageIndex, uint32_t layout_param) const
+const size_t state_block::get_root_table_entry_size_at(uint32_t stageIndex, uint32_t layout_param)
 {
     if (root_tables[stageIndex].second.size() > layout_param)
     {
-        const auto& root_entry = root_tables[stageIndex].second[layout_param];
+        auto& root_entry = root_tables[stageIndex].second[layout_param];
+
+        if (root_entry.type == root_entry_type::descriptor_table && root_entry.resolve_descriptors)
+        {
+            prepare_descriptor_table(root_tables[stageIndex].first, layout_param, root_entry);
+        }
 
-        if ((root_entry.type == root_entry_type::push_descriptors || root_entry.type == root_entry_type::descriptor_table) && root_entry.buffer_index >= 0)
+        if ((root_entry.type == root_entry_type::push_descriptors || root_entry.type == root_entry_type::descriptor_table) && root_entry.descriptors != nullptr)
         {
-            return descriptor_buffer[stageIndex][root_entry.buffer_index].size();
+            return root_entry.count;
         }
-        else if (root_entry.type == root_entry_type::push_constants && root_entry.buffer_index >= 0)
+        else if (root_entry.type == root_entry_type::push_constants && root_entry.constants != nullptr)
         {
-            return constant_buffer[root_entry.buffer_index].size();
+            return root_entry.count;
         }
     }
 
@@ -626,19 +985,19 @@ const size_t state_block::get_root_table_size_at(uint32_t stageIndex) const
     return root_tables[stageIndex].second.size();
 }
 
-const std::vector<uint32_t>* state_block::get_constants_at(uint32_t stageIndex, uint32_t layout_param) const
+std::span<const uint32_t> state_block::get_constants_at(uint32_t stageIndex, uint32_t layout_param) const
 {
     if (root_tables[stageIndex].second.size() > layout_param)
     {
         const auto& root_entry = root_tables[stageIndex].second[layout_param];
 
-        if (root_entry.type == root_entry_type::push_constants && root_entry.buffer_index >= 0)
+        if (root_entry.type == root_entry_type::push_constants && root_entry.constants != nullptr)
         {
-            return &constant_buffer[stageIndex][root_entry.buffer_index];
+            return { root_entry.constants, root_entry.count };
         }
     }
 
-    return nullptr;
+    return {};
 }
 
 static void on_reset_command_list(command_list* cmd_list)
@@ -649,6 +1008,8 @@ static void on_reset_command_list(command_list* cmd_list)
 
 static void on_reshade_present(effect_runtime* runtime)
 {
+    state_block::end_state_call_frame();
+
     if (runtime->get_device()->get_api() != device_api::d3d12 && runtime->get_device()->get_api() != device_api::vulkan)
     {
         auto& state = runtime->get_command_queue()->get_immediate_command_list()->get_private_data<state_tracking>();
@@ -656,30 +1017,106 @@ static void on_reshade_present(effect_runtime* runtime)
     }
 }
 
+barrier_track* barrier_track_list::find(uint64_t handle)
+{
+    for (uint32_t i = 0; i < inline_count; i++)
+    {
+        if (inline_entries[i].handle == handle)
+        {
+            return &inline_entries[i].track;
+        }
+    }
+
+    for (entry& e : overflow)
+    {
+        if (e.handle == handle)
+        {
+            return &e.track;
+        }
+    }
+
+    return nullptr;
+}
+
+barrier_track& barrier_track_list::add(uint64_t handle, const barrier_track& track)
+{
+    total_count.fetch_add(1, std::memory_order_relaxed);
+
+    if (inline_count < INLINE_CAPACITY)
+    {
+        inline_entries[inline_count] = { handle, track };
+        return inline_entries[inline_count++].track;
+    }
+
+    return overflow.emplace_back(entry{ handle, track }).track;
+}
+
+void barrier_track_list::erase(uint64_t handle)
+{
+    for (uint32_t i = 0; i < inline_count; i++)
+    {
+        if (inline_entries[i].handle == handle)
+        {
+            // Keep the inline entries dense, refill the hole from the overflow first
+            if (!overflow.empty())
+            {
+                inline_entries[i] = overflow.back();
+                overflow.pop_back();
+            }
+            else
+            {
+                inline_entries[i] = inline_entries[--inline_count];
+            }
+
+            total_count.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    for (size_t i = 0; i < overflow.size(); i++)
+    {
+        if (overflow[i].handle == handle)
+        {
+            overflow[i] = overflow.back();
+            overflow.pop_back();
+
+            total_count.fetch_sub(1, std::memory_order_relaxed);
+            return;
+        }
+    }
+}
+
+void barrier_track_list::clear()
+{
+    total_count.fetch_sub(static_cast<uint32_t>(size()), std::memory_order_relaxed);
+    inline_count = 0;
+    overflow.clear();
+}
+
 void state_block::start_resource_barrier_tracking(reshade::api::resource res, reshade::api::resource_usage current_usage)
 {
-    const auto& restrack = resource_barrier_track.find(res.handle);
+    barrier_track* restrack = resource_barrier_track.find(res.handle);
 
-    if (restrack != resource_barrier_track.end())
+    if (restrack != nullptr)
     {
-        restrack->second.ref_count++;
+        restrack->ref_count++;
     }
     else
     {
-        resource_barrier_track.emplace(res.handle, barrier_track{ current_usage, 1 });
+        resource_barrier_track.add(res.handle, barrier_track{ current_usage, 1 });
     }
 }
 
 reshade::api::resource_usage state_block::stop_resource_barrier_tracking(reshade::api::resource res)
 {
-    const auto& restrack = resource_barrier_track.find(res.handle);
+    barrier_track* restrack = resource_barrier_track.find(res.handle);
 
-    if (restrack != resource_barrier_track.end())
+    if (restrack != nullptr)
     {
-        resource_usage usage = restrack->second.usage;
+        resource_usage usage = restrack->usage;
 
-        restrack->second.ref_count--;
-        if (restrack->second.ref_count <= 0)
+        restrack->ref_count--;
+        if (restrack->ref_count <= 0)
         {
             resource_barrier_track.erase(res.handle);
         }
@@ -692,16 +1129,20 @@ reshade::api::resource_usage state_block::stop_resource_barrier_tracking(reshade
 
 static void on_barrier(command_list* cmd_list, uint32_t count, const resource* resources, const resource_usage* old_states, const resource_usage* new_states)
 {
-    auto& barrier_track = cmd_list->get_private_data<state_tracking>().resource_barrier_track;
-    if (barrier_track.size() > 0)
+    // Nothing is tracked in the vast majority of barriers, don't even look up the command list data then
+    if (barrier_track_list::get_total_count() == 0)
+    {
+        return;
+    }
+
+    auto& tracked = cmd_list->get_private_data<state_tracking>().resource_barrier_track;
+    if (!tracked.empty())
     {
         for (uint32_t i = 0; i < count; i++)
         {
-            const auto& restrack = barrier_track.find(resources[i].handle);
-
-            if (restrack != barrier_track.end())
+            if (barrier_track* restrack = tracked.find(resources[i].handle))
             {
-                restrack->second.usage = new_states[i];
+                restrack->usage = new_states[i];
             }
         }
     }
@@ -710,6 +1151,8 @@ static void on_barrier(command_list* cmd_list, uint32_t count, const resource* r
 static void on_init_device(device* device)
 {
     device->create_private_data<DeviceStateTracking>();
+
+    state_tracking::add_device_api(device->get_api());
 }
 
 static void on_destroy_device(device* device)
@@ -719,34 +1162,16 @@ static void on_destroy_device(device* device)
 
 void state_tracking::register_events(bool track)
 {
-    // disable for now
-    track = false;
-
     track_descriptors = track;
     descriptor_tracking::register_events(track);
 
     reshade::register_event<reshade::addon_event::init_command_list>(on_init_command_list);
     reshade::register_event<reshade::addon_event::destroy_command_list>(on_destroy_command_list);
 
-    reshade::register_event<reshade::addon_event::bind_render_targets_and_depth_stencil>(on_bind_render_targets_and_depth_stencil);
-    reshade::register_event<reshade::addon_event::bind_pipeline>(on_bind_pipeline);
-    reshade::register_event<reshade::addon_event::bind_pipeline_states>(on_bind_pipeline_states);
-    reshade::register_event<reshade::addon_event::bind_viewports>(on_bind_viewports);
-    reshade::register_event<reshade::addon_event::bind_scissor_rects>(on_bind_scissor_rects);
     reshade::register_event<reshade::addon_event::barrier>(on_barrier);
     reshade::register_event<reshade::addon_event::reshade_present>(on_reshade_present);
 
-    reshade::register_event<reshade::addon_event::push_descriptors>(on_push_descriptors);
-    reshade::register_event<reshade::addon_event::push_constants>(on_push_constants);
-
-    if (track_descriptors)
-    {
-        reshade::register_event<reshade::addon_event::bind_descriptor_tables>(on_bind_descriptor_tables);
-    }
-    else
-    {
-        reshade::register_event<reshade::addon_event::bind_descriptor_tables>(on_bind_descriptor_tables_no_track);
-    }
+    register_state_events();
 
     reshade::register_event<reshade::addon_event::reset_command_list>(on_reset_command_list);
 
@@ -762,30 +1187,162 @@ void state_tracking::unregister_events()
     reshade::unregister_event<reshade::addon_event::init_command_list>(on_init_command_list);
     reshade::unregister_event<reshade::addon_event::destroy_command_list>(on_destroy_command_list);
 
+    reshade::unregister_event<reshade::addon_event::barrier>(on_barrier);
+    reshade::unregister_event<reshade::addon_event::reshade_present>(on_reshade_present);
+
+    unregister_state_events();
+
+    reshade::unregister_event<reshade::addon_event::reset_command_list>(on_reset_command_list);
+
+    reshade::unregister_event<reshade::addon_event::init_device>(on_init_device);
+    reshade::unregister_event<reshade::addon_event::destroy_device>(on_destroy_device);
+    reshade::unregister_event<reshade::addon_event::destroy_pipeline>(on_destroy_pipeline);
+    //reshade::unregister_event<reshade::addon_event::destroy_resource_view>(on_destroy_resource_view);
+}
+void state_tracking::set_state_events_enabled(bool enabled)
+{
+    state_events_enabled.store(enabled, std::memory_order_relaxed);
+}
+void state_tracking::register_state_events()
+{
+    if (state_events_registered)
+    {
+        return;
+    }
+
+    state_events_registered = true;
+
+    reshade::register_event<reshade::addon_event::bind_render_targets_and_depth_stencil>(on_bind_render_targets_and_depth_stencil);
+    reshade::register_event<reshade::addon_event::bind_pipeline>(on_bind_pipeline);
+    reshade::register_event<reshade::addon_event::bind_pipeline_states>(on_bind_pipeline_states);
+    reshade::register_event<reshade::addon_event::bind_viewports>(on_bind_viewports);
+    reshade::register_event<reshade::addon_event::bind_scissor_rects>(on_bind_scissor_rects);
+    reshade::register_event<reshade::addon_event::begin_render_pass>(on_begin_render_pass);
+    reshade::register_event<reshade::addon_event::draw>(on_draw);
+    reshade::register_event<reshade::addon_event::draw_indexed>(on_draw_indexed);
+    reshade::register_event<reshade::addon_event::dispatch>(on_dispatch);
+    reshade::register_event<reshade::addon_event::draw_or_dispatch_indirect>(on_draw_or_dispatch_indirect);
+    reshade::register_event<reshade::addon_event::execute_secondary_command_list>(on_execute_secondary_command_list);
+
+    std::unique_lock<std::mutex> lock(api_events_mutex);
+    register_api_events();
+}
+void state_tracking::unregister_state_events()
+{
+    if (!state_events_registered)
+    {
+        return;
+    }
+
+    state_events_registered = false;
+
     reshade::unregister_event<reshade::addon_event::bind_render_targets_and_depth_stencil>(on_bind_render_targets_and_depth_stencil);
     reshade::unregister_event<reshade::addon_event::bind_pipeline>(on_bind_pipeline);
     reshade::unregister_event<reshade::addon_event::bind_pipeline_states>(on_bind_pipeline_states);
     reshade::unregister_event<reshade::addon_event::bind_viewports>(on_bind_viewports);
     reshade::unregister_event<reshade::addon_event::bind_scissor_rects>(on_bind_scissor_rects);
-    reshade::unregister_event<reshade::addon_event::barrier>(on_barrier);
-    reshade::unregister_event<reshade::addon_event::reshade_present>(on_reshade_present);
+    reshade::unregister_event<reshade::addon_event::begin_render_pass>(on_begin_render_pass);
+    reshade::unregister_event<reshade::addon_event::draw>(on_draw);
+    reshade::unregister_event<reshade::addon_event::draw_indexed>(on_draw_indexed);
+    reshade::unregister_event<reshade::addon_event::dispatch>(on_dispatch);
+    reshade::unregister_event<reshade::addon_event::draw_or_dispatch_indirect>(on_draw_or_dispatch_indirect);
+    reshade::unregister_event<reshade::addon_event::execute_secondary_command_list>(on_execute_secondary_command_list);
+
+    std::unique_lock<std::mutex> lock(api_events_mutex);
+    unregister_api_events();
+}
 
-    reshade::unregister_event<reshade::addon_event::push_descriptors>(on_push_descriptors);
-    reshade::unregister_event<reshade::addon_event::push_constants>(on_push_constants);
+template<typename api_traits>
+static void register_family_events(bool track_descriptors)
+{
+    reshade::register_event<reshade::addon_event::push_descriptors>(on_push_descriptors<api_traits>);
+    reshade::register_event<reshade::addon_event::push_constants>(on_push_constants<api_traits>);
 
-    if (track_descriptors)
+    if constexpr (api_traits::binds_descriptor_tables)
     {
-        reshade::unregister_event<reshade::addon_event::bind_descriptor_tables>(on_bind_descriptor_tables);
+        if (track_descriptors)
+            reshade::register_event<reshade::addon_event::bind_descriptor_tables>(on_bind_descriptor_tables<true>);
+        else
+            reshade::register_event<reshade::addon_event::bind_descriptor_tables>(on_bind_descriptor_tables<false>);
     }
-    else
+}
+template<typename api_traits>
+static void unregister_family_events(bool track_descriptors)
+{
+    reshade::unregister_event<reshade::addon_event::push_descriptors>(on_push_descriptors<api_traits>);
+    reshade::unregister_event<reshade::addon_event::push_constants>(on_push_constants<api_traits>);
+
+    if constexpr (api_traits::binds_descriptor_tables)
     {
-        reshade::unregister_event<reshade::addon_event::bind_descriptor_tables>(on_bind_descriptor_tables_no_track);
+        if (track_descriptors)
+            reshade::unregister_event<reshade::addon_event::bind_descriptor_tables>(on_bind_descriptor_tables<true>);
+        else
+            reshade::unregister_event<reshade::addon_event::bind_descriptor_tables>(on_bind_descriptor_tables<false>);
     }
+}
 
-    reshade::unregister_event<reshade::addon_event::reset_command_list>(on_reset_command_list);
+void state_tracking::register_api_events()
+{
+    switch (device_api_family)
+    {
+    case api_family::immediate:
+        register_family_events<immediate_api_traits>(track_descriptors);
+        break;
+    case api_family::explicit_descriptors:
+        register_family_events<explicit_api_traits>(track_descriptors);
+        break;
+    case api_family::mixed:
+        register_family_events<mixed_api_traits>(track_descriptors);
+        break;
+    default:
+        // No device yet, registered once the first one is created
+        break;
+    }
+}
+void state_tracking::unregister_api_events()
+{
+    switch (device_api_family)
+    {
+    case api_family::immediate:
+        unregister_family_events<immediate_api_traits>(track_descriptors);
+        break;
+    case api_family::explicit_descriptors:
+        unregister_family_events<explicit_api_traits>(track_descriptors);
+        break;
+    case api_family::mixed:
+        unregister_family_events<mixed_api_traits>(track_descriptors);
+        break;
+    default:
+        break;
+    }
+}
 
-    reshade::unregister_event<reshade::addon_event::init_device>(on_init_device);
-    reshade::unregister_event<reshade::addon_event::destroy_device>(on_destroy_device);
-    reshade::unregister_event<reshade::addon_event::destroy_pipeline>(on_destroy_pipeline);
-    //reshade::unregister_event<reshade::addon_event::destroy_resource_view>(on_destroy_resource_view);
+void state_tracking::add_device_api(device_api api)
+{
+    const api_family family = api == device_api::d3d12 || api == device_api::vulkan ? api_family::explicit_descriptors : api_family::immediate;
+
+    std::unique_lock<std::mutex> lock(api_events_mutex);
+
+    const api_family combined = device_api_family == api_family::none || device_api_family == family ? family : api_family::mixed;
+
+    if (combined == device_api_family)
+    {
+        return;
+    }
+
+    // ReShade doesn't synchronize its event lists. The first device registers its family before anything is recorded on it. A device of
+    // the other family swaps in the mixed callbacks, unregistering first so the push lists keep their size while other threads walk them,
+    // bind_descriptor_tables only gets added when none of the devices so far could raise it. A push on another thread right in between
+    // isn't captured.
+    if (state_events_registered)
+    {
+        unregister_api_events();
+    }
+
+    device_api_family = combined;
+
+    if (state_events_registered)
+    {
+        register_api_events();
+    }
 }
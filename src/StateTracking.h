@@ -7,11 +7,17 @@
 
 #include <vector>
 #include <array>
+#include <span>
+#include <memory>
+#include <cstddef>
 #include <unordered_map>
+#include <mutex>
 #include <shared_mutex>
 #include <unordered_set>
+#include <atomic>
 #include <d3d9.h>
 #include "DescriptorTracking.h"
+#include "SnapshotArena.h"
 
  /// <summary>
  /// A state block capturing current state of a command list.
@@ -52,6 +58,47 @@ namespace StateTracking
         int32_t ref_count = 0;
     };
 
+    /// <summary>
+    /// The resources of which barriers are followed on a command list. Only a few resources are tracked at a time, so they're kept in an
+    /// inline array which is searched linearly and only spills into the heap when it overflows.
+    /// </summary>
+    class barrier_track_list
+    {
+    public:
+        barrier_track_list() = default;
+        barrier_track_list(const barrier_track_list&) = delete;
+        barrier_track_list& operator=(const barrier_track_list&) = delete;
+        ~barrier_track_list() { clear(); }
+
+        barrier_track* find(uint64_t handle);
+        barrier_track& add(uint64_t handle, const barrier_track& track);
+        void erase(uint64_t handle);
+        void clear();
+
+        bool empty() const { return inline_count == 0; }
+        size_t size() const { return inline_count + overflow.size(); }
+
+        /// <summary>
+        /// Number of resources tracked by all command lists, lets barriers skip looking up the command list data while it's 0.
+        /// </summary>
+        static uint32_t get_total_count() { return total_count.load(std::memory_order_relaxed); }
+
+    private:
+        static constexpr uint32_t INLINE_CAPACITY = 4;
+
+        struct entry
+        {
+            uint64_t handle = 0;
+            barrier_track track;
+        };
+
+        std::array<entry, INLINE_CAPACITY> inline_entries;
+        uint32_t inline_count = 0;
+        std::vector<entry> overflow;    // only used once the inline entries are all taken
+
+        static std::atomic<uint32_t> total_count;
+    };
+
     enum class root_entry_type : int32_t
     {
         undefined = -1,
@@ -63,15 +110,64 @@ namespace StateTracking
 
     struct root_entry
     {
-        constexpr root_entry() : type(root_entry_type::undefined), buffer_index(-1), descriptor_table({ 0 }) {}
-        constexpr root_entry(root_entry_type t, int32_t index, const reshade::api::descriptor_table& table) : type(t), buffer_index(index), descriptor_table(table) {}
-        constexpr root_entry(const reshade::api::descriptor_table& table) : type(root_entry_type::descriptor_table), buffer_index(-1), descriptor_table(table) {}
+        constexpr root_entry() : type(root_entry_type::undefined), descriptor_table({ 0 }) {}
+        constexpr root_entry(const reshade::api::descriptor_table& table) : type(root_entry_type::descriptor_table), descriptor_table(table) {}
 
         root_entry_type type = root_entry_type::undefined;
-        int32_t buffer_index = -1;;
+        bool resolve_descriptors = false;   // descriptor table of which the descriptors are copied from the heap mirror on first read
+        uint32_t count = 0;     // number of captured descriptors or 32-bit constants
+        uint32_t capacity = 0;
+        uint64_t resolved_ranges = 0;       // bit per descriptor range of the table which was copied already
+        descriptor_tracking::descriptor_data* descriptors = nullptr;    // span in the snapshot arena of the command list
+        uint32_t* constants = nullptr;                                  // span in the snapshot arena of the command list
+        const descriptor_tracking::descriptor_table_layout* table_layout = nullptr;    // set once the descriptor table is first read
         reshade::api::descriptor_table descriptor_table = {};
     };
 
+    constexpr uint32_t TRACKED_SHADER_STAGES_SIZE = 3;
+
+    /// <summary>
+    /// The layout params (slots) per shader stage index (pixel, vertex, compute) of which the descriptors and constants are read through
+    /// <see cref="state_block::get_descriptor_at"/> and <see cref="state_block::get_constants_at"/>. Readers clamp the slot to the
+    /// size of the root table, so the highest slot of a stage is kept as well.
+    /// </summary>
+    struct tracking_interest
+    {
+        std::array<uint64_t, TRACKED_SHADER_STAGES_SIZE> slots = {};
+        std::array<int32_t, TRACKED_SHADER_STAGES_SIZE> max_slot = { -1, -1, -1 };
+
+        void add(uint32_t stage_index, uint32_t slot);
+
+        bool operator==(const tracking_interest& other) const = default;
+    };
+
+    /// <summary>
+    /// Groups of state which are restored by <see cref="state_block::apply"/>. Callers which only change some of them pass those to
+    /// <see cref="state_block::capture"/>, so apply leaves the others alone. <see cref="state_block::apply_deferred"/> also leaves the
+    /// ones alone which the game rebinds itself before it depends on them.
+    /// </summary>
+    enum state_category : uint32_t
+    {
+        state_category_none = 0,
+        state_category_render_targets = 1 << 0,
+        state_category_graphics_pipeline = 1 << 1,
+        state_category_compute_pipeline = 1 << 2,
+        state_category_dynamic_states = 1 << 3,     // topology, blend constant, sample mask and stencil reference values
+        state_category_viewports = 1 << 4,
+        state_category_scissor_rects = 1 << 5,
+        state_category_graphics_descriptors = 1 << 6,
+        state_category_compute_descriptors = 1 << 7,
+        state_category_all = (1 << 8) - 1
+    };
+
+    struct state_call_count
+    {
+        uint32_t issued = 0;
+        uint32_t saved = 0;
+
+        void add(bool issue) { issue ? issued++ : saved++; }
+    };
+
     struct state_block
     {
         /// <summary>
@@ -79,22 +175,57 @@ namespace StateTracking
         /// </summary>
         /// <param name="cmd_list">Target command list to bind the state on.</param>
 
-        void capture(reshade::api::command_list* cmd_list, bool force_restore = false);
+        /// <summary>
+        /// Prepares restoring the state after rendering. categories are the state categories the caller is going to change, apply
+        /// only re-issues those.
+        /// </summary>
+        void capture(reshade::api::command_list* cmd_list, bool force_restore = false, uint32_t categories = state_category_all);
 
         void apply(reshade::api::command_list* cmd_list, bool force_restore = false);
+        /// <summary>
+        /// Restores the state categories rendering changed once the game depends on them, right before its next draw, dispatch, bundle
+        /// or descriptor binding on the command list. Categories the game binds completely itself before that are dropped by
+        /// <see cref="state_block::discard_deferred"/> and never restored. Only d3d12 and Vulkan defer, the other APIs apply right away.
+        /// </summary>
+        void apply_deferred(reshade::api::command_list* cmd_list, uint32_t categories = state_category_all);
+        void flush_deferred(reshade::api::command_list* cmd_list);
+        void discard_deferred(uint32_t categories);
+        static bool has_deferred() { return deferred_block_count.load(std::memory_order_relaxed) != 0; }
         void apply_dx9(reshade::api::command_list* cmd_list, bool force_restore);
         void apply_default(reshade::api::command_list* cmd_list, bool force_restore) const;
 
-        void apply_descriptors_dx12_vulkan(reshade::api::command_list* cmd_list) const;
-        void apply_descriptors(reshade::api::command_list* cmd_list) const;
+        void apply_descriptors_dx12_vulkan(reshade::api::command_list* cmd_list, uint32_t dirty, state_call_count& calls) const;
+        void apply_descriptors(reshade::api::command_list* cmd_list, uint32_t dirty, state_call_count& calls) const;
+
+        /// <summary>
+        /// Number of state calls apply issued and skipped because their category wasn't touched, over the last frame.
+        /// </summary>
+        static state_call_count get_state_call_stats();
+        static void end_state_call_frame();
 
         void start_resource_barrier_tracking(reshade::api::resource res, reshade::api::resource_usage current_usage);
         reshade::api::resource_usage stop_resource_barrier_tracking(reshade::api::resource res);
 
-        const descriptor_tracking::descriptor_data* get_descriptor_at(uint32_t stageIndex, uint32_t layout_param, uint32_t binding) const;
-        const size_t get_root_table_entry_size_at(uint32_t stageIndex, uint32_t layout_param) const;
+        /// <summary>
+        /// Returns the descriptor bound at binding of layout_param. Descriptors of bound tables are copied from the heap mirror the first
+        /// time a binding of their range is read and kept until the table is bound again.
+        /// </summary>
+        const descriptor_tracking::descriptor_data* get_descriptor_at(uint32_t stageIndex, uint32_t layout_param, uint32_t binding);
+        const size_t get_root_table_entry_size_at(uint32_t stageIndex, uint32_t layout_param);
         const size_t get_root_table_size_at(uint32_t stageIndex) const;
-        const std::vector<uint32_t>* get_constants_at(uint32_t stageIndex, uint32_t layout_param) const;
+        std::span<const uint32_t> get_constants_at(uint32_t stageIndex, uint32_t layout_param) const;
+
+        /// <summary>
+        /// Records pushed descriptors or constants of the shader stage index. They're captured if a group reads layout_param or restored
+        /// is true, otherwise only the root table entry is kept. The push_descriptors and push_constants events end up here.
+        /// </summary>
+        void push_descriptors(int32_t stage_index, reshade::api::shader_stage stages, reshade::api::pipeline_layout layout, uint32_t layout_param, const reshade::api::descriptor_table_update& update, bool restored);
+        void push_constants(int32_t stage_index, reshade::api::shader_stage stages, reshade::api::pipeline_layout layout, uint32_t layout_param, uint32_t first, uint32_t count, const void* values, bool restored);
+
+        descriptor_tracking::descriptor_data* allocate_descriptors(root_entry& entry, uint32_t count);
+        bool prepare_descriptor_table(reshade::api::pipeline_layout layout, uint32_t layout_param, root_entry& entry);
+        void resolve_descriptor_table(reshade::api::pipeline_layout layout, uint32_t layout_param, root_entry& entry, uint32_t binding);
+        uint32_t* allocate_constants(root_entry& entry, uint32_t count);
 
         /// <summary>
         /// Removes all state in this state block.
@@ -116,12 +247,25 @@ namespace StateTracking
 
         std::array<std::pair<reshade::api::pipeline_layout, std::vector<root_entry>>, ALL_SHADER_STAGES_SIZE> root_tables;
         std::array<reshade::api::shader_stage, ALL_SHADER_STAGES_SIZE> root_table_stages;
-        std::array<std::vector<std::vector<uint32_t>>, ALL_SHADER_STAGES_SIZE> constant_buffer;
-        std::array<std::vector<std::vector<descriptor_tracking::descriptor_data>>, ALL_SHADER_STAGES_SIZE> descriptor_buffer;
 
-        std::unordered_map<uint64_t, barrier_track> resource_barrier_track;
+        // Snapshots live in one arena until the command list is reset. The immediate command list of d3d9-11 is never reset, so at
+        // present its live snapshots are moved into the other arena and the current one is reset.
+        std::array<snapshot_arena, 2> snapshot_arenas;
+        uint32_t current_arena = 0;
+
+        barrier_track_list resource_barrier_track;
 
         IDirect3DStateBlock9* dx_state;
+        uint32_t dirty_categories = state_category_all;     // categories apply restores, set by capture
+        uint32_t deferred_categories = state_category_none; // categories apply_deferred still has to restore
+
+        static std::atomic<uint32_t> deferred_block_count;  // state blocks with deferred categories, the draw events only look up their state block if non zero
+
+        static std::atomic<uint32_t> state_calls_issued;
+        static std::atomic<uint32_t> state_calls_saved;
+        static std::atomic<uint32_t> last_frame_state_calls_issued;
+        static std::atomic<uint32_t> last_frame_state_calls_saved;
+        reshade::api::device* cmd_list_device = nullptr;
     };
 
     struct __declspec(uuid("EE0C0141-E361-42E5-AF64-25F2F677F37F")) DeviceStateTracking {
@@ -144,6 +288,46 @@ public:
     /// Unregisters all the necessary add-on events for state tracking to work.
     /// </summary>
     static void unregister_events();
+    /// <summary>
+    /// Enables or disables the events which track the per draw call state (render targets, pipelines, descriptors, constants...). They stay
+    /// registered, as the event lists can't be changed while other threads record command lists, but return right away while disabled.
+    /// </summary>
+    static void set_state_events_enabled(bool enabled);
+    static bool is_enabled() { return state_events_enabled.load(std::memory_order_relaxed); }
+    /// <summary>
+    /// Sets the slots of which descriptors and constants are captured, everything else only has its root table entry tracked for restoring.
+    /// Pixel slots 0 and 1 of d3d9-11 are captured regardless, they're restored after the addon's own passes.
+    /// </summary>
+    static void set_interest(const StateTracking::tracking_interest& interest);
+    /// <summary>
+    /// Returns true if descriptors or constants bound to layout_param of the shader stage index have to be captured.
+    /// </summary>
+    static bool is_tracked(int32_t stage_index, uint32_t layout_param, size_t root_table_size);
+
+    enum class api_family : uint32_t
+    {
+        none,
+        immediate,              // d3d9, d3d10, d3d11 and OpenGL
+        explicit_descriptors,   // d3d12 and Vulkan
+        mixed
+    };
+
+    /// <summary>
+    /// Widens the API family with the one of a newly created device and registers the descriptor and constant callbacks instantiated for
+    /// it in place of the ones of the previous family.
+    /// </summary>
+    static void add_device_api(reshade::api::device_api api);
 private:
+    static void register_state_events();
+    static void unregister_state_events();
+    static void register_api_events();
+    static void unregister_api_events();
+
     static bool track_descriptors;
+    static bool state_events_registered;
+    static std::atomic<bool> state_events_enabled;
+    static api_family device_api_family;
+    static std::mutex api_events_mutex;
+    static std::array<std::atomic<uint64_t>, StateTracking::TRACKED_SHADER_STAGES_SIZE> tracked_slots;
+    static std::array<std::atomic<int32_t>, StateTracking::TRACKED_SHADER_STAGES_SIZE> tracked_max_slot;
 };
@@ -31,6 +31,7 @@
 /////////////////////////////////////////////////////////////////////////
 
 #include <sstream>
+#include <algorithm>
 #include "stdafx.h"
 #include "ToggleGroup.h"
 
@@ -85,6 +86,7 @@ namespace ShaderToggler
         _cbSlotIndex = other._cbSlotIndex;
         _cbDescIndex = other._cbDescIndex;
         _cbShaderStage = other._cbShaderStage;
+        _cbReadbackLatency = other._cbReadbackLatency;
         _bindingInvocationLocation = other._bindingInvocationLocation;
         _bindingRTIndex = other._bindingRTIndex;
         _bindingSrvSlotIndex = other._bindingSrvSlotIndex;
@@ -112,6 +114,8 @@ namespace ShaderToggler
         _preferredTechniques = other._preferredTechniques;
         _preferredTechniqueData = other._preferredTechniqueData;
         _varOffsetMapping = other._varOffsetMapping;
+        _constantReadSpans = other._constantReadSpans;
+        _varMappingVersion = other._varMappingVersion;
         _cbCycle = other._cbCycle;
         _srvCycle = other._srvCycle;
         _rtCycle = other._rtCycle;
@@ -218,6 +222,7 @@ namespace ShaderToggler
     bool ToggleGroup::SetVarMapping(uintptr_t offset, string& variable, bool prev)
     {
         _varOffsetMapping.emplace(variable, make_tuple(offset, prev));
+        OnVarMappingChanged();
 
         return true; // do some sanity checking?
     }
@@ -226,11 +231,41 @@ namespace ShaderToggler
     bool ToggleGroup::RemoveVarMapping(string& variable)
     {
         _varOffsetMapping.erase(variable);
+        OnVarMappingChanged();
 
         return true; // do some sanity checking?
     }
 
 
+    void ToggleGroup::OnVarMappingChanged()
+    {
+        _varMappingVersion++;
+
+        vector<uint32_t> offsets;
+        offsets.reserve(_varOffsetMapping.size());
+        for (const auto& [varName, varData] : _varOffsetMapping)
+        {
+            offsets.push_back(static_cast<uint32_t>(get<0>(varData)));
+        }
+        sort(offsets.begin(), offsets.end());
+
+        // The variable types aren't known here, so every variable is assumed to be as large as the largest type
+        _constantReadSpans.clear();
+        for (const uint32_t offset : offsets)
+        {
+            if (!_constantReadSpans.empty() && offset <= _constantReadSpans.back().offset + _constantReadSpans.back().size + CONSTANT_SPAN_MERGE_DISTANCE)
+            {
+                ConstantSpan& span = _constantReadSpans.back();
+                span.size = std::max(span.size, offset + CONSTANT_SPAN_VARIABLE_SIZE - span.offset);
+            }
+            else
+            {
+                _constantReadSpans.push_back({ offset, CONSTANT_SPAN_VARIABLE_SIZE });
+            }
+        }
+    }
+
+
     void ToggleGroup::saveState(CDataFile& iniFile, int groupCounter) const
     {
         const string sectionRoot = "Group" + std::to_string(groupCounter);
@@ -315,6 +350,7 @@ namespace ShaderToggler
         iniFile.SetUInt("ConstantDescriptorIndex", _cbDescIndex, "", sectionRoot);
         iniFile.SetBool("ConstantPushMode", _cbModePush, "", sectionRoot);
         iniFile.SetUInt("ConstantShaderStage", _cbShaderStage, "", sectionRoot);
+        iniFile.SetUInt("ConstantReadbackLatency", _cbReadbackLatency, "", sectionRoot);
 
         iniFile.SetBool("ExtractSRVs", _extractResourceViews, "", sectionRoot);
         iniFile.SetUInt("SRVPipelineSlot", _bindingSrvSlotIndex, "", sectionRoot);
@@ -433,6 +469,7 @@ namespace ShaderToggler
                 _varOffsetMapping.emplace(varName, make_tuple(offset, prevValue));
             }
         }
+        OnVarMappingChanged();
 
         _name = iniFile.GetValue("Name", sectionRoot);
         if (_name.size() <= 0)
@@ -521,6 +558,16 @@ namespace ShaderToggler
             _cbShaderStage = 0;
         }
 
+        uint32_t readbackLatency = iniFile.GetUInt("ConstantReadbackLatency", sectionRoot);
+        if (readbackLatency != UINT_MAX && readbackLatency <= MAX_CB_READBACK_LATENCY)
+        {
+            _cbReadbackLatency = readbackLatency;
+        }
+        else
+        {
+            _cbReadbackLatency = 0;
+        }
+
         _extractResourceViews = iniFile.GetBool("ExtractSRVs", sectionRoot);
 
         uint32_t srvSlotIndex = iniFile.GetUInt("SRVPipelineSlot", sectionRoot);
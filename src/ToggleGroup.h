@@ -35,6 +35,7 @@
 #include <unordered_set>
 #include <unordered_map>
 #include <array>
+#include <vector>
 #include <functional>
 
 #include "reshade.hpp"
@@ -76,6 +77,16 @@ namespace ShaderToggler
     };
 
     constexpr uint32_t GroupResourceTypeCount = 3;
+    constexpr uint32_t MAX_CB_READBACK_LATENCY = 3;
+
+    /// <summary>
+    /// Byte range of a constant buffer which has to be read to get the values of the variables mapped to it.
+    /// </summary>
+    struct ConstantSpan
+    {
+        uint32_t offset;
+        uint32_t size;
+    };
 
     struct __declspec(novtable) GroupResource final
     {
@@ -159,6 +170,8 @@ namespace ShaderToggler
         void setExtractConstant(bool extract) { _extractConstants = extract; }
         uint32_t getCBShaderStage() const { return _cbShaderStage; }
         void setCBShaderStage(uint32_t shaderStage) { _cbShaderStage = shaderStage; }
+        uint32_t getCBReadbackLatency() const { return _cbReadbackLatency; }
+        void setCBReadbackLatency(uint32_t latency) { _cbReadbackLatency = latency; }
         bool getExtractResourceViews() const { return _extractResourceViews; }
         void setExtractResourceViews(bool extract) { _extractResourceViews = extract; }
         bool getRenderToResourceViews() const { return _renderToResourceViews; }
@@ -190,6 +203,14 @@ namespace ShaderToggler
         const std::unordered_map<std::string, std::tuple<uintptr_t, bool>>& GetVarOffsetMapping() const { return _varOffsetMapping; }
         bool SetVarMapping(uintptr_t, std::string&, bool);
         bool RemoveVarMapping(std::string&);
+        /// <summary>
+        /// Sorted, non-overlapping byte ranges covering all mapped variables, nearby variables share a range.
+        /// </summary>
+        const std::vector<ConstantSpan>& GetConstantReadSpans() const { return _constantReadSpans; }
+        /// <summary>
+        /// Changes every time a variable mapping is added or removed.
+        /// </summary>
+        uint32_t GetVarMappingVersion() const { return _varMappingVersion; }
         bool getClearPreviewAlpha() const { return _previewClearAlpha; }
         void setClearPreviewAlpha(bool previewClearAlpha) { _previewClearAlpha = previewClearAlpha; }
         bool getToneMap() const { return _tonemapHDRtoSDRtoHDR; }
@@ -237,6 +258,11 @@ namespace ShaderToggler
         const std::unordered_set<EffectData*>& GetPreferredTechniqueData();
 
     private:
+        static constexpr uint32_t CONSTANT_SPAN_VARIABLE_SIZE = 64;	// size of the largest variable type, float4x4
+        static constexpr uint32_t CONSTANT_SPAN_MERGE_DISTANCE = 256;
+
+        void OnVarMappingChanged();
+
         int _id;
         std::string	_name;
         uint32_t _keybind;
@@ -248,6 +274,7 @@ namespace ShaderToggler
         uint32_t _cbSlotIndex = 2;
         uint32_t _cbDescIndex = 0;
         uint32_t _cbShaderStage = 0;
+        uint32_t _cbReadbackLatency = 0;	// frames between copying a constant buffer on the GPU and reading it back (GPU readback mode only)
         uint32_t _bindingInvocationLocation = 0;
         uint32_t _bindingRTIndex = 0;
         uint32_t _bindingSrvSlotIndex = 1;
@@ -279,6 +306,8 @@ namespace ShaderToggler
         std::unordered_set<std::string> _preferredTechniques;
         std::unordered_set<EffectData*> _preferredTechniqueData;
         std::unordered_map<std::string, std::tuple<uintptr_t, bool>> _varOffsetMapping;
+        std::vector<ConstantSpan> _constantReadSpans;
+        uint32_t _varMappingVersion = 0;
         DescriptorCycle _cbCycle;
         DescriptorCycle _srvCycle;
         DescriptorCycle _rtCycle;
@@ -0,0 +1,204 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Part of ShaderToggler, a shader toggler add on for Reshade 5+ which allows you
+// to define groups of shaders to toggle them on/off with one key press
+// 
+// (c) Frans 'Otis_Inf' Bouma.
+//
+// All rights reserved.
+// https://github.com/FransBouma/ShaderToggler
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met :
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+//	  list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and / or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+/////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#include <emmintrin.h>
+#define TOGGLE_GROUP_INDEX_SSE2 1
+#endif
+#include "ToggleGroupIndex.h"
+
+using namespace ShaderToggler;
+using namespace std;
+
+static inline size_t mixShaderHash(uint32_t shaderHash)
+{
+    return static_cast<size_t>((static_cast<uint64_t>(shaderHash) * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+ShaderGroupTable::ShaderGroupTable(size_t maxHashCount, uint32_t wordCount) : _wordCount(wordCount)
+{
+    // keep the load factor at or below 50%
+    size_t probeGroups = 1;
+    while (probeGroups * PROBE_WIDTH < maxHashCount * 2)
+    {
+        probeGroups *= 2;
+    }
+
+    _probeGroupMask = probeGroups - 1;
+    _keys.assign(probeGroups * PROBE_WIDTH, 0);
+    _bitsetOffsets.assign(probeGroups * PROBE_WIDTH, 0);
+    _bitsets.reserve(maxHashCount * wordCount);
+
+    size_t filterWords = 1;
+    while (filterWords * 64 < maxHashCount * FILTER_BITS_PER_HASH)
+    {
+        filterWords *= 2;
+    }
+
+    _filterMask = filterWords - 1;
+    _filter.assign(filterWords, 0);
+}
+
+ShaderGroupTable& ShaderGroupTable::operator=(ShaderGroupTable&& other) noexcept
+{
+    _keys = std::move(other._keys);
+    _bitsetOffsets = std::move(other._bitsetOffsets);
+    _bitsets = std::move(other._bitsets);
+    _probeGroupMask = other._probeGroupMask;
+    _hashCount = other._hashCount;
+    _wordCount = other._wordCount;
+    _filter = std::move(other._filter);
+    _filterMask = other._filterMask;
+    _filterRejects.store(other._filterRejects.load(memory_order_relaxed), memory_order_relaxed);
+    _filterFalsePositives.store(other._filterFalsePositives.load(memory_order_relaxed), memory_order_relaxed);
+
+    return *this;
+}
+
+size_t ShaderGroupTable::FindSlot(uint32_t shaderHash) const
+{
+    // Returns the slot holding shaderHash, or the empty slot it would be inserted in
+    size_t group = mixShaderHash(shaderHash) & _probeGroupMask;
+
+    for (size_t probes = 0; probes <= _probeGroupMask; probes++, group = (group + 1) & _probeGroupMask)
+    {
+        const uint32_t* keys = &_keys[group * PROBE_WIDTH];
+
+#ifdef TOGGLE_GROUP_INDEX_SSE2
+        const __m128i k = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys));
+        const int matches = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(k, _mm_set1_epi32(static_cast<int>(shaderHash)))));
+        const int empties = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(k, _mm_setzero_si128())));
+
+        if (matches != 0)
+        {
+            return group * PROBE_WIDTH + countr_zero(static_cast<uint32_t>(matches));
+        }
+
+        if (empties != 0)
+        {
+            return group * PROBE_WIDTH + countr_zero(static_cast<uint32_t>(empties));
+        }
+#else
+        for (size_t i = 0; i < PROBE_WIDTH; i++)
+        {
+            if (keys[i] == shaderHash || keys[i] == 0)
+            {
+                return group * PROBE_WIDTH + i;
+            }
+        }
+#endif
+    }
+
+    return SIZE_MAX;
+}
+
+void ShaderGroupTable::Add(uint32_t shaderHash, uint32_t groupIndex)
+{
+    if (shaderHash == 0 || _keys.size() == 0)
+    {
+        return;
+    }
+
+    const size_t slot = FindSlot(shaderHash);
+    if (slot == SIZE_MAX)
+    {
+        return;
+    }
+
+    if (_keys[slot] == 0)
+    {
+        _keys[slot] = shaderHash;
+        _bitsetOffsets[slot] = static_cast<uint32_t>(_bitsets.size());
+        _bitsets.resize(_bitsets.size() + _wordCount, 0);
+        _hashCount++;
+
+        const uint64_t mixed = static_cast<uint64_t>(shaderHash) * 0xC2B2AE3D27D4EB4Full;
+        _filter[(mixed >> 32) & _filterMask] |= FilterBits(mixed);
+    }
+
+    _bitsets[_bitsetOffsets[slot] + groupIndex / 64] |= 1ull << (groupIndex % 64);
+}
+
+const uint64_t* ShaderGroupTable::Find(uint32_t shaderHash) const
+{
+    if (shaderHash == 0 || _hashCount == 0)
+    {
+        return nullptr;
+    }
+
+    if (!MayContain(shaderHash))
+    {
+        _filterRejects.fetch_add(1, memory_order_relaxed);
+        return nullptr;
+    }
+
+    const size_t slot = FindSlot(shaderHash);
+    if (slot == SIZE_MAX || _keys[slot] != shaderHash)
+    {
+        _filterFalsePositives.fetch_add(1, memory_order_relaxed);
+        return nullptr;
+    }
+
+    return &_bitsets[_bitsetOffsets[slot]];
+}
+
+ToggleGroupIndex::ToggleGroupIndex(uint32_t epoch, vector<ToggleGroup*>&& groups, const array<size_t, 3>& maxHashCounts) :
+    _epoch(epoch),
+    _wordCount(std::max(static_cast<uint32_t>((groups.size() + 63) / 64), 1u)),
+    _groups(std::move(groups)),
+    _activeGroups(new atomic<uint64_t>[_wordCount])
+{
+    for (uint32_t i = 0; i < _shaderGroups.size(); i++)
+    {
+        _shaderGroups[i] = ShaderGroupTable(maxHashCounts[i], _wordCount);
+    }
+
+    UpdateActiveGroups();
+}
+
+void ToggleGroupIndex::UpdateActiveGroups()
+{
+    for (uint32_t w = 0; w < _wordCount; w++)
+    {
+        uint64_t bits = 0;
+
+        for (uint32_t i = w * 64; i < std::min(static_cast<uint32_t>(_groups.size()), (w + 1) * 64); i++)
+        {
+            if (_groups[i]->isActive())
+            {
+                bits |= 1ull << (i % 64);
+            }
+        }
+
+        _activeGroups[w].store(bits, memory_order_relaxed);
+    }
+}
@@ -0,0 +1,197 @@
+///////////////////////////////////////////////////////////////////////
+//
+// Part of ShaderToggler, a shader toggler add on for Reshade 5+ which allows you
+// to define groups of shaders to toggle them on/off with one key press
+// 
+// (c) Frans 'Otis_Inf' Bouma.
+//
+// All rights reserved.
+// https://github.com/FransBouma/ShaderToggler
+//
+// Redistribution and use in source and binary forms, with or without
+// modification, are permitted provided that the following conditions are met :
+//
+//  * Redistributions of source code must retain the above copyright notice, this
+//	  list of conditions and the following disclaimer.
+//
+//  * Redistributions in binary form must reproduce the above copyright notice,
+//    this list of conditions and the following disclaimer in the documentation
+//    and / or other materials provided with the distribution.
+//
+// THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+// AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+// IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+// DISCLAIMED.IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE
+// FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+// DAMAGES(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+// SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+// CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+// OR TORT(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+// OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+/////////////////////////////////////////////////////////////////////////
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <vector>
+#include "ToggleGroup.h"
+
+namespace ShaderToggler
+{
+    /// <summary>
+    /// Flat, power of two sized open addressing table which maps a shader hash to a bitset of dense toggle group indices. Slots are probed in
+    /// groups of four keys with a single SSE2 compare. Built once and never modified afterwards, so it has no tombstones and can be read
+    /// without any locking. Shader hash 0 is used as the empty marker, which is fine as hash 0 is never registered.
+    /// Lookups first go through a blocked Bloom filter (one 64-bit word per hash) so the common case of a shader which isn't part of any
+    /// group is rejected with a single load.
+    /// </summary>
+    class __declspec(novtable) ShaderGroupTable final
+    {
+    public:
+        ShaderGroupTable() = default;
+        ShaderGroupTable(size_t maxHashCount, uint32_t wordCount);
+        ShaderGroupTable& operator=(ShaderGroupTable&& other) noexcept;
+
+        /// <summary>
+        /// Marks shaderHash as member of the group with the passed in dense index. Only valid while building the table.
+        /// </summary>
+        void Add(uint32_t shaderHash, uint32_t groupIndex);
+
+        /// <summary>
+        /// Returns the group bitset for shaderHash, nullptr if the hash isn't part of any group.
+        /// </summary>
+        const uint64_t* Find(uint32_t shaderHash) const;
+
+        /// <summary>
+        /// Returns false if shaderHash is definitely not in the table.
+        /// </summary>
+        bool MayContain(uint32_t shaderHash) const
+        {
+            const uint64_t mixed = static_cast<uint64_t>(shaderHash) * 0xC2B2AE3D27D4EB4Full;
+            const uint64_t bits = FilterBits(mixed);
+            return (_filter[(mixed >> 32) & _filterMask] & bits) == bits;
+        }
+
+        size_t GetHashCount() const { return _hashCount; }
+        uint64_t GetFilterRejectCount() const { return _filterRejects.load(std::memory_order_relaxed); }
+        uint64_t GetFilterFalsePositiveCount() const { return _filterFalsePositives.load(std::memory_order_relaxed); }
+
+        /// <summary>
+        /// Measured false positive rate of the filter: lookups of hashes not in the table which the filter let through.
+        /// </summary>
+        double GetFilterFalsePositiveRate() const
+        {
+            const uint64_t falsePositives = GetFilterFalsePositiveCount();
+            const uint64_t negatives = falsePositives + GetFilterRejectCount();
+            return negatives > 0 ? static_cast<double>(falsePositives) / static_cast<double>(negatives) : 0.0;
+        }
+
+    private:
+        static constexpr size_t PROBE_WIDTH = 4;
+        static constexpr size_t FILTER_BITS_PER_HASH = 16;
+
+        static uint64_t FilterBits(uint64_t mixed)
+        {
+            return (1ull << (mixed & 63)) | (1ull << ((mixed >> 6) & 63)) | (1ull << ((mixed >> 12) & 63));
+        }
+
+        size_t FindSlot(uint32_t shaderHash) const;
+
+        std::vector<uint32_t> _keys;
+        std::vector<uint32_t> _bitsetOffsets;
+        std::vector<uint64_t> _bitsets;
+        size_t _probeGroupMask = 0;
+        size_t _hashCount = 0;
+        uint32_t _wordCount = 0;
+
+        std::vector<uint64_t> _filter = std::vector<uint64_t>(1, 0);
+        size_t _filterMask = 0;
+        mutable std::atomic<uint64_t> _filterRejects = 0;
+        mutable std::atomic<uint64_t> _filterFalsePositives = 0;
+    };
+
+    /// <summary>
+    /// Immutable snapshot of the toggle group membership of all shader hashes, rebuilt by AddonUIData whenever group membership changes.
+    /// Groups are addressed by a dense index into groups, the active state of each group is kept in a bitset with the same layout as the
+    /// membership bitsets so the active groups of a shader are found with a single AND per 64 groups.
+    /// </summary>
+    class __declspec(novtable) ToggleGroupIndex final
+    {
+    public:
+        ToggleGroupIndex(uint32_t epoch, std::vector<ToggleGroup*>&& groups, const std::array<size_t, 3>& maxHashCounts);
+
+        /// <summary>
+        /// Returns the group bitset of shaderHash for the passed in shader type (0: pixel, 1: vertex, 2: compute, see ShaderData::id).
+        /// </summary>
+        const uint64_t* Find(uint32_t shaderType, uint32_t shaderHash) const { return _shaderGroups[shaderType].Find(shaderHash); }
+        void Add(uint32_t shaderType, uint32_t shaderHash, uint32_t groupIndex) { _shaderGroups[shaderType].Add(shaderHash, groupIndex); }
+
+        /// <summary>
+        /// Copies the active state of every group into the active group bitset.
+        /// </summary>
+        void UpdateActiveGroups();
+
+        /// <summary>
+        /// Calls func for every active group in the passed in membership bitset.
+        /// </summary>
+        template<typename F>
+        void ForEachActiveGroup(const uint64_t* groupBits, F&& func) const
+        {
+            for (uint32_t w = 0; w < _wordCount; w++)
+            {
+                uint64_t bits = groupBits[w] & _activeGroups[w].load(std::memory_order_relaxed);
+
+                while (bits != 0)
+                {
+                    const uint32_t index = w * 64 + static_cast<uint32_t>(std::countr_zero(bits));
+                    bits &= bits - 1;
+
+                    func(_groups[index]);
+                }
+            }
+        }
+
+        bool HasActiveGroup(const uint64_t* groupBits) const
+        {
+            for (uint32_t w = 0; w < _wordCount; w++)
+            {
+                if (groupBits[w] & _activeGroups[w].load(std::memory_order_relaxed))
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        /// <summary>
+        /// Returns true if at least one group in the index is active.
+        /// </summary>
+        bool HasAnyActiveGroup() const
+        {
+            for (uint32_t w = 0; w < _wordCount; w++)
+            {
+                if (_activeGroups[w].load(std::memory_order_relaxed))
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        uint32_t GetEpoch() const { return _epoch; }
+        uint32_t GetWordCount() const { return _wordCount; }
+        const std::vector<ToggleGroup*>& GetGroups() const { return _groups; }
+        const ShaderGroupTable& GetShaderGroupTable(uint32_t shaderType) const { return _shaderGroups[shaderType]; }
+
+    private:
+        const uint32_t _epoch;
+        const uint32_t _wordCount;
+        std::vector<ToggleGroup*> _groups;
+        std::array<ShaderGroupTable, 3> _shaderGroups;
+        std::unique_ptr<std::atomic<uint64_t>[]> _activeGroups;
+    };
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+/// <summary>
+/// Minimal harness for the standalone checks and microbenchmarks in this project. Cases register themselves through
+/// BENCH_CASE; a failed BENCH_CHECK marks the run as failed without aborting the remaining cases.
+/// </summary>
+namespace Bench
+{
+    struct Case
+    {
+        const char* name;
+        void (*run)();
+    };
+
+    inline std::vector<Case>& Registry()
+    {
+        static std::vector<Case> cases;
+        return cases;
+    }
+
+    inline int& FailureCount()
+    {
+        static int failures = 0;
+        return failures;
+    }
+
+    struct Registrar
+    {
+        Registrar(const char* name, void (*run)())
+        {
+            Registry().push_back({ name, run });
+        }
+    };
+
+    inline void Fail(const char* file, int line, const char* expression)
+    {
+        std::printf("  FAILED %s(%d): %s\n", file, line, expression);
+        FailureCount()++;
+    }
+
+    /// <summary>
+    /// Runs fn `iterations` times and returns the mean wall time per iteration in nanoseconds.
+    /// </summary>
+    template<typename F>
+    double TimeNs(size_t iterations, F&& fn)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; i++)
+        {
+            fn();
+        }
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / static_cast<double>(iterations);
+    }
+
+    // Keeps the optimizer from discarding benchmarked results
+    template<typename T>
+    void Consume(const T& value)
+    {
+        static volatile T sink;
+        sink = value;
+        (void)sink;
+    }
+}
+
+#define BENCH_CASE(name) \
+    static void name(); \
+    static Bench::Registrar name##_registrar(#name, &name); \
+    static void name()
+
+#define BENCH_CHECK(expression) \
+    do { if (!(expression)) Bench::Fail(__FILE__, __LINE__, #expression); } while (false)
@@ -0,0 +1,83 @@
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "Bench.h"
+#include "crc32_hash.hpp"
+
+using namespace crc32_hash_detail;
+
+static std::vector<uint8_t> RandomBytes(size_t size, uint32_t seed)
+{
+    std::mt19937 rng(seed);
+    std::vector<uint8_t> bytes(size);
+    for (auto& b : bytes)
+    {
+        b = static_cast<uint8_t>(rng());
+    }
+    return bytes;
+}
+
+static uint32_t ReferenceCrc32(const uint8_t* data, size_t size)
+{
+    return ~update_bytewise(0xFFFFFFFF, data, size);
+}
+
+BENCH_CASE(Crc32_KnownVector)
+{
+    const char* check = "123456789";
+    BENCH_CHECK(compute_crc32(reinterpret_cast<const uint8_t*>(check), 9) == 0xCBF43926);
+    BENCH_CHECK(compute_crc32(nullptr, 0) == 0);
+}
+
+BENCH_CASE(Crc32_PathsMatchBytewise)
+{
+    // Cover every tail length around the 16 and 64 byte block boundaries, at every misalignment within a cache line
+    const auto bytes = RandomBytes(4096 + 64, 0xC0FFEE);
+
+    for (size_t offset = 0; offset < 64; offset += 7)
+    {
+        const uint8_t* data = bytes.data() + offset;
+
+        for (size_t size = 0; size <= 1024; size++)
+        {
+            const uint32_t expected = ReferenceCrc32(data, size);
+
+            BENCH_CHECK(~update_slice16(0xFFFFFFFF, data, size) == expected);
+            BENCH_CHECK(compute_crc32(data, size) == expected);
+        }
+
+        BENCH_CHECK(compute_crc32(data, 4096) == ReferenceCrc32(data, 4096));
+    }
+
+#ifdef CRC32_HASH_X86
+    if (!cpu_supports_pclmul())
+    {
+        std::printf("  PCLMULQDQ not supported, folding path skipped\n");
+        return;
+    }
+
+    for (size_t size = 64; size <= 4096; size += 16)
+    {
+        const uint8_t* data = bytes.data() + (size % 13);
+        BENCH_CHECK(~update_pclmul(0xFFFFFFFF, data, size) == ReferenceCrc32(data, size));
+    }
+#endif
+}
+
+BENCH_CASE(Crc32_Throughput)
+{
+    // Typical DXBC/SPIR-V blobs range from a few hundred bytes to tens of kilobytes
+    for (size_t size : { 256, 2048, 16384, 131072 })
+    {
+        const auto bytes = RandomBytes(size, static_cast<uint32_t>(size));
+        const size_t iterations = (64u << 20) / size;
+
+        const double bytewise = Bench::TimeNs(iterations, [&] { Bench::Consume(update_bytewise(0xFFFFFFFF, bytes.data(), size)); });
+        const double slice16 = Bench::TimeNs(iterations, [&] { Bench::Consume(update_slice16(0xFFFFFFFF, bytes.data(), size)); });
+        const double dispatched = Bench::TimeNs(iterations, [&] { Bench::Consume(compute_crc32(bytes.data(), size)); });
+
+        const auto gbps = [size](double ns) { return static_cast<double>(size) / ns; };
+        std::printf("  %7zu bytes: bytewise %6.2f GB/s, slice-by-16 %6.2f GB/s, compute_crc32 %6.2f GB/s\n",
+            size, gbps(bytewise), gbps(slice16), gbps(dispatched));
+    }
+}
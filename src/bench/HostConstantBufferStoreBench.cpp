@@ -0,0 +1,185 @@
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Bench.h"
+#include "HostConstantBufferStore.h"
+
+using Shim::Constants::HostConstantBufferStore;
+
+BENCH_CASE(HostConstantBufferStore_Basics)
+{
+    HostConstantBufferStore store;
+    const uint8_t initial[4] = { 1, 2, 3, 4 };
+    uint8_t read[4] = {};
+    const auto copy = [&read](const uint8_t* data, size_t size) { std::memcpy(read, data, size); };
+
+    BENCH_CHECK(store.Read(1, 1, copy) == HostConstantBufferStore::ReadResult::Missing);
+    BENCH_CHECK(!store.Write(1, initial, 4, 0));
+
+    // Not seeded, so its zeroes aren't handed out until it's written
+    store.Create(1, 4, 1);
+    BENCH_CHECK(store.Contains(1));
+    BENCH_CHECK(store.Read(1, 5, copy) == HostConstantBufferStore::ReadResult::WarmingUp);
+    BENCH_CHECK(store.Write(1, initial, 8, 2));
+    BENCH_CHECK(store.Read(1, 5, copy) == HostConstantBufferStore::ReadResult::Copied && read[2] == 1 && read[3] == 2);
+
+    // A seed is handed out right away, but never overwrites a write
+    const uint8_t seed[4] = { 5, 6, 7, 8 };
+    BENCH_CHECK(!store.Seed(1, seed, 4));
+    BENCH_CHECK(store.Read(1, 5, copy) == HostConstantBufferStore::ReadResult::Copied && read[0] == 0 && read[3] == 2);
+
+    store.Create(2, 4, 1);
+    BENCH_CHECK(store.Seed(2, initial, 4));
+    BENCH_CHECK(store.Read(2, 1, copy) == HostConstantBufferStore::ReadResult::Copied && read[0] == 1 && read[3] == 4);
+
+    // Buffer 1 was read in frame 5, buffer 2 in frame 1
+    store.EvictIdle(10, 5);
+    BENCH_CHECK(store.Contains(1) && !store.Contains(2));
+
+    store.Erase(1);
+    BENCH_CHECK(!store.Contains(1));
+}
+
+// The store ConstantCopyBase used before: one map of buffers behind a single lock, taken exclusively for every write
+struct LockedStore
+{
+    void Create(uint64_t handle, size_t size)
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        buffers.emplace(handle, std::vector<uint8_t>(size, 0));
+    }
+
+    void Write(uint64_t handle, const void* src, size_t size, size_t offset)
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex);
+        const auto it = buffers.find(handle);
+        if (it != buffers.end())
+        {
+            std::memcpy(it->second.data() + offset, src, size);
+        }
+    }
+
+    template<typename F>
+    bool Read(uint64_t handle, F&& copy)
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex);
+        const auto it = buffers.find(handle);
+        if (it == buffers.end())
+        {
+            return false;
+        }
+
+        copy(it->second.data(), it->second.size());
+        return true;
+    }
+
+    std::shared_mutex mutex;
+    std::unordered_map<uint64_t, std::vector<uint8_t>> buffers;
+};
+
+struct ShardedStore
+{
+    void Create(uint64_t handle, size_t size) { store.Create(handle, size, 1); }
+    void Write(uint64_t handle, const void* src, size_t size, size_t offset) { store.Write(handle, src, size, offset); }
+
+    template<typename F>
+    bool Read(uint64_t handle, F&& copy) { return store.Read(handle, 2, copy) == HostConstantBufferStore::ReadResult::Copied; }
+
+    HostConstantBufferStore store;
+};
+
+// Writers fill constant buffers with a single byte value, like the render and worker threads copying constants into mapped buffers,
+// while readers take snapshots for the toggle groups and check none of them mixes two writes. Most writes go to a few hot per frame
+// buffers, so writers also meet on the same buffer. Returns millions of writes per second.
+template<typename TStore>
+static double RunContention(unsigned writerCount, bool& consistent)
+{
+    constexpr uint64_t BUFFER_COUNT = 512;
+    constexpr uint64_t HOT_BUFFER_COUNT = 8;
+    constexpr size_t BUFFER_SIZE = 256;
+    constexpr size_t WRITES_PER_THREAD = 200000;
+    constexpr unsigned READERS = 2;
+
+    TStore store;
+    for (uint64_t handle = 1; handle <= BUFFER_COUNT; handle++)
+    {
+        store.Create(handle, BUFFER_SIZE);
+    }
+
+    std::atomic<bool> done = false;
+    std::atomic<bool> torn = false;
+
+    std::vector<std::thread> readers;
+    for (unsigned t = 0; t < READERS; t++)
+    {
+        readers.emplace_back([&, t] {
+            std::mt19937_64 rng(100 + t);
+            uint8_t snapshot[BUFFER_SIZE];
+            while (!done.load(std::memory_order_relaxed))
+            {
+                const uint64_t handle = rng() % BUFFER_COUNT + 1;
+                const bool copied = store.Read(handle, [&snapshot](const uint8_t* data, size_t size) { std::memcpy(snapshot, data, size); });
+                if (copied && std::memcmp(snapshot, snapshot + 1, BUFFER_SIZE - 1) != 0)
+                {
+                    torn.store(true, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> writers;
+    for (unsigned t = 0; t < writerCount; t++)
+    {
+        writers.emplace_back([&, t] {
+            std::mt19937_64 rng(t + 1);
+            uint8_t content[BUFFER_SIZE];
+            for (size_t i = 0; i < WRITES_PER_THREAD; i++)
+            {
+                const uint64_t handle = (rng() & 3) == 0 ? rng() % BUFFER_COUNT + 1 : rng() % HOT_BUFFER_COUNT + 1;
+                std::memset(content, static_cast<int>(rng() & 0xff), BUFFER_SIZE);
+                store.Write(handle, content, BUFFER_SIZE, 0);
+            }
+        });
+    }
+
+    for (auto& t : writers)
+    {
+        t.join();
+    }
+
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    done.store(true);
+    for (auto& t : readers)
+    {
+        t.join();
+    }
+
+    consistent = !torn.load();
+
+    const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    return static_cast<double>(writerCount) * WRITES_PER_THREAD / ns * 1000.0;
+}
+
+BENCH_CASE(HostConstantBufferStore_WriterContention)
+{
+    for (unsigned writers : { 1u, 4u, 8u, 16u })
+    {
+        bool consistent = false;
+
+        const double lockedRate = RunContention<LockedStore>(writers, consistent);
+        BENCH_CHECK(consistent);
+
+        const double shardedRate = RunContention<ShardedStore>(writers, consistent);
+        BENCH_CHECK(consistent);
+
+        std::printf("  %2u writers + 2 readers: single lock %6.2f M writes/s, HostConstantBufferStore %6.2f M writes/s\n", writers, lockedRate, shardedRate);
+    }
+}
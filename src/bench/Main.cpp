@@ -0,0 +1,24 @@
+#include <cstdio>
+#include <cstring>
+#include "Bench.h"
+
+// Usage: ShaderTogglerBench [name filter]
+int main(int argc, char** argv)
+{
+    const char* filter = argc > 1 ? argv[1] : nullptr;
+
+    for (const auto& c : Bench::Registry())
+    {
+        if (filter != nullptr && strstr(c.name, filter) == nullptr)
+        {
+            continue;
+        }
+
+        std::printf("[%s]\n", c.name);
+        c.run();
+    }
+
+    std::printf("%d failure(s)\n", Bench::FailureCount());
+
+    return Bench::FailureCount() == 0 ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+#include "Bench.h"
+#include "MappedRangeIndex.h"
+
+using Shim::Constants::MappedRange;
+using Shim::Constants::MappedRangeIndex;
+
+BENCH_CASE(MappedRangeIndex_Basics)
+{
+    MappedRangeIndex index;
+    MappedRange range;
+
+    BENCH_CHECK(index.Empty());
+    BENCH_CHECK(index.Lowest() == UINTPTR_MAX && index.Highest() == 0);
+    BENCH_CHECK(!index.Find(0x1000, range));
+
+    BENCH_CHECK(index.Add(1, 0x1000, 0x10ff, 0x100));
+    BENCH_CHECK(index.Add(2, 0x3000, 0x30ff, 0x100));
+    BENCH_CHECK(index.Add(3, 0x2000, 0x2fff, 0x1000));
+
+    BENCH_CHECK(index.Size() == 3);
+    BENCH_CHECK(index.Find(0x2800, range) && range.resource == 3 && range.destination == 0x2000 && range.bufferSize == 0x1000);
+    BENCH_CHECK(index.Find(0x10ff, range) && range.resource == 1);
+    BENCH_CHECK(!index.Find(0x1100, range));
+    BENCH_CHECK(!index.Find(0x0fff, range));
+    BENCH_CHECK(index.Lowest() == 0x1000 && index.Highest() == 0x30ff);
+
+    // Mapping a resource again replaces its range
+    BENCH_CHECK(!index.Add(2, 0x4000, 0x40ff, 0x100));
+    BENCH_CHECK(index.Size() == 3);
+    BENCH_CHECK(!index.Find(0x3000, range));
+    BENCH_CHECK(index.Find(0x4000, range) && range.resource == 2);
+    BENCH_CHECK(index.Highest() == 0x40ff);
+
+    BENCH_CHECK(index.Remove(2));
+    BENCH_CHECK(!index.Remove(2));
+    BENCH_CHECK(index.Highest() == 0x2fff);
+    BENCH_CHECK(index.Remove(1));
+    BENCH_CHECK(index.Lowest() == 0x2000);
+    BENCH_CHECK(index.Remove(3));
+    BENCH_CHECK(index.Empty());
+    BENCH_CHECK(index.Lowest() == UINTPTR_MAX && index.Highest() == 0);
+}
+
+namespace
+{
+    uintptr_t listenedLowest = 0;
+    uintptr_t listenedHighest = 0;
+    uint32_t listenedCount = 0;
+
+    void OnBoundsChanged(uintptr_t lowest, uintptr_t highest)
+    {
+        listenedLowest = lowest;
+        listenedHighest = highest;
+        listenedCount++;
+    }
+}
+
+BENCH_CASE(MappedRangeIndex_BoundsListener)
+{
+    MappedRangeIndex index(&OnBoundsChanged);
+
+    index.Add(1, 0x2000, 0x20ff, 0x100);
+    BENCH_CHECK(listenedCount == 1 && listenedLowest == 0x2000 && listenedHighest == 0x20ff);
+
+    index.Add(2, 0x1000, 0x10ff, 0x100);
+    index.Add(1, 0x3000, 0x30ff, 0x100);
+    BENCH_CHECK(listenedCount == 3 && listenedLowest == 0x1000 && listenedHighest == 0x30ff);
+
+    // Nothing changed, nothing to report
+    BENCH_CHECK(!index.Remove(3));
+    BENCH_CHECK(listenedCount == 3);
+
+    index.Remove(1);
+    index.Remove(2);
+    BENCH_CHECK(listenedCount == 5 && listenedLowest == UINTPTR_MAX && listenedHighest == 0);
+}
+
+BENCH_CASE(MappedRangeIndex_SharedStartAddress)
+{
+    // Ring buffer allocators hand out the same address to different resources
+    MappedRangeIndex index;
+    MappedRange range;
+
+    index.Add(1, 0x1000, 0x10ff, 0x100);
+    index.Add(2, 0x1000, 0x1fff, 0x1000);
+    index.Add(3, 0x1000, 0x13ff, 0x400);
+
+    BENCH_CHECK(index.Remove(2));
+    BENCH_CHECK(index.Highest() == 0x13ff);
+    BENCH_CHECK(index.Find(0x1000, range) && range.resource != 2);
+    BENCH_CHECK(index.Remove(3));
+    BENCH_CHECK(index.Find(0x1000, range) && range.resource == 1);
+    BENCH_CHECK(!index.Find(0x1100, range));
+}
+
+BENCH_CASE(MappedRangeIndex_ConcurrentLookups)
+{
+    // Readers look up addresses of buffers which stay mapped while a writer maps and unmaps others around them, like the memcpy detour
+    // on the game's worker threads while the render thread maps constant buffers
+    constexpr uint64_t STABLE = 64;
+    constexpr uint64_t CHURN = 256;
+    constexpr uintptr_t STRIDE = 0x1000;
+    constexpr size_t LOOKUPS_PER_READER = 500000;
+
+    MappedRangeIndex index;
+
+    for (uint64_t i = 0; i < STABLE; i++)
+    {
+        const uintptr_t first = (i * 2 + 1) * STRIDE;
+        index.Add(i + 1, first, first + STRIDE / 2, STRIDE / 2);
+    }
+
+    std::atomic<bool> done = false;
+    std::atomic<bool> missed = false;
+
+    std::thread writer([&] {
+        std::mt19937_64 rng(7);
+        while (!done.load(std::memory_order_relaxed))
+        {
+            const uint64_t i = rng() % CHURN;
+            const uintptr_t first = (i * 2) * STRIDE;
+            if (rng() & 1)
+            {
+                index.Add(1000 + i, first, first + STRIDE / 2, STRIDE / 2);
+            }
+            else
+            {
+                index.Remove(1000 + i);
+            }
+        }
+    });
+
+    for (unsigned readers : { 1u, 4u, 8u })
+    {
+        const auto start = std::chrono::steady_clock::now();
+
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < readers; t++)
+        {
+            threads.emplace_back([&, t] {
+                std::mt19937_64 rng(t + 1);
+                MappedRange range;
+                for (size_t i = 0; i < LOOKUPS_PER_READER; i++)
+                {
+                    const uint64_t stable = rng() % STABLE;
+                    const uintptr_t address = (stable * 2 + 1) * STRIDE + rng() % (STRIDE / 2);
+                    if (!index.Find(address, range) || range.resource != stable + 1)
+                    {
+                        missed.store(true, std::memory_order_relaxed);
+                    }
+                }
+            });
+        }
+
+        for (auto& t : threads)
+        {
+            t.join();
+        }
+
+        const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+        std::printf("  %u readers + 1 writer: %7.1f M lookups/s\n", readers, static_cast<double>(readers) * LOOKUPS_PER_READER / ns * 1000.0);
+    }
+
+    done.store(true);
+    writer.join();
+
+    BENCH_CHECK(!missed.load());
+}
@@ -0,0 +1,89 @@
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+#include "Bench.h"
+#include "MemcpyFence.h"
+
+using Shim::Constants::MemcpyFence;
+
+typedef void* (sig_memcpy)(void*, const void*, size_t);
+
+static sig_memcpy* org_memcpy = &std::memcpy;
+static std::atomic<size_t> forwardedBytes = 0;
+
+// Mirrors ConstantCopyMemcpy::detour_memcpy, with the copier's OnMemcpy replaced by a counter
+static void* detour_memcpy(void* dest, const void* src, size_t size)
+{
+    if (MemcpyFence::Admits(reinterpret_cast<uintptr_t>(dest)))
+    {
+        forwardedBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+
+    return org_memcpy(dest, src, size);
+}
+
+BENCH_CASE(MemcpyDetour_Fence)
+{
+    alignas(64) static uint8_t mapped[256];
+    const uintptr_t lowest = reinterpret_cast<uintptr_t>(mapped);
+    const uintptr_t highest = lowest + sizeof(mapped);
+
+    MemcpyFence::Set(lowest, highest);
+    BENCH_CHECK(!MemcpyFence::Admits(lowest));
+
+    // A mapping made on another thread doesn't admit the copies made on this one
+    std::thread([] { MemcpyFence::OnThreadMapped(); }).join();
+    BENCH_CHECK(!MemcpyFence::Admits(lowest));
+
+    MemcpyFence::OnThreadMapped();
+    BENCH_CHECK(MemcpyFence::Admits(lowest) && MemcpyFence::Admits(highest));
+    BENCH_CHECK(!MemcpyFence::Admits(lowest - 1) && !MemcpyFence::Admits(highest + 1));
+
+    bool otherThreadAdmitted = true;
+    std::thread([&] { otherThreadAdmitted = MemcpyFence::Admits(lowest); }).join();
+    BENCH_CHECK(!otherThreadAdmitted);
+
+    MemcpyFence::OnThreadUnmapped();
+    MemcpyFence::OnThreadUnmapped();
+    BENCH_CHECK(MemcpyFence::ThreadMapCount() == 0);
+    BENCH_CHECK(!MemcpyFence::Admits(lowest));
+
+    MemcpyFence::Set(UINTPTR_MAX, 0);
+}
+
+BENCH_CASE(MemcpyDetour_SizeClasses)
+{
+    // Every memcpy in the process goes through the detour, so the cost on calls it rejects matters more than the cost of forwarding
+    constexpr size_t TOTAL_BYTES = 64 * 1024 * 1024;
+    std::vector<uint8_t> source(64 * 1024, 0x5a);
+    std::vector<uint8_t> destination(64 * 1024);
+    std::vector<uint8_t> mapped(64 * 1024);
+
+    sig_memcpy* volatile plain = org_memcpy;
+    sig_memcpy* volatile detoured = &detour_memcpy;
+
+    for (size_t size : { 8, 16, 64, 256, 1024, 4096, 64 * 1024 })
+    {
+        const size_t iterations = TOTAL_BYTES / size;
+        const auto copy = [&](sig_memcpy* fn, uint8_t* dest) { return Bench::TimeNs(iterations, [&] { Bench::Consume(fn(dest, source.data(), size)); }); };
+
+        const double baseline = copy(plain, destination.data());
+
+        MemcpyFence::Set(reinterpret_cast<uintptr_t>(mapped.data()), reinterpret_cast<uintptr_t>(mapped.data()) + mapped.size());
+        const double notMapped = copy(detoured, destination.data());
+
+        MemcpyFence::OnThreadMapped();
+        const double outsideFence = copy(detoured, destination.data());
+
+        forwardedBytes.store(0);
+        const double forwarded = copy(detoured, mapped.data());
+        BENCH_CHECK(forwardedBytes.load() == iterations * size);
+
+        MemcpyFence::OnThreadUnmapped();
+        MemcpyFence::Set(UINTPTR_MAX, 0);
+
+        std::printf("  %6zu bytes: memcpy %7.2f ns, detour not mapped %7.2f ns, outside fence %7.2f ns, forwarded %7.2f ns\n", size, baseline,
+            notMapped, outsideFence, forwarded);
+    }
+}
@@ -0,0 +1,295 @@
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "Bench.h"
+#include "PagedArray.h"
+#include "ReadMostlyHandleMap.h"
+
+using ShaderToggler::PagedArray;
+using ShaderToggler::ReadMostlyHandleMap;
+
+static uint64_t ValueFor(size_t index)
+{
+    return index * 2654435761ull | 1;
+}
+
+BENCH_CASE(PagedArray_Basics)
+{
+    PagedArray<uint64_t, 64> array;
+
+    BENCH_CHECK(array.find(0) == nullptr);
+    BENCH_CHECK(array.size() == 0);
+
+    array.allocate(100, 10);
+    BENCH_CHECK(array.size() == 110);
+    BENCH_CHECK(array.find(99) != nullptr && *array.find(99) == 0);
+    BENCH_CHECK(array.find(128) == nullptr);
+    BENCH_CHECK(array.memory() == 64 * sizeof(uint64_t));
+
+    array.get_or_create(100000) = 5;
+    BENCH_CHECK(*array.find(100000) == 5);
+    BENCH_CHECK(array.size() == 100001);
+}
+
+BENCH_CASE(PagedArray_ConcurrentAllocateAndRead)
+{
+    // Small pages so the eight writers keep allocating pages and growing the directory while the readers walk it
+    constexpr size_t CHUNK = 100;
+    constexpr size_t CHUNK_COUNT = 2000;
+    constexpr unsigned WRITERS = 8;
+    constexpr unsigned READERS = 4;
+    PagedArray<std::atomic<uint64_t>, 64> array;
+
+    std::atomic<bool> done = false;
+    std::atomic<bool> mismatch = false;
+
+    std::vector<std::thread> readers;
+    for (unsigned t = 0; t < READERS; t++)
+    {
+        readers.emplace_back([&, t] {
+            std::mt19937_64 rng(t + 1);
+            while (!done.load(std::memory_order_relaxed))
+            {
+                const size_t index = rng() % (CHUNK * CHUNK_COUNT);
+                const std::atomic<uint64_t>* element = array.find(index);
+                const uint64_t value = element != nullptr ? element->load(std::memory_order_relaxed) : 0;
+                if (value != 0 && value != ValueFor(index))
+                {
+                    mismatch.store(true, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+
+    std::vector<std::thread> writers;
+    for (unsigned t = 0; t < WRITERS; t++)
+    {
+        writers.emplace_back([&, t] {
+            for (size_t chunk = t; chunk < CHUNK_COUNT; chunk += WRITERS)
+            {
+                array.allocate(chunk * CHUNK, CHUNK);
+                for (size_t i = chunk * CHUNK; i < (chunk + 1) * CHUNK; i++)
+                {
+                    array.find(i)->store(ValueFor(i), std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+
+    for (auto& t : writers)
+    {
+        t.join();
+    }
+    done.store(true);
+    for (auto& t : readers)
+    {
+        t.join();
+    }
+
+    BENCH_CHECK(!mismatch.load());
+    BENCH_CHECK(array.size() == CHUNK * CHUNK_COUNT);
+    BENCH_CHECK(array.memory() == (CHUNK * CHUNK_COUNT + 63) / 64 * 64 * sizeof(std::atomic<uint64_t>));
+
+    bool allWritten = true;
+    for (size_t i = 0; i < CHUNK * CHUNK_COUNT; i++)
+    {
+        allWritten &= array.find(i)->load() == ValueFor(i);
+    }
+    BENCH_CHECK(allWritten);
+}
+
+BENCH_CASE(PagedArray_RacingAllocateOfSamePages)
+{
+    // All threads ask for the same pages at once, each page has to be allocated exactly once
+    PagedArray<uint64_t, 64> array;
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < 8; t++)
+    {
+        threads.emplace_back([&] {
+            for (size_t first = 0; first < 64 * 1024; first += 500)
+            {
+                array.allocate(first, 500);
+            }
+        });
+    }
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    BENCH_CHECK(array.memory() == (64 * 1024 + 500 + 63) / 64 * 64 * sizeof(uint64_t));
+}
+
+// Same size as descriptor_tracking::heap_entry
+struct HeapEntry
+{
+    uint32_t type = 0;
+    uint32_t out_of_line_index = 0;
+    uint64_t handle = 0;
+};
+
+// The mirror descriptor_tracking used before: a growable vector per heap behind a lock
+struct LockedHeapMirror
+{
+    void update(size_t offset, size_t count, uint64_t handle)
+    {
+        std::unique_lock lock(mutex);
+        if (entries.size() < offset + count)
+        {
+            entries.resize(offset + count);
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            entries[offset + i] = { 2, 0, handle + i };
+        }
+    }
+
+    void copy(size_t dest, size_t source, size_t count)
+    {
+        std::unique_lock lock(mutex);
+        if (entries.size() < std::max(dest, source) + count)
+        {
+            entries.resize(std::max(dest, source) + count);
+        }
+        for (size_t i = 0; i < count; i++)
+        {
+            entries[dest + i] = entries[source + i];
+        }
+    }
+
+    uint64_t read(size_t offset)
+    {
+        std::unique_lock lock(mutex);
+        return offset < entries.size() ? entries[offset].handle : 0;
+    }
+
+    std::mutex mutex;
+    std::vector<HeapEntry> entries;
+};
+
+struct PagedHeapMirror
+{
+    void update(size_t offset, size_t count, uint64_t handle)
+    {
+        entries.allocate(offset, count);
+        for (size_t i = 0; i < count; i++)
+        {
+            *entries.find(offset + i) = { 2, 0, handle + i };
+        }
+    }
+
+    void copy(size_t dest, size_t source, size_t count)
+    {
+        entries.allocate(dest, count);
+        for (size_t i = 0; i < count; i++)
+        {
+            const HeapEntry* entry = entries.find(source + i);
+            *entries.find(dest + i) = entry != nullptr ? *entry : HeapEntry{};
+        }
+    }
+
+    uint64_t read(size_t offset)
+    {
+        const HeapEntry* entry = entries.find(offset);
+        return entry != nullptr ? entry->handle : 0;
+    }
+
+    PagedArray<HeapEntry> entries;
+};
+
+// Looks up the heap mirror like descriptor_tracking::get_or_create_heap: lock free find, creation double checked under the storage lock
+template<typename TMirror>
+struct HeapRegistry
+{
+    TMirror& get_or_create(uint64_t heap)
+    {
+        if (TMirror* mirror = heaps.find(heap))
+        {
+            return *mirror;
+        }
+
+        std::unique_lock lock(storage_mutex);
+        TMirror* mirror = heaps.find(heap);
+        if (mirror == nullptr)
+        {
+            mirror = storage.emplace_back(std::make_unique<TMirror>()).get();
+            heaps.insert_or_assign(heap, mirror);
+        }
+        return *mirror;
+    }
+
+    ReadMostlyHandleMap<TMirror*> heaps;
+    std::vector<std::unique_ptr<TMirror>> storage;
+    std::mutex storage_mutex;
+};
+
+// Each thread updates descriptor ranges in its own part of a few shared heaps and copies them to a staging part, which is what D3D12
+// titles do when several threads build descriptor tables for the same frame. Returns millions of descriptors written per second.
+template<typename TMirror>
+static double RunUpdateCopyStress(unsigned threadCount, bool& consistent)
+{
+    constexpr unsigned HEAP_COUNT = 4;
+    constexpr size_t REGION = 32 * 1024;
+    constexpr size_t TABLE = 16;
+    constexpr size_t TABLES_PER_THREAD = 100000;
+
+    HeapRegistry<TMirror> registry;
+    std::atomic<bool> mismatch = false;
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < threadCount; t++)
+    {
+        threads.emplace_back([&, t] {
+            std::mt19937_64 rng(t + 1);
+            const size_t regionStart = t * REGION * 2;
+            for (size_t i = 0; i < TABLES_PER_THREAD; i++)
+            {
+                const uint64_t heap = (rng() % HEAP_COUNT + 1) * 0x1000;
+                TMirror& mirror = registry.get_or_create(heap);
+                const size_t offset = regionStart + (rng() % (REGION / TABLE)) * TABLE;
+                const uint64_t handle = (static_cast<uint64_t>(t) << 48) | (i << 8);
+
+                mirror.update(offset, TABLE, handle);
+                mirror.copy(offset + REGION, offset, TABLE);
+
+                if (mirror.read(offset + REGION + TABLE - 1) != handle + TABLE - 1)
+                {
+                    mismatch.store(true, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    consistent = !mismatch.load() && registry.storage.size() == HEAP_COUNT;
+
+    const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    return static_cast<double>(threadCount) * TABLES_PER_THREAD * TABLE * 2 / ns * 1000.0;
+}
+
+BENCH_CASE(PagedArray_UpdateCopyStress)
+{
+    for (unsigned threads : { 1u, 4u, 8u })
+    {
+        bool consistent = false;
+
+        const double lockedRate = RunUpdateCopyStress<LockedHeapMirror>(threads, consistent);
+        BENCH_CHECK(consistent);
+
+        const double pagedRate = RunUpdateCopyStress<PagedHeapMirror>(threads, consistent);
+        BENCH_CHECK(consistent);
+
+        std::printf("  %u threads: locked vector %7.1f M descriptors/s, PagedArray %7.1f M descriptors/s\n", threads, lockedRate, pagedRate);
+    }
+}
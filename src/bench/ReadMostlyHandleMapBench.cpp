@@ -0,0 +1,309 @@
+#include <cstdio>
+#include <random>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+#include "Bench.h"
+#include "ReadMostlyHandleMap.h"
+
+#if __has_include(<tsl/robin_map.h>)
+#include <tsl/robin_map.h>
+template<typename K, typename V> using BaselineMap = tsl::robin_map<K, V>;
+static constexpr const char* BASELINE_NAME = "robin_map + shared_mutex";
+#else
+#include <unordered_map>
+template<typename K, typename V> using BaselineMap = std::unordered_map<K, V>;
+static constexpr const char* BASELINE_NAME = "unordered_map + shared_mutex";
+#endif
+
+using ShaderToggler::ReadMostlyHandleMap;
+
+// The map ShaderManager used before, a hash map behind a reader/writer lock
+class LockedHandleMap
+{
+public:
+    uint32_t find(uint64_t handle)
+    {
+        std::shared_lock lock(_mutex);
+        const auto it = _map.find(handle);
+        return it == _map.end() ? 0 : it->second;
+    }
+
+    void insert_or_assign(uint64_t handle, uint32_t value)
+    {
+        std::unique_lock lock(_mutex);
+        _map.insert_or_assign(handle, value);
+    }
+
+    void erase(uint64_t handle)
+    {
+        std::unique_lock lock(_mutex);
+        _map.erase(handle);
+    }
+
+private:
+    std::shared_mutex _mutex;
+    BaselineMap<uint64_t, uint32_t> _map;
+};
+
+static uint32_t ValueFor(uint64_t handle)
+{
+    return static_cast<uint32_t>(handle >> 4) | 1u;
+}
+
+BENCH_CASE(ReadMostlyHandleMap_Basics)
+{
+    ReadMostlyHandleMap<uint32_t> map;
+
+    BENCH_CHECK(map.insert_or_assign(0x1000, 7) == 0);
+    BENCH_CHECK(map.insert_or_assign(0x1000, 8) == 7);
+    BENCH_CHECK(map.find(0x1000) == 8);
+    BENCH_CHECK(map.find(0x2000) == 0);
+    BENCH_CHECK(map.find(0) == 0);
+    BENCH_CHECK(map.size() == 1);
+    BENCH_CHECK(map.erase(0x1000) == 8);
+    BENCH_CHECK(map.erase(0x1000) == 0);
+    BENCH_CHECK(!map.contains(0x1000));
+    BENCH_CHECK(map.size() == 0);
+}
+
+BENCH_CASE(ReadMostlyHandleMap_ChurnKeepsCapacityFlat)
+{
+    // PSO streaming: the live count stays around 600 while a million distinct handles pass through
+    ReadMostlyHandleMap<uint32_t> map;
+    constexpr uint64_t LIVE = 600;
+    size_t settledCapacity = 0;
+
+    for (uint64_t i = 1; i <= 1000000; i++)
+    {
+        map.insert_or_assign(i * 64, ValueFor(i * 64));
+        if (i > LIVE)
+        {
+            map.erase((i - LIVE) * 64);
+        }
+
+        if (i % 10000 == 0)
+        {
+            map.reclaim_retired();
+        }
+
+        if (i == 10000)
+        {
+            settledCapacity = map.capacity();
+        }
+    }
+
+    BENCH_CHECK(map.size() == LIVE);
+    BENCH_CHECK(map.capacity() == settledCapacity);
+
+    for (uint64_t i = 1000000 - LIVE + 1; i <= 1000000; i++)
+    {
+        BENCH_CHECK(map.find(i * 64) == ValueFor(i * 64));
+    }
+
+    // Without readers two presents see both read epochs drained, which frees every table retired above
+    map.reclaim_retired();
+    map.reclaim_retired();
+    BENCH_CHECK(map.retired_count() == 0);
+}
+
+BENCH_CASE(ReadMostlyHandleMap_GuardHoldsRetiredValues)
+{
+    ReadMostlyHandleMap<uint64_t*> map;
+    auto value = std::make_unique<uint64_t>(42);
+    map.insert_or_assign(0x1000, value.get());
+
+    {
+        const ReadMostlyHandleMap<uint64_t*>::read_guard guard(map);
+        uint64_t* found = map.find(guard, 0x1000);
+
+        map.erase(0x1000);
+        map.retire(std::move(value));
+
+        // However often the owner reclaims, the value stays alive while the guard which found it is held
+        for (int frame = 0; frame < 16; frame++)
+        {
+            map.reclaim_retired();
+        }
+        BENCH_CHECK(map.retired_count() == 1);
+        BENCH_CHECK(*found == 42);
+    }
+
+    map.reclaim_retired();
+    map.reclaim_retired();
+    BENCH_CHECK(map.retired_count() == 0);
+}
+
+BENCH_CASE(ReadMostlyHandleMap_ConcurrentRetire)
+{
+    // The writer replaces values and retires the old ones while reclaiming as often as it can, readers keep dereferencing what they find.
+    // Build with -fsanitize=address to catch a value freed under a reader.
+    constexpr uint64_t KEY_SPACE = 256;
+    constexpr size_t LOOKUPS_PER_READER = 1000000;
+
+    ReadMostlyHandleMap<uint64_t*> map;
+    std::atomic<bool> done = false;
+    std::atomic<bool> mismatch = false;
+
+    std::thread writer([&] {
+        std::mt19937_64 rng(42);
+        while (!done.load(std::memory_order_relaxed))
+        {
+            const uint64_t handle = (rng() % KEY_SPACE + 1) * 64;
+            uint64_t* previous = (rng() & 3) != 0 ? map.insert_or_assign(handle, new uint64_t(ValueFor(handle))) : map.erase(handle);
+            map.retire(std::unique_ptr<uint64_t>(previous));
+            map.reclaim_retired();
+        }
+    });
+
+    std::vector<std::thread> readers;
+    for (unsigned t = 0; t < 4; t++)
+    {
+        readers.emplace_back([&, t] {
+            std::mt19937_64 rng(t + 1);
+            for (size_t i = 0; i < LOOKUPS_PER_READER; i++)
+            {
+                const uint64_t handle = (rng() % KEY_SPACE + 1) * 64;
+                const ReadMostlyHandleMap<uint64_t*>::read_guard guard(map);
+                const uint64_t* value = map.find(guard, handle);
+                if (value != nullptr && *value != ValueFor(handle))
+                {
+                    mismatch.store(true, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+
+    for (auto& t : readers)
+    {
+        t.join();
+    }
+    done.store(true);
+    writer.join();
+
+    BENCH_CHECK(!mismatch.load());
+
+    for (uint64_t k = 1; k <= KEY_SPACE; k++)
+    {
+        map.retire(std::unique_ptr<uint64_t>(map.erase(k * 64)));
+    }
+    map.reclaim_retired();
+    map.reclaim_retired();
+    BENCH_CHECK(map.retired_count() == 0);
+}
+
+BENCH_CASE(ReadMostlyHandleMap_GrowsWithLiveCount)
+{
+    ReadMostlyHandleMap<uint32_t> map;
+
+    for (uint64_t i = 1; i <= 100000; i++)
+    {
+        map.insert_or_assign(i, ValueFor(i));
+    }
+
+    BENCH_CHECK(map.size() == 100000);
+    BENCH_CHECK(map.capacity() >= 2 * 100000);
+    BENCH_CHECK(map.retired_count() > 0);
+
+    bool allFound = true;
+    for (uint64_t i = 1; i <= 100000; i++)
+    {
+        allFound &= map.find(i) == ValueFor(i);
+    }
+    BENCH_CHECK(allFound);
+}
+
+template<typename TMap>
+static double RunMixedLoad(TMap& map, unsigned readers, bool reclaim, bool& consistent)
+{
+    constexpr uint64_t KEY_SPACE = 4096;
+    constexpr size_t LOOKUPS_PER_READER = 2000000;
+
+    for (uint64_t k = 1; k <= KEY_SPACE; k += 2)
+    {
+        map.insert_or_assign(k * 64, ValueFor(k * 64));
+    }
+
+    std::atomic<bool> done = false;
+    std::atomic<bool> mismatch = false;
+
+    // One streaming thread inserts and erases, like init_pipeline/destroy_pipeline under PSO streaming, and reclaims once per 60 Hz frame
+    std::thread writer([&] {
+        std::mt19937_64 rng(42);
+        auto lastPresent = std::chrono::steady_clock::now();
+        while (!done.load(std::memory_order_relaxed))
+        {
+            const uint64_t handle = (rng() % KEY_SPACE + 1) * 64;
+            if (rng() & 1)
+            {
+                map.insert_or_assign(handle, ValueFor(handle));
+            }
+            else
+            {
+                map.erase(handle);
+            }
+
+            if constexpr (requires { map.reclaim_retired(); })
+            {
+                const auto now = std::chrono::steady_clock::now();
+                if (reclaim && now - lastPresent >= std::chrono::milliseconds(16))
+                {
+                    map.reclaim_retired();
+                    lastPresent = now;
+                }
+            }
+        }
+    });
+
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::thread> threads;
+    for (unsigned t = 0; t < readers; t++)
+    {
+        threads.emplace_back([&, t] {
+            std::mt19937_64 rng(t + 1);
+            for (size_t i = 0; i < LOOKUPS_PER_READER; i++)
+            {
+                const uint64_t handle = (rng() % KEY_SPACE + 1) * 64;
+                const uint32_t value = map.find(handle);
+                if (value != 0 && value != ValueFor(handle))
+                {
+                    mismatch.store(true, std::memory_order_relaxed);
+                }
+            }
+        });
+    }
+
+    for (auto& t : threads)
+    {
+        t.join();
+    }
+
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    done.store(true);
+    writer.join();
+
+    consistent = !mismatch.load();
+
+    const double ns = static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count());
+    return static_cast<double>(readers) * LOOKUPS_PER_READER / ns * 1000.0;
+}
+
+BENCH_CASE(ReadMostlyHandleMap_MixedLoad)
+{
+    for (unsigned readers : { 1u, 4u, 8u })
+    {
+        bool consistent = false;
+
+        LockedHandleMap locked;
+        const double lockedRate = RunMixedLoad(locked, readers, false, consistent);
+        BENCH_CHECK(consistent);
+
+        ReadMostlyHandleMap<uint32_t> readMostly;
+        const double readMostlyRate = RunMixedLoad(readMostly, readers, true, consistent);
+        BENCH_CHECK(consistent);
+
+        std::printf("  %2u readers + 1 writer: %s %7.1f M lookups/s, ReadMostlyHandleMap %7.1f M lookups/s\n",
+            readers, BASELINE_NAME, lockedRate, readMostlyRate);
+    }
+}
@@ -0,0 +1,191 @@
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <random>
+#include "Bench.h"
+#include "../StateTracking.h"
+
+using namespace reshade::api;
+using StateTracking::snapshot_arena;
+using StateTracking::state_block;
+
+namespace
+{
+    std::atomic<uint64_t> heapAllocations = 0;
+}
+
+// Every heap allocation of the bench process goes through here, so the checks below also see the resizes of the root tables and
+// anything else the capture path allocates besides the arena blocks
+void* operator new(size_t size)
+{
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+
+    if (void* p = std::malloc(size == 0 ? 1 : size))
+    {
+        return p;
+    }
+
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept
+{
+    std::free(p);
+}
+
+namespace
+{
+    // Same size as descriptor_tracking::descriptor_data
+    struct fake_descriptor
+    {
+        uint64_t handles[4];
+        uint32_t type;
+    };
+
+    constexpr uint32_t MAX_LAYOUT_PARAMS = 8;
+    constexpr uint32_t MAX_PUSH_COUNT = 32;
+
+    // Captures every slot, so all pushes below end up in the arena
+    void TrackAllSlots()
+    {
+        StateTracking::tracking_interest interest;
+        for (uint32_t stage = 0; stage < StateTracking::TRACKED_SHADER_STAGES_SIZE; stage++)
+        {
+            for (uint32_t slot = 0; slot < MAX_LAYOUT_PARAMS; slot++)
+            {
+                interest.add(stage, slot);
+            }
+        }
+        state_tracking::set_interest(interest);
+    }
+
+    // A frame of pushes through the capture path of the push_descriptors and push_constants events: a few hundred tables and constant
+    // ranges of varying size over the tracked stages and slots, which also grows the root tables of a cleared state block again
+    void RecordFrame(state_block& state, std::mt19937& rng)
+    {
+        static const resource_view views[MAX_PUSH_COUNT] = {};
+        static const uint32_t constants[MAX_PUSH_COUNT] = {};
+
+        for (uint32_t i = 0; i < 300; i++)
+        {
+            const int32_t stageIndex = static_cast<int32_t>(i % StateTracking::TRACKED_SHADER_STAGES_SIZE);
+            const shader_stage stages = StateTracking::ALL_SHADER_STAGES[stageIndex];
+            const uint32_t layoutParam = rng() % MAX_LAYOUT_PARAMS;
+            const uint32_t count = 1 + rng() % MAX_PUSH_COUNT;
+
+            if (i % 3 == 0)
+            {
+                state.push_constants(stageIndex, stages, pipeline_layout{ 1 }, layoutParam, 0, count, constants, false);
+            }
+            else
+            {
+                const descriptor_table_update update = { {}, 0, 0, count, descriptor_type::shader_resource_view, views };
+                state.push_descriptors(stageIndex, stages, pipeline_layout{ 1 }, layoutParam, update, false);
+            }
+        }
+    }
+}
+
+BENCH_CASE(SnapshotArena_ValueInitializedAndAligned)
+{
+    snapshot_arena arena;
+
+    for (uint32_t i = 1; i < 200; i++)
+    {
+        uint8_t* bytes = arena.allocate<uint8_t>(i);
+        fake_descriptor* descriptors = arena.allocate<fake_descriptor>(i % 7 + 1);
+
+        BENCH_CHECK(reinterpret_cast<uintptr_t>(descriptors) % alignof(fake_descriptor) == 0);
+        BENCH_CHECK(descriptors[0].type == 0 && descriptors[0].handles[3] == 0);
+        BENCH_CHECK(bytes[i - 1] == 0);
+
+        memset(bytes, 0xFF, i);
+        memset(descriptors, 0xFF, sizeof(fake_descriptor) * (i % 7 + 1));
+    }
+
+    arena.reset();
+
+    // Memory handed out again after a reset is zeroed as well
+    const uint32_t* constants = arena.allocate<uint32_t>(1024);
+    bool zeroed = true;
+    for (uint32_t i = 0; i < 1024; i++)
+    {
+        zeroed &= constants[i] == 0;
+    }
+    BENCH_CHECK(zeroed);
+}
+
+BENCH_CASE(SnapshotArena_NoAllocationsOnceWarm_ResetPerCommandList)
+{
+    // d3d12/vulkan: the state block is cleared on every reset_command_list
+    TrackAllSlots();
+    state_block state{};
+    std::mt19937 rng(1);
+
+    uint64_t warmCount = 0;
+    for (uint32_t frame = 0; frame < 1000; frame++)
+    {
+        if (frame == 100)
+        {
+            warmCount = heapAllocations.load(std::memory_order_relaxed);
+        }
+
+        state.clear();
+        RecordFrame(state, rng);
+    }
+
+    const uint64_t allocations = heapAllocations.load(std::memory_order_relaxed) - warmCount;
+    std::printf("  %llu heap allocation(s) in the last 900 frames\n", static_cast<unsigned long long>(allocations));
+    BENCH_CHECK(allocations == 0);
+
+    const double ns = Bench::TimeNs(1000, [&] { state.clear(); RecordFrame(state, rng); });
+    std::printf("  %.0f ns per frame of 300 pushes\n", ns);
+}
+
+BENCH_CASE(SnapshotArena_NoAllocationsOnceWarm_PresentSwap)
+{
+    // d3d9-11: the immediate command list is never reset, at present the bound snapshots move to the other arena
+    TrackAllSlots();
+    state_block state{};
+    std::mt19937 rng(2);
+
+    uint64_t warmCount = 0;
+    for (uint32_t frame = 0; frame < 1000; frame++)
+    {
+        if (frame == 100)
+        {
+            warmCount = heapAllocations.load(std::memory_order_relaxed);
+        }
+
+        RecordFrame(state, rng);
+        state.clear_present(nullptr);
+    }
+
+    const uint64_t allocations = heapAllocations.load(std::memory_order_relaxed) - warmCount;
+    std::printf("  %llu heap allocation(s) in the last 900 frames\n", static_cast<unsigned long long>(allocations));
+    BENCH_CHECK(allocations == 0);
+
+    const double ns = Bench::TimeNs(1000, [&] { RecordFrame(state, rng); state.clear_present(nullptr); });
+    std::printf("  %.0f ns per frame of 300 pushes\n", ns);
+}